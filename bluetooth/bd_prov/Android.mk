@@ -21,6 +21,13 @@ LOCAL_STATIC_LIBRARIES := \
 	CC6_UMIP_ACCESS CC6_ALL_BASIC_LIB
 endif
 
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../include
+
+# Keep writing bd_addr.conf for readers of the text format
+ifneq ($(BD_PROV_TEXT_VIEW),false)
+LOCAL_CFLAGS += -DBD_ADDR_TEXT_VIEW
+endif
+
 LOCAL_SRC_FILES:= \
 	bd_provisioning.c
 LOCAL_CFLAGS += -m32
@@ -32,3 +39,17 @@ LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_EXECUTABLE)
 
+
+#
+# Factory batch mode: allocate and validate BD addresses (host)
+#
+
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../include
+LOCAL_SRC_FILES:= \
+	bd_batch.c \
+	bd_batch_main.c
+LOCAL_LDLIBS := -lrt
+LOCAL_MODULE:= bd_prov_batch
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,280 @@
+/*
+ *  bd_batch.c - factory allocation and validation of BD addresses
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "bd_batch.h"
+
+/* Value of a hex digit, -1 for anything else */
+static inline int hex(unsigned char c)
+{
+	unsigned int v;
+
+	v = c - '0';
+	if (v < 10)
+		return v;
+	v = (c | 0x20) - 'a';
+	if (v < 6)
+		return v + 10;
+	return -1;
+}
+
+/* Decode "XX:XX:XX:XX:XX:XX", with ':' or '-', or 12 plain hex digits.
+ * Returns 0 and the address bytes, or -1 if str is anything else.
+ */
+int bd_parse(const char *str, size_t len, uint8_t *addr)
+{
+	const unsigned char *p = (const unsigned char *)str;
+	int step, i, hi, lo;
+
+	if (len == 17)
+		step = 3;
+	else if (len == 12)
+		step = 2;
+	else
+		return -1;
+
+	for (i = 0; i < 6; i++, p += step) {
+		hi = hex(p[0]);
+		lo = hex(p[1]);
+		if ((hi | lo) < 0)
+			return -1;
+		if (step == 3 && i < 5 && p[2] != ':' && p[2] != '-')
+			return -1;
+		addr[i] = hi << 4 | lo;
+	}
+	return 0;
+}
+
+bd_key_t bd_key(const uint8_t *addr)
+{
+	return (bd_key_t)addr[0] << 40 | (bd_key_t)addr[1] << 32 |
+		(bd_key_t)addr[2] << 24 | addr[3] << 16 | addr[4] << 8 | addr[5];
+}
+
+void bd_unkey(bd_key_t key, uint8_t *addr)
+{
+	int i;
+
+	for (i = 5; i >= 0; i--, key >>= 8)
+		addr[i] = key & 0xff;
+}
+
+static inline size_t bd_hash(bd_key_t key, size_t mask)
+{
+	uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+
+	return (h ^ h >> 29) & mask;
+}
+
+int bd_set_init(struct bd_set *set, size_t expected)
+{
+	size_t size = 1024;
+
+	/* kept at most half full */
+	while (size < expected * 2)
+		size <<= 1;
+	set->slot = calloc(size, sizeof(*set->slot));
+	if (!set->slot)
+		return -1;
+	set->mask = size - 1;
+	set->count = 0;
+	return 0;
+}
+
+void bd_set_release(struct bd_set *set)
+{
+	free(set->slot);
+	set->slot = NULL;
+}
+
+static int bd_set_grow(struct bd_set *set)
+{
+	struct bd_set bigger;
+	size_t i, j;
+
+	if (bd_set_init(&bigger, set->mask + 1) < 0)
+		return -1;
+	for (i = 0; i <= set->mask; i++) {
+		if (!set->slot[i])
+			continue;
+		j = bd_hash(set->slot[i] - 1, bigger.mask);
+		while (bigger.slot[j])
+			j = (j + 1) & bigger.mask;
+		bigger.slot[j] = set->slot[i];
+	}
+	bigger.count = set->count;
+	free(set->slot);
+	*set = bigger;
+	return 0;
+}
+
+/* Returns 1 if key was added, 0 if it was there already */
+int bd_set_add(struct bd_set *set, bd_key_t key)
+{
+	size_t i;
+
+	if (set->count * 2 >= set->mask + 1 && bd_set_grow(set) < 0)
+		return -1;
+
+	for (i = bd_hash(key, set->mask); set->slot[i]; i = (i + 1) & set->mask)
+		if (set->slot[i] == key + 1)
+			return 0;
+	set->slot[i] = key + 1;
+	set->count++;
+	return 1;
+}
+
+int bd_batch_init(struct bd_batch *batch, size_t expected, FILE *out)
+{
+	memset(batch, 0, sizeof(*batch));
+	batch->out = out;
+	batch->timestamp = time(NULL);
+	return bd_set_init(&batch->set, expected);
+}
+
+void bd_batch_release(struct bd_batch *batch)
+{
+	bd_set_release(&batch->set);
+}
+
+/* Check an address must not be handed out by a batch: all zeroes, all
+ * ones, a group address, or a LAP reserved for the inquiry access
+ * codes (0x9E8B00-0x9E8B3F)
+ */
+static inline int bd_addr_reserved(const uint8_t *addr)
+{
+	static const uint8_t zero[6], ones[6] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+	if (!memcmp(addr, zero, 6) || !memcmp(addr, ones, 6))
+		return 1;
+	if (addr[0] & 0x01)
+		return 1;
+	return addr[3] == 0x9e && addr[4] == 0x8b && addr[5] < 0x40;
+}
+
+/* Validate one address and emit its record. Returns 1 if accepted,
+ * 0 if rejected, -1 on errors.
+ */
+int bd_batch_add(struct bd_batch *batch, const uint8_t *addr)
+{
+	struct bd_record rec;
+	int added;
+
+	if (bd_addr_reserved(addr)) {
+		batch->stats.reserved++;
+		return 0;
+	}
+	added = bd_set_add(&batch->set, bd_key(addr));
+	if (added <= 0) {
+		if (!added)
+			batch->stats.duplicate++;
+		return added;
+	}
+	batch->stats.accepted++;
+
+	if (!batch->out)
+		return 1;
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = BD_RECORD_MAGIC;
+	rec.version = BD_RECORD_VERSION;
+	rec.source = BD_SOURCE_FACTORY;
+	memcpy(rec.addr, addr, sizeof(rec.addr));
+	rec.generation = batch->generation;
+	rec.timestamp = batch->timestamp;
+	rec.crc = bd_record_crc(&rec);
+	if (fwrite(&rec, sizeof(rec), 1, batch->out) != 1)
+		return -1;
+	return 1;
+}
+
+/* Mark the addresses of earlier records as taken */
+int bd_batch_exclude(struct bd_batch *batch, const char *records)
+{
+	struct bd_record rec;
+	FILE *in;
+	int err = 0;
+
+	in = fopen(records, "r");
+	if (!in)
+		return -1;
+	while (fread(&rec, sizeof(rec), 1, in) == 1) {
+		if (!bd_record_valid(&rec, sizeof(rec)))
+			continue;
+		if (bd_set_add(&batch->set, bd_key(rec.addr)) < 0) {
+			err = -1;
+			break;
+		}
+	}
+	fclose(in);
+	return err;
+}
+
+/* Take one address per line. Blank lines and lines starting with '#'
+ * are skipped, trailing white space is ignored.
+ */
+int bd_batch_text(struct bd_batch *batch, const char *buf, size_t len)
+{
+	const char *p = buf, *end = buf + len, *eol;
+	uint8_t addr[6];
+	size_t n;
+
+	for (; p < end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		n = eol - p;
+		while (n && (p[n - 1] == '\r' || p[n - 1] == ' ' || p[n - 1] == '\t'))
+			n--;
+		if (!n || p[0] == '#')
+			continue;
+
+		if (bd_parse(p, n, addr) < 0) {
+			batch->stats.malformed++;
+			continue;
+		}
+		if (bd_batch_add(batch, addr) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Allocate count addresses of an OUI, from the 24-bit device part
+ * start on
+ */
+int bd_batch_range(struct bd_batch *batch, uint32_t oui, uint32_t start,
+		unsigned long count)
+{
+	bd_key_t key;
+	uint8_t addr[6];
+
+	if (oui > 0xffffff || start > 0xffffff || count > 0x1000000UL - start) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	key = (bd_key_t)oui << 24 | start;
+	for (; count; count--, key++) {
+		bd_unkey(key, addr);
+		if (bd_batch_add(batch, addr) < 0)
+			return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ *  bd_batch.h - factory allocation and validation of BD addresses
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef BD_BATCH_H
+#define BD_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "bd_addr_record.h"
+
+/* Addresses are handled as 48-bit integers, most significant byte
+ * first as written
+ */
+typedef uint64_t bd_key_t;
+
+/* Set of the addresses handed out so far, open addressing with
+ * linear probing. 0 marks a free slot, keys are stored plus one.
+ */
+struct bd_set {
+	bd_key_t *slot;
+	size_t mask;
+	size_t count;
+};
+
+/* Outcome of a batch */
+struct bd_batch_stats {
+	unsigned long accepted;
+	unsigned long malformed;
+	unsigned long reserved;
+	unsigned long duplicate;
+};
+
+struct bd_batch {
+	struct bd_set set;
+	struct bd_batch_stats stats;
+	FILE *out;		/* records are appended here, NULL for none */
+	uint32_t generation;
+	uint64_t timestamp;
+};
+
+int bd_parse(const char *str, size_t len, uint8_t *addr);
+bd_key_t bd_key(const uint8_t *addr);
+void bd_unkey(bd_key_t key, uint8_t *addr);
+
+int bd_set_init(struct bd_set *set, size_t expected);
+void bd_set_release(struct bd_set *set);
+int bd_set_add(struct bd_set *set, bd_key_t key);
+
+int bd_batch_init(struct bd_batch *batch, size_t expected, FILE *out);
+void bd_batch_release(struct bd_batch *batch);
+int bd_batch_add(struct bd_batch *batch, const uint8_t *addr);
+int bd_batch_exclude(struct bd_batch *batch, const char *records);
+int bd_batch_text(struct bd_batch *batch, const char *buf, size_t len);
+int bd_batch_range(struct bd_batch *batch, uint32_t oui, uint32_t start,
+		unsigned long count);
+
+#endif /* BD_BATCH_H */
@@ -0,0 +1,224 @@
+/*
+ *  bd_batch_main.c - factory batch mode of bd_prov (host)
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bd_batch.h"
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: bd_prov_batch [-o records] [-x used records] "
+			"[-g generation]\n"
+			"\t\t-r OUI:start:count | -i addresses | -B count\n");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Map a text file of addresses, one per line */
+static const char *map_input(const char *name, size_t *len)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	*len = st.st_size;
+	return map;
+}
+
+/* Build count lines of random addresses of one OUI, a few of them
+ * repeated and a few reserved, as a station input would look like
+ */
+static char *bench_input(unsigned long count, size_t *len)
+{
+	char *buf, *p;
+	unsigned long i;
+	uint32_t nic;
+
+	/* room for the terminator snprintf() adds after the last line */
+	buf = malloc(count * 18 + 1);
+	if (!buf)
+		return NULL;
+	srand(1);
+	for (i = 0, p = buf; i < count; i++, p += 18) {
+		nic = (rand() ^ rand() << 12) & 0xffffff;
+		if (i % 100 == 99)
+			nic = 0x9e8b33;
+		snprintf(p, 19, "00:17:E8:%02X:%02X:%02X\n", nic >> 16,
+				(nic >> 8) & 0xff, nic & 0xff);
+	}
+	*len = count * 18;
+	return buf;
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+	const char *out_name = NULL, *used = NULL, *in_name = NULL;
+	const char *input = NULL;
+	char tmp[PATH_MAX];
+	char *bench = NULL;
+	unsigned long count = 0, bench_count = 0;
+	unsigned int oui = 0, start = 0;
+	struct bd_batch batch;
+	struct stat st;
+	FILE *out = NULL;
+	size_t len = 0, expected;
+	double t0, t1;
+	int opt, err;
+	uint32_t generation = 0;
+
+	while ((opt = getopt(argc, argv, "o:x:g:r:i:B:")) != -1) {
+		switch (opt) {
+		case 'o':
+			out_name = optarg;
+			break;
+		case 'x':
+			/* records handed out before */
+			used = optarg;
+			break;
+		case 'g':
+			generation = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			if (sscanf(optarg, "%x:%x:%lu", &oui, &start, &count) != 3) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'i':
+			in_name = optarg;
+			break;
+		case 'B':
+			bench_count = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+	/* exactly one source of addresses */
+	if ((count > 0) + (in_name != NULL) + (bench_count > 0) != 1) {
+		usage();
+		return -1;
+	}
+
+	if (in_name) {
+		input = map_input(in_name, &len);
+		if (!input) {
+			fprintf(stderr, "Can't map %s (%s)\n", in_name, strerror(errno));
+			return -1;
+		}
+	} else if (bench_count) {
+		bench = bench_input(bench_count, &len);
+		if (!bench)
+			return -1;
+		input = bench;
+	}
+
+	if (out_name) {
+		snprintf(tmp, sizeof(tmp), "%s.tmp", out_name);
+		out = fopen(tmp, "w");
+		if (!out) {
+			fprintf(stderr, "Can't create %s (%s)\n", tmp, strerror(errno));
+			return -1;
+		}
+		setvbuf(out, NULL, _IOFBF, 1 << 20);
+	}
+
+	expected = count ? count : len / 13;
+	if (used && !stat(used, &st))
+		expected += st.st_size / sizeof(struct bd_record);
+	if (bd_batch_init(&batch, expected, out) < 0) {
+		fprintf(stderr, "Out of memory\n");
+		goto fail;
+	}
+	batch.generation = generation;
+	if (used && bd_batch_exclude(&batch, used) < 0) {
+		fprintf(stderr, "Can't read %s (%s)\n", used, strerror(errno));
+		goto fail_release;
+	}
+
+	t0 = now();
+	if (count)
+		err = bd_batch_range(&batch, oui, start, count);
+	else
+		err = bd_batch_text(&batch, input, len);
+	t1 = now();
+	if (err < 0) {
+		fprintf(stderr, "Batch failed (%s)\n", strerror(errno));
+		goto fail_release;
+	}
+
+	if (out) {
+		if (fflush(out) || fsync(fileno(out)) < 0 || fclose(out) ||
+				rename(tmp, out_name) < 0) {
+			fprintf(stderr, "Can't write %s (%s)\n", out_name,
+					strerror(errno));
+			unlink(tmp);
+			return -1;
+		}
+	}
+
+	printf("accepted %lu malformed %lu reserved %lu duplicate %lu\n",
+			batch.stats.accepted, batch.stats.malformed,
+			batch.stats.reserved, batch.stats.duplicate);
+	printf("%.3f s, %.2f M addresses/s\n", t1 - t0,
+			(batch.stats.accepted + batch.stats.malformed +
+			 batch.stats.reserved + batch.stats.duplicate) /
+			(t1 - t0) / 1e6);
+
+	bd_batch_release(&batch);
+	free(bench);
+	return 0;
+
+fail_release:
+	bd_batch_release(&batch);
+fail:
+	/* no partial batch is left behind */
+	if (out) {
+		fclose(out);
+		unlink(tmp);
+	}
+	free(bench);
+	return -1;
+}
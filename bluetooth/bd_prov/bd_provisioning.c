@@ -18,7 +18,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <time.h>
 #include <sys/stat.h>
 
@@ -28,6 +32,8 @@
 #include <cutils/log.h>
 #include <cutils/properties.h>
 
+#include "bd_addr_record.h"
+
 #define LOG_TAG "bd_prov"
 
 #define BD_ADDRESS_LEN 6
@@ -38,6 +44,15 @@
 #define BD_ADDR_FILE_NAME	"/config/bt/bd_addr.conf"
 #define BD_LEN			18
 
+/* The security engines expose no cheap way to tell their content
+ * changed. The generation covers what changes when it is provisioned
+ * again: the board serial number, and a property factory tools bump
+ * to force a new read. That one must stay writable after boot, ro.*
+ * properties are set once. bd_prov -f forces a read as well.
+ */
+#define BD_SERIAL_PROP		"ro.serialno"
+#define BD_GENERATION_PROP	"persist.bd_prov.generation"
+
 #if (BUILD_WITH_CHAABI_SUPPORT || BUILD_WITH_TXEI_SUPPORT)
 
 #include "umip_access.h"
@@ -67,23 +82,161 @@ int get_bd_address(unsigned char **bd_addr_buf){
 
 #endif /* (BUILD_WITH_CHAABI_SUPPORT || BUILD_WITH_TXEI_SUPPORT) */
 
+#if (BUILD_WITH_CHAABI_SUPPORT || BUILD_WITH_TOKEN_SUPPORT || BUILD_WITH_TXEI_SUPPORT)
+
+#if BUILD_WITH_CHAABI_SUPPORT
+#define BD_SOURCE	BD_SOURCE_CHAABI
+#elif BUILD_WITH_TXEI_SUPPORT
+#define BD_SOURCE	BD_SOURCE_TXEI
+#else
+#define BD_SOURCE	BD_SOURCE_TOKEN
+#endif
+
+static uint32_t get_generation(void)
+{
+	char value[PROPERTY_VALUE_MAX];
+	uint32_t gen;
+
+	property_get(BD_SERIAL_PROP, value, "");
+	gen = bd_crc32(0, value, strlen(value));
+	property_get(BD_GENERATION_PROP, value, "0");
+	return bd_crc32(gen, value, strlen(value));
+}
+
+/* Read the record of the last provisioning, 0 if there is no valid one */
+static int read_record(struct bd_record *rec)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(BD_RECORD_PATH, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	len = pread(fd, rec, sizeof(*rec), 0);
+	close(fd);
+	return bd_record_valid(rec, len);
+}
+
+/* Replace the record atomically: readers see the old or the new one */
+static int write_record(const unsigned char *addr, uint32_t gen)
+{
+	struct bd_record rec;
+	char tmp[] = BD_RECORD_PATH ".tmp";
+	char dir[] = BD_RECORD_PATH;
+	int fd, err = 0;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = BD_RECORD_MAGIC;
+	rec.version = BD_RECORD_VERSION;
+	rec.source = BD_SOURCE;
+	memcpy(rec.addr, addr, sizeof(rec.addr));
+	rec.generation = gen;
+	rec.timestamp = time(NULL);
+	rec.crc = bd_record_crc(&rec);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		LOGE("Error %s while opening %s", strerror(errno), tmp);
+		return -1;
+	}
+	/* ensure it can be opened later for reading */
+	fchmod(fd, 0664);
+	if (write(fd, &rec, sizeof(rec)) != sizeof(rec) || fsync(fd) < 0)
+		err = -1;
+	close(fd);
+	if (err || rename(tmp, BD_RECORD_PATH) < 0) {
+		LOGE("Error %s while writing %s", strerror(errno), BD_RECORD_PATH);
+		unlink(tmp);
+		return -1;
+	}
+
+	/* make the rename itself durable */
+	*strrchr(dir, '/') = '\0';
+	fd = open(dir, O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	return 0;
+}
+
+#ifdef BD_ADDR_TEXT_VIEW
+/* Keep the text file older readers use in line with the record,
+ * it is only written when it differs
+ */
+static void update_text_view(const unsigned char *addr)
+{
+	char *bd_addr_file_name = BD_ADDR_FILE_NAME;
+	char bd_address_str[BD_LEN];
+	char current[BD_LEN];
+	FILE *bd_addr_file;
+	size_t len = 0;
+	int res;
+
+	snprintf(bd_address_str, sizeof(bd_address_str), "%02X:%02X:%02X:%02X:%02X:%02X",
+		addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+
+	bd_addr_file = fopen(bd_addr_file_name, "r");
+	if (bd_addr_file) {
+		len = fread(current, 1, sizeof(current), bd_addr_file);
+		fclose(bd_addr_file);
+	}
+	if (len == BD_LEN - 1 && !memcmp(current, bd_address_str, len))
+		return;
+
+	LOGD("Open file %s for writing\n", bd_addr_file_name);
+	bd_addr_file = fopen(bd_addr_file_name, "w");
+	if (bd_addr_file == NULL) {
+		LOGE("Error %s while opening %s\n", strerror(errno), bd_addr_file_name);
+		return;
+	}
+	res = fprintf(bd_addr_file, "%s", bd_address_str);
+	if (res)
+		LOGD("BD address written successfully");
+	else
+		LOGE("Error %s, failed to write BD address", strerror(errno));
+	fflush(bd_addr_file);
+	fclose(bd_addr_file);
+	//change BD addr file permission,ensure it can be opened later for reading
+	res = chmod(bd_addr_file_name, 0664);
+	if (res < 0)
+		LOGE("BD addr_file change permission failure");
+}
+#else
+static inline void update_text_view(const unsigned char *addr)
+{
+}
+#endif /* BD_ADDR_TEXT_VIEW */
+
+#endif /* (BUILD_WITH_CHAABI_SUPPORT || BUILD_WITH_TOKEN_SUPPORT || BUILD_WITH_TXEI_SUPPORT) */
+
 
 int main(int argc, char **argv)
 {
 	unsigned char *bd_addr_buf = NULL;
 	int res = NO_ERR;
-	char state[PROPERTY_VALUE_MAX];
-	FILE *bd_addr_file = NULL;
-	char *bd_addr_file_name = BD_ADDR_FILE_NAME;
-	char bd_address_str[BD_LEN] = "00:00:00:00:00:00";
+	int force = 0;
+#if (BUILD_WITH_CHAABI_SUPPORT || BUILD_WITH_TOKEN_SUPPORT || BUILD_WITH_TXEI_SUPPORT)
+	struct bd_record rec;
+	uint32_t gen;
+#endif
 
 	/* Check parameters */
-	if (argc != 1) {
-		/* No param expected */
+	if (argc == 2 && !strcmp(argv[1], "-f")) {
+		/* read secure storage even if the record is valid */
+		force = 1;
+	} else if (argc != 1) {
 		return ERR_WRONG_PARAM;
 	}
 
 #if (BUILD_WITH_CHAABI_SUPPORT || BUILD_WITH_TOKEN_SUPPORT || BUILD_WITH_TXEI_SUPPORT)
+	gen = get_generation();
+	if (!force && read_record(&rec) && rec.generation == gen) {
+		LOGD("BD address record is up to date");
+		update_text_view(rec.addr);
+		return NO_ERR;
+	}
+
 	/* Read BD address from Chaabi */
 	LOGV("Retrieving BD address...");
 	res = get_bd_address(&bd_addr_buf);
@@ -107,38 +260,20 @@ int main(int argc, char **argv)
 				bd_addr_buf[4], bd_addr_buf[5]);
 	}
 	if (bd_addr_buf) {
-		/* write to file */
-		LOGD("Open file %s for writing\n", bd_addr_file_name);
-		bd_addr_file = fopen(bd_addr_file_name, "w");
-		if (bd_addr_file != NULL) {
-			snprintf(bd_address_str, sizeof(bd_address_str), "%02X:%02X:%02X:%02X:%02X:%02X",
-				bd_addr_buf[0], bd_addr_buf[1],
-				bd_addr_buf[2], bd_addr_buf[3],
-				bd_addr_buf[4], bd_addr_buf[5]);
-			res = fprintf(bd_addr_file, "%s", bd_address_str);
-			if (res)
-				LOGD("BD address written successfully");
-			else
-				LOGE("Error %s, failed to write BD address", strerror(errno));
-			fflush(bd_addr_file);
-			fclose(bd_addr_file);
-                        //change BD addr file permission,ensure it can be opened later for reading
-                        res=chmod(bd_addr_file_name, 0664);
-                        if(res < 0)
-                              LOGE("BD addr_file change permission failure");
-                        else
-                              LOGD("BD addr_file  change permission success");
-		}
-		else {
-			LOGE("Error %s while opening %s\n", strerror(errno), bd_addr_file_name);
-			return errno;
+		if (write_record(bd_addr_buf, gen) < 0) {
+			res = errno;
+			free(bd_addr_buf);
+			return res;
 		}
+		LOGD("BD address record written successfully");
+		update_text_view(bd_addr_buf);
 		/* deallocate buffer set by get_bd_address() */
 		free(bd_addr_buf);
 	} else {
 		LOGE("No chaabi BD address");
 	}
 #else
+	(void)force;
 	LOGE("Chaabi not supported, "
 			"BD address diversification is not available");
 #endif /* (BUILD_WITH_CHAABI_SUPPORT || BUILD_WITH_TOKEN_SUPPORT || BUILD_WITH_TXEI_SUPPORT) */
@@ -0,0 +1,86 @@
+/*
+ *  bd_addr_record.h - provisioned bluetooth device address record
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef BD_ADDR_RECORD_H
+#define BD_ADDR_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Written by bd_prov, read by uim with a single pread(). The file is
+ * replaced atomically, so readers see either the old or the new
+ * record, and the CRC catches anything else.
+ */
+#define BD_RECORD_PATH		"/config/bt/bd_addr.bin"
+#define BD_RECORD_MAGIC		0x52444142	/* "BADR" */
+#define BD_RECORD_VERSION	1
+
+/* Where the address came from */
+enum bd_record_source {
+	BD_SOURCE_UNKNOWN,
+	BD_SOURCE_CHAABI,
+	BD_SOURCE_TXEI,
+	BD_SOURCE_TOKEN,
+	BD_SOURCE_FACTORY,	/* allocated by bd_prov_batch */
+};
+
+/* Fields are in host byte order, addr in the order it is written
+ * as text, most significant byte first
+ */
+struct bd_record {
+	uint32_t magic;
+	uint16_t version;
+	uint8_t source;
+	uint8_t reserved;
+	uint8_t addr[6];
+	uint8_t reserved2[2];
+	uint32_t generation;	/* of secure storage when it was read */
+	uint32_t crc;		/* CRC-32 of the record with crc zero */
+	uint64_t timestamp;	/* seconds since the epoch */
+};
+
+static inline uint32_t bd_crc32(uint32_t crc, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	int i;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static inline uint32_t bd_record_crc(const struct bd_record *rec)
+{
+	struct bd_record tmp = *rec;
+
+	tmp.crc = 0;
+	return bd_crc32(0, &tmp, sizeof(tmp));
+}
+
+/* Check len bytes read from the record file hold a valid record */
+static inline int bd_record_valid(const struct bd_record *rec, long len)
+{
+	return len == (long)sizeof(*rec) && rec->magic == BD_RECORD_MAGIC &&
+		rec->version == BD_RECORD_VERSION &&
+		rec->crc == bd_record_crc(rec);
+}
+
+#endif /* BD_ADDR_RECORD_H */
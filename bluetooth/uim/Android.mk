@@ -1,16 +1,129 @@
 LOCAL_PATH:= $(call my-dir)
+
+# Bring-up engine shared by the daemon and the host tools: HCI framing
+# and commands over a pluggable transport, termios, BD address and
+# init script handling
+UIM_LIB_SRC_FILES:= \
+	uim.c \
+	uim_transport.c \
+	uim_rx.c \
+	uim_hci.c \
+	uim_trace.c \
+	uim_baud.c \
+	uim_cfg.c \
+	uim_snoop.c \
+	uim_log.c \
+	uim_bts.c \
+	uim_bts_img.c \
+	uim_rtt.c \
+	uim_link.c \
+	uim_metrics.c \
+	uim_mux.c
+
+#
+# libuim
+#
+
 include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= $(UIM_LIB_SRC_FILES)
+LOCAL_CFLAGS:= -m32
+LOCAL_MODULE:=libuim
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= $(UIM_LIB_SRC_FILES)
+LOCAL_MODULE:=libuim
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_STATIC_LIBRARY)
 
 #
 # UIM Application
 #
 
-LOCAL_C_INCLUDES:= uim.h
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES:= uim.h \
+	$(LOCAL_PATH)/../include
 
 LOCAL_SRC_FILES:= \
-	uim.c
+	uim_main.c \
+	uim_loop.c \
+	uim_queue.c \
+	uim_ctl.c
 LOCAL_CFLAGS:= -m32
+LOCAL_STATIC_LIBRARIES:= libuim
 LOCAL_SHARED_LIBRARIES:= libnetutils liblog
 LOCAL_MODULE:=uim
 LOCAL_MODULE_TAGS := optional
 include $(BUILD_EXECUTABLE)
+
+#
+# Metrics reader
+#
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= \
+	uim_stat.c
+LOCAL_CFLAGS:= -m32
+LOCAL_STATIC_LIBRARIES:= libuim
+LOCAL_SHARED_LIBRARIES:= liblog
+LOCAL_MODULE:=uim_stat
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+#
+# WL1283 controller simulator (host)
+#
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= \
+	uim_sim.c \
+	uim_sim_main.c
+LOCAL_STATIC_LIBRARIES:= libuim
+LOCAL_LDLIBS:= -lpthread
+LOCAL_MODULE:=uim_sim
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+#
+# Bring-up latency benchmark against the simulator (host)
+#
+
+UIM_BENCH_WRAP:= open close read write writev poll ioctl fcntl \
+	tcflush tcgetattr tcsetattr nanosleep
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= \
+	uim_sim.c \
+	uim_bench.c
+LOCAL_STATIC_LIBRARIES:= libuim
+LOCAL_LDFLAGS:= $(foreach f,$(UIM_BENCH_WRAP),-Wl,--wrap=$(f))
+LOCAL_LDLIBS:= -lpthread -lrt
+LOCAL_MODULE:=uim_bench
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+#
+# HCI engine microbenchmarks over the in-memory transport (host)
+#
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= \
+	uim_microbench.c
+LOCAL_STATIC_LIBRARIES:= libuim
+LOCAL_LDLIBS:= -lpthread -lrt
+LOCAL_MODULE:=uim_microbench
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+#
+# BTS init script compiler (host)
+#
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= \
+	uim_btsc.c
+LOCAL_STATIC_LIBRARIES:= libuim
+LOCAL_MODULE:=uim_btsc
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
@@ -28,252 +28,597 @@
 #include <termios.h>
 #include <poll.h>
 #include <stdint.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <sys/types.h>
+#include <limits.h>
 #ifdef ANDROID
 #include <private/android_filesystem_config.h>
 #endif
 
 #include "uim.h"
+#include "uim_rx.h"
+#include "uim_hci.h"
+#include "uim_trace.h"
+#include "uim_baud.h"
+#include "uim_cfg.h"
+#include "uim_inst.h"
+#include "uim_bts.h"
+#include "uim_link.h"
+#include "uim_mux.h"
+
+/* Line discipline installed once the UART is configured */
+int line_discipline = N_TI_WL;
+/* Select the UART rate by probing instead of using the KIM one */
+int baud_autotune;
+/* Where the probed rates are remembered */
+const char *baud_cache_file = UIM_BAUD_CACHE_FILE;
+/* Keep the UART open and configured between bring-ups */
+int warm_uart;
+/* Init script to download, or directory to pick it from by version */
+const char *fw_path;
+/* Measure the link instead of handing it to the driver */
+const struct uim_link_cfg *link_bench;
+/* Serve the channels from user space with ptys in this directory
+ * instead of installing the line discipline
+ */
+const char *mux_dir;
 
-/* Maintains the exit state of UIM*/
-static int exiting;
-#define UIM_DEBUG
+/* Pointer to array of hex bytes of the BD address to program */
+bdaddr_t *bd_addr;
 
-/* Maintains the exit state of UIM*/
-static int exiting;
-static int line_discipline;
-static int dev_fd;
+/*****************************************************************************/
+/* Function to set up an instance for the KIM driver exported at dir */
+void uim_inst_init(struct uim_inst *inst, const char *dir, int index)
+{
+	const char *name;
+
+	memset(inst, 0, sizeof(*inst));
+	snprintf(inst->dir, sizeof(inst->dir), "%s", dir);
+	name = strrchr(inst->dir, '/');
+	snprintf(inst->name, sizeof(inst->name), "%s", name ? name + 1 : dir);
+	inst->index = index;
+	inst->dev_fd = -1;
+	inst->cancel_fd = -1;
+	uim_cfg_init(&inst->cfg, inst->dir);
+	uim_snoop_init(&inst->snoop);
+	uim_rtt_init(&inst->rtt);
+	uim_metrics_init(&inst->metrics, inst->name);
+}
 
-/* BD address as string and a pointer to array of hex bytes */
-char uim_bd_address[BD_ADDR_LEN+1];
-bdaddr_t *bd_addr;
+/* Function to open one of the attributes exported by the KIM driver */
+int kim_attr_open(const struct uim_inst *inst, const char *attr)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", inst->dir, attr) >=
+			(int)sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return open(path, O_RDONLY);
+}
 
 /*****************************************************************************/
-#ifdef UIM_DEBUG
-/*  Function to Read the firmware version
- *  module into the system. Currently used for
+/* HCI commands of the bring-up sequence */
+static const struct uim_hci_desc hci_change_speed = {
+	.name = "change_speed",
+	.opcode = HCI_HDR_OPCODE,
+	.plen = 4,
+	.reply = UIM_REPLY_CMD_COMPLETE,
+	.timeout_ms = UIM_RX_TIMEOUT_MS,
+	/* the controller switches right after answering, a resend
+	 * would go out at the wrong rate
+	 */
+	.retries = 0,
+};
+
+static const struct uim_hci_desc hci_write_bd_addr = {
+	.name = "write_bd_addr",
+	.opcode = WRITE_BD_ADDR_OPCODE,
+	.plen = sizeof(bdaddr_t),
+	.reply = UIM_REPLY_CMD_COMPLETE,
+	.timeout_ms = UIM_RX_TIMEOUT_MS,
+	.retries = 2,
+};
+
+/* Round trip proving a new rate works both ways */
+static const struct uim_hci_desc hci_link_check = {
+	.name = "link_check",
+	.opcode = HCI_READ_LOCAL_VERSION_OPCODE,
+	.plen = 0,
+	.reply = UIM_REPLY_CMD_COMPLETE,
+	.rsp_len = HCI_LOCAL_VERSION_LEN,
+	.timeout_ms = UIM_BAUD_PROBE_TIMEOUT_MS,
+	.retries = 0,
+};
+
+static const struct uim_hci_desc hci_read_local_version = {
+	.name = "read_local_version",
+	.opcode = HCI_READ_LOCAL_VERSION_OPCODE,
+	.plen = 0,
+	.reply = UIM_REPLY_CMD_COMPLETE,
+	.rsp_len = HCI_LOCAL_VERSION_LEN,
+	.timeout_ms = UIM_RX_TIMEOUT_MS,
+	.retries = 2,
+};
+
+/* Entry of the init command table */
+struct uim_init_cmd {
+	const struct uim_hci_desc *desc;
+	enum uim_trace_phase phase;
+	int required;		/* failing it fails the bring-up */
+	/* sets the parameters, returns -1 to skip the command */
+	int (*prepare)(struct uim_inst *inst, const unsigned char **param);
+	/* called once the command completed successfully */
+	void (*done)(struct uim_inst *inst, const struct uim_hci_cmd *cmd);
+};
+
+/* Function to ask for the firmware version only when it is logged */
+static int local_version_prepare(struct uim_inst *inst,
+		const unsigned char **param)
+{
+	return uim_log_level >= UIM_LOG_VER ? 0 : -1;
+}
+
+/*  Function to log the firmware version
+ *  read back from the controller. Currently used for
  *  debugging purpose, whenever the baud rate is changed
  */
-void read_firmware_version(int dev_fd)
+static void read_firmware_version(struct uim_inst *inst,
+		const struct uim_hci_cmd *cmd)
 {
-	int index = 0;
-	char resp_buffer[20] = { 0 };
-	unsigned char buffer[] = { 0x01, 0x01, 0x10, 0x00 };
+	const unsigned char *v = cmd->rsp;
 
 	UIM_START_FUNC();
-	UIM_VER(" wrote %d bytes", (int) write(dev_fd, buffer, 4));
-	UIM_VER(" reading %d bytes", (int) read(dev_fd, resp_buffer, 15));
 
-	for (index = 0; index < 15; index++)
-		UIM_VER(" %x ", resp_buffer[index]);
+	UIM_VER(" %s: hci %d rev 0x%04x lmp %d manufacturer %d subversion 0x%04x",
+			inst->name, v[0], v[1] | v[2] << 8, v[3], v[4] | v[5] << 8,
+			v[6] | v[7] << 8);
+}
 
-	printf("\n");
+/* Function to prepare the BD address command, skipped without address.
+ * The provisioned address belongs to the first instance only, the
+ * others keep the address of their chip.
+ */
+static int bd_addr_prepare(struct uim_inst *inst, const unsigned char **param)
+{
+	if (!bd_addr || inst->index)
+		return -1;
+	*param = bd_addr->b;
+	return 0;
 }
-#endif
 
-/*****************************************************************************/
-/* Function to read the HCI event from the given file descriptor
+static void bd_addr_done(struct uim_inst *inst, const struct uim_hci_cmd *cmd)
+{
+	UIM_VER("BD address changed to %02X:%02X:%02X:%02X:%02X:%02X",
+			cmd->param[0], cmd->param[1], cmd->param[2],
+			cmd->param[3], cmd->param[4], cmd->param[5]);
+}
+
+/* Function to prepare the link check, only a stored rate needs it */
+static int link_check_prepare(struct uim_inst *inst,
+		const unsigned char **param)
+{
+	return inst->link_unverified ? 0 : -1;
+}
+
+static void link_check_done(struct uim_inst *inst,
+		const struct uim_hci_cmd *cmd)
+{
+	inst->link_unverified = 0;
+}
+
+/* Commands sent once the UART runs at its final speed. They do not
+ * depend on each other and are all pipelined, adding one only takes
+ * a description and an entry in this table.
+ */
+static const struct uim_init_cmd init_cmds[] = {
+	{ &hci_link_check, UIM_TRACE_BAUD_PROBE, 1,
+		link_check_prepare, link_check_done },
+	{ &hci_write_bd_addr, UIM_TRACE_BD_ADDR, 0,
+		bd_addr_prepare, bd_addr_done },
+	{ &hci_read_local_version, UIM_TRACE_FW_VERSION, 0,
+		local_version_prepare, read_firmware_version },
+};
+
+#define INIT_CMDS	(sizeof(init_cmds) / sizeof(init_cmds[0]))
+
+/* Function to send the init commands
  *
- * This will parse the response received and returns error
- * if the required response is not received
+ * Everything is submitted first and the replies collected afterwards,
+ * so the commands overlap as much as the controller credits allow.
+ * Returns -1 if a required command failed.
  */
-int read_hci_event(int fd, unsigned char *buf, int size)
+static int send_init_cmds(struct uim_inst *inst)
 {
-	int remain, rd;
-	int count = 0;
-	int reading = 1;
-	int rd_retry_count = 0;
-	struct timespec tm = { 0, 50 * 1000 * 1000 };
+	struct uim_hci_cmd cmds[INIT_CMDS];
+	unsigned char rsp[INIT_CMDS][UIM_HCI_RSP_MAX];
+	const unsigned char *param;
+	unsigned int i;
+	int err = 0;
 
-	UIM_START_FUNC();
+	for (i = 0; i < INIT_CMDS; i++) {
+		cmds[i].state = UIM_CMD_IDLE;
+		param = NULL;
+		if (init_cmds[i].prepare && init_cmds[i].prepare(inst, &param) < 0)
+			continue;
 
-	UIM_VER(" read_hci_event");
-	if (size <= 0)
-		return -1;
+		uim_trace_begin(&inst->trace, init_cmds[i].phase);
+		uim_hci_cmd_init(&cmds[i], init_cmds[i].desc, param, 0);
+		cmds[i].rsp = rsp[i];
+		cmds[i].rsp_size = sizeof(rsp[i]);
+		uim_hci_submit(&inst->hci, &cmds[i]);
+	}
 
-	/* The first byte identifies the packet type. For HCI event packets, it
-	 * should be 0x04, so we read until we get to the 0x04. */
-	while (reading) {
-		rd = read(fd, buf, 1);
-		if (rd <= 0 && rd_retry_count++ < 4) {
-			nanosleep(&tm, NULL);
+	for (i = 0; i < INIT_CMDS; i++) {
+		if (cmds[i].state == UIM_CMD_IDLE)
 			continue;
-		} else if (rd_retry_count >= 4) {
-			return -1;
-		}
 
-		if (buf[0] == RESP_PREFIX) {
-			break;
+		if (uim_hci_wait(&inst->hci, &cmds[i]) < 0) {
+			UIM_ERR(" %s: %s", init_cmds[i].desc->name,
+					uim_hci_cmd_result(&cmds[i]));
+			if (init_cmds[i].required)
+				err = -1;
+			continue;
 		}
+		uim_trace_end(&inst->trace, init_cmds[i].phase);
+		if (init_cmds[i].done)
+			init_cmds[i].done(inst, &cmds[i]);
 	}
-	count++;
 
-	/* The next two bytes are the event code and parameter total length. */
-	while (count < 3) {
-		rd = read(fd, buf + count, 3 - count);
-		if (rd <= 0)
-			return -1;
-		count += rd;
-	}
+	/* nothing may be left referencing the commands above */
+	uim_hci_reset(&inst->hci);
 
-	/* Now we read the parameters. */
-	if (buf[2] < (size - 3))
-		remain = buf[2];
-	else
-		remain = size - 3;
+	return err;
+}
 
-	while ((count - 3) < remain) {
-		rd = read(fd, buf + count, remain - (count - 3));
-		if (rd <= 0)
-			return -1;
-		count += rd;
+/* Function to set the default baud rate
+ *
+ * The default baud rate of 115200 is set to the UART from the host side
+ * by making a call to this function.This function is also called before
+ * making a call to set the custom baud rate
+ */
+static int set_baud_rate(struct uim_transport *t)
+{
+	UIM_START_FUNC();
+
+	uim_transport_flush(t, TCIOFLUSH);
+
+	/* raw mode with hardware flow control at the default rate */
+	if (uim_transport_set_rate(t, UIM_BAUD_DEFAULT, 1) < 0) {
+		UIM_ERR(" Can't set port settings");
+		return -1;
 	}
 
-	return count;
+	uim_transport_flush(t, TCIOFLUSH);
+	UIM_DBG(" set_baud_rate() done");
+
+	return 0;
 }
 
-/* Function to read the Command complete event
+/* Function to set the UART custom baud rate.
  *
- * This will read the response for the change speed
- * command that was sent to configure the UART speed
- * with the custom baud rate
- */
-static int read_command_complete(int fd, unsigned short opcode)
+ * The UART baud rate has already been
+ * set to default value 115200 before calling this function.
+ * The baud rate is then changed to custom baud rate by this function*/
+static int set_custom_baud_rate(struct uim_transport *t, int baud_rate,
+		int flow_ctrl)
 {
-	command_complete_t resp;
-
 	UIM_START_FUNC();
 
-	UIM_VER(" Command complete started");
-	if (read_hci_event(fd, (unsigned char *) &resp, sizeof(resp)) < 0) {
-		UIM_ERR(" Invalid response");
+	/* Flush non-transmitted output data,
+	 * non-read input data or both*/
+	uim_transport_flush(t, TCIOFLUSH);
+
+	/* Set the UART flow control and the actual baud rate, the
+	 * transport checks the rate the driver could program
+	 */
+	if (uim_transport_set_rate(t, baud_rate, flow_ctrl) < 0)
 		return -1;
+
+	UIM_DBG(" set_custom_baud_rate() done");
+	return 0;
+}
+
+/* Function to close the UART, dropping what was cached about it */
+static void close_uart(struct uim_inst *inst)
+{
+	if (inst->mux) {
+		uim_mux_stop(inst->mux);
+		inst->mux = NULL;
 	}
+	if (inst->dev_fd >= 0)
+		close(inst->dev_fd);
+	inst->dev_fd = -1;
+	uim_transport_close(&inst->tr);
+	inst->baud = 0;
+}
+
+/* Function to open the UART, in warm mode the open one is reused as
+ * long as the KIM still names the same device
+ */
+static int open_uart(struct uim_inst *inst, const char *name)
+{
+	if (warm_uart && inst->dev_fd >= 0 && !strcmp(inst->dev_fd_name, name))
+		return 0;
 
-	/* Response should be an event packet */
-	if (resp.uart_prefix != HCI_EVENT_PKT) {
-		UIM_ERR
-			(" Error in response: not an event packet, but 0x%02x!",
-				resp.uart_prefix);
+	close_uart(inst);
+	inst->dev_fd = open(name, warm_uart ? O_RDWR | O_NONBLOCK : O_RDWR);
+	if (inst->dev_fd < 0) {
+		UIM_ERR("Can't open %s, error (%s)", name, strerror(errno));
 		return -1;
 	}
+	snprintf(inst->dev_fd_name, sizeof(inst->dev_fd_name), "%s", name);
+	/* every line setting goes through the transport from here on */
+	uim_transport_fd(&inst->tr, inst->dev_fd);
 
-	/* Response should be a command complete event */
-	if (resp.hci_hdr.evt != EVT_CMD_COMPLETE) {
-		/* event must be event-complete */
-		UIM_ERR
-			(" Error in response: not a cmd-complete event,but 0x%02x!",
-				resp.hci_hdr.evt);
+	return 0;
+}
+
+static int set_host_rate(struct uim_inst *inst, long rate, int flow_ctrl);
+
+/* Function to switch controller and host to a new rate
+ *
+ * The controller answers the speed change at the old rate and
+ * switches afterwards, the host follows once the answer is in.
+ */
+static int change_speed(struct uim_inst *inst, long rate, int flow_ctrl)
+{
+	unsigned char speed[4];
+	struct uim_hci_cmd speed_cmd;
+
+	UIM_VER("Setting speed to %ld", rate);
+	/* Forming the packet for Change speed command */
+	speed[0] = rate & 0xff;
+	speed[1] = (rate >> 8) & 0xff;
+	speed[2] = (rate >> 16) & 0xff;
+	speed[3] = (rate >> 24) & 0xff;
+	uim_hci_cmd_init(&speed_cmd, &hci_change_speed, speed, 0);
+
+	/* Writing the change speed command to the UART
+	 * This will change the UART speed at the controller
+	 * side
+	 */
+	uim_trace_begin(&inst->trace, UIM_TRACE_SPEED_CHANGE_WRITE);
+	if (uim_hci_submit(&inst->hci, &speed_cmd) < 0) {
+		UIM_ERR("Failed to write speed-set command");
+		uim_hci_reset(&inst->hci);
 		return -1;
 	}
+	uim_trace_end(&inst->trace, UIM_TRACE_SPEED_CHANGE_WRITE);
 
-	if (resp.hci_hdr.plen < 4) {
-		/* plen >= 4 for EVT_CMD_COMPLETE */
-		UIM_ERR(" Error in response: plen is not >= 4, but 0x%02x!",
-				resp.hci_hdr.plen);
+	/* Read the response for the Change speed command,
+	 * nothing else may be sent before the host follows
+	 */
+	uim_trace_begin(&inst->trace, UIM_TRACE_SPEED_CHANGE_WAIT);
+	if (uim_hci_wait(&inst->hci, &speed_cmd) < 0) {
+		UIM_ERR("Speed change to %ld failed: %s", rate,
+				uim_hci_cmd_result(&speed_cmd));
+		uim_hci_reset(&inst->hci);
 		return -1;
 	}
+	uim_trace_end(&inst->trace, UIM_TRACE_SPEED_CHANGE_WAIT);
 
-	if (resp.cmd_complete.opcode != (unsigned short) opcode) {
-		UIM_ERR(" Error in response: opcode is 0x%04x, not 0x%04x!",
-				resp.cmd_complete.opcode, opcode);
+	UIM_VER(" Speed changed to %ld", rate);
+
+	return set_host_rate(inst, rate, flow_ctrl);
+}
+
+/* Function to move the host side of the UART to a new rate */
+static int set_host_rate(struct uim_inst *inst, long rate, int flow_ctrl)
+{
+	/* Set the actual custom baud rate at the host side */
+	uim_trace_begin(&inst->trace, UIM_TRACE_SET_CUSTOM_BAUD_RATE);
+	if (warm_uart) {
+		if (uim_transport_set_rate(&inst->tr, rate, flow_ctrl) < 0)
+			return -1;
+		/* whatever came in during the switch is garbage */
+		uim_transport_flush(&inst->tr, TCIFLUSH);
+	} else if (set_custom_baud_rate(&inst->tr, rate, flow_ctrl) < 0) {
+		UIM_ERR("set_custom_baud_rate() failed");
 		return -1;
 	}
+	uim_trace_end(&inst->trace, UIM_TRACE_SET_CUSTOM_BAUD_RATE);
+	inst->baud = rate;
+	uim_hci_set_rtt(&inst->hci, &inst->rtt, rate);
+	/* set_custom_baud_rate() flushed the driver queues */
+	uim_rx_flush(&inst->rx);
 
-	UIM_DBG(" Command complete done");
-	return resp.status == 0 ? 0 : -1;
+	return 0;
 }
 
-/* Function to set the default baud rate
+/* Function to check both directions work at the current rate */
+static int check_link(struct uim_inst *inst)
+{
+	struct uim_hci_cmd cmd;
+	unsigned char rsp[HCI_LOCAL_VERSION_LEN];
+	int err;
+
+	uim_hci_cmd_init(&cmd, &hci_link_check, NULL, 0);
+	cmd.rsp = rsp;
+	cmd.rsp_size = sizeof(rsp);
+	err = uim_hci_send(&inst->hci, &cmd);
+	if (err < 0) {
+		UIM_DBG(" link check: %s", uim_hci_cmd_result(&cmd));
+		/* drop whatever garbage arrived at the wrong rate */
+		uim_rx_flush(&inst->rx);
+	}
+	uim_hci_reset(&inst->hci);
+
+	return err;
+}
+
+/* Function to check whether the bring-up was called off meanwhile,
+ * checked between steps so that an abort never waits for a reply
+ */
+static int cancelled(struct uim_inst *inst)
+{
+	if (!inst->cancel)
+		return 0;
+	UIM_DBG(" Bring-up of %s cancelled", inst->name);
+	return 1;
+}
+
+/* Function to drop the stored rate that just failed,
+ * the next bring-up probes again
+ */
+static void forget_baud(struct uim_inst *inst, const char *dev)
+{
+	char board[UIM_BAUD_BOARD_LEN];
+
+	UIM_ERR("Stored rate does not hold, forgetting it");
+	uim_baud_board_id(board, sizeof(board));
+	uim_baud_cache_store(baud_cache_file, board, dev, 0);
+	inst->link_unverified = 0;
+}
+
+/* Function to move to the fastest rate that holds
  *
- * The default baud rate of 115200 is set to the UART from the host side
- * by making a call to this function.This function is also called before
- * making a call to set the custom baud rate
+ * A rate stored for this board and UART is tried first. Otherwise
+ * the ladder is walked down from the fastest rate, skipping those the
+ * host divisor cannot produce accurately, and every step is proven by
+ * a round trip. A failing step is left in-band: the next speed change
+ * goes out at the rate that just failed, which still reaches the
+ * controller when only the fast return path was unreliable.
+ * The winner is stored so the next bring-up skips the probing.
  */
-static int set_baud_rate(int dev_fd)
+static int autotune_baud(struct uim_inst *inst, const char *dev, int flow_ctrl)
 {
+	char board[UIM_BAUD_BOARD_LEN];
+	long base, rate, limit;
+	int i;
+
 	UIM_START_FUNC();
-	struct termios ti;
 
-	tcflush(dev_fd, TCIOFLUSH);
+	inst->link_unverified = 0;
+	uim_baud_board_id(board, sizeof(board));
+	limit = LONG_MAX;
 
-	/* Get the attributes of UART */
-	if (tcgetattr(dev_fd, &ti) < 0) {
-		UIM_ERR(" Can't get port settings");
-		return -1;
+	/* a stored rate is proven by the link check among the
+	 * pipelined init commands instead of a round trip of its own
+	 */
+	rate = uim_baud_cache_load(baud_cache_file, board, dev);
+	if (rate > 0) {
+		if (change_speed(inst, rate, flow_ctrl) == 0) {
+			UIM_VER(" Using stored rate %ld", rate);
+			inst->link_unverified = 1;
+			return 0;
+		}
+		/* not a verdict on the stored rate */
+		if (cancelled(inst))
+			return -1;
+		UIM_ERR("Stored rate %ld failed, probing", rate);
+		uim_baud_cache_store(baud_cache_file, board, dev, 0);
+		limit = rate;
 	}
 
-	/* Change the UART attributes before
-	 * setting the default baud rate*/
-	cfmakeraw(&ti);
+	base = uim_baud_base(inst->dev_fd);
+	uim_trace_begin(&inst->trace, UIM_TRACE_BAUD_PROBE);
+	for (i = 0; i < uim_baud_ladder_len; i++) {
+		rate = uim_baud_ladder[i];
+		if (rate >= limit)
+			continue;
+		if (uim_baud_error_ppm(base, rate) > UIM_BAUD_MAX_ERROR_PPM) {
+			UIM_DBG(" %ld baud off by %ld ppm from base %ld", rate,
+					uim_baud_error_ppm(base, rate), base);
+			continue;
+		}
+
+		if (change_speed(inst, rate, flow_ctrl) < 0 || check_link(inst) < 0) {
+			if (cancelled(inst))
+				return -1;
+			UIM_ERR("%ld baud does not hold", rate);
+			continue;
+		}
+		uim_trace_end(&inst->trace, UIM_TRACE_BAUD_PROBE);
 
-	ti.c_cflag |= 1;
-	ti.c_cflag |= CRTSCTS;
+		UIM_DBG(" Selected %ld baud for %s on %s", rate, dev, board);
+		uim_baud_cache_store(baud_cache_file, board, dev, rate);
+		return 0;
+	}
 
-	/* Set the attributes of UART after making
-	 * the above changes
-	 */
-	tcsetattr(dev_fd, TCSANOW, &ti);
+	return -1;
+}
 
-	/* Set the actual default baud rate */
-	cfsetospeed(&ti, B115200);
-	cfsetispeed(&ti, B115200);
-	tcsetattr(dev_fd, TCSANOW, &ti);
+static long bts_rate(void *ctx)
+{
+	return ((struct uim_inst *)ctx)->baud;
+}
 
-	tcflush(dev_fd, TCIOFLUSH);
-	UIM_DBG(" set_baud_rate() done");
+static int bts_change_speed(void *ctx, long rate)
+{
+	struct uim_inst *inst = ctx;
 
-	return 0;
+	return change_speed(inst, rate, inst->cfg.flow_ctrl);
 }
 
-/* Function to set the UART custom baud rate.
- *
- * The UART baud rate has already been
- * set to default value 115200 before calling this function.
- * The baud rate is then changed to custom baud rate by this function*/
-static int set_custom_baud_rate(int dev_fd, int baud_rate, int flow_ctrl)
+static int bts_set_host_rate(void *ctx, long rate, int flow_ctrl)
 {
-	UIM_START_FUNC();
+	return set_host_rate(ctx, rate, flow_ctrl);
+}
 
-	struct termios ti;
-	struct termios2 ti2;
+/* Function to find the init script for the controller on the UART,
+ * asking it for its version when only a directory was given
+ */
+static int bts_path(struct uim_inst *inst, char *path, size_t size)
+{
+	struct uim_hci_cmd cmd;
+	unsigned char rsp[HCI_LOCAL_VERSION_LEN];
+	char name[32];
+	struct stat st;
+	int err;
+
+	if (stat(fw_path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		snprintf(path, size, "%s", fw_path);
+		return 0;
+	}
 
-	/* Flush non-transmitted output data,
-	 * non-read input data or both*/
-	tcflush(dev_fd, TCIOFLUSH);
-	/* Get the attributes of UART */
-	if (tcgetattr(dev_fd, &ti) < 0) {
-		UIM_ERR(" Can't get port settings");
+	uim_hci_cmd_init(&cmd, &hci_read_local_version, NULL, 0);
+	cmd.rsp = rsp;
+	cmd.rsp_size = sizeof(rsp);
+	err = uim_hci_send(&inst->hci, &cmd);
+	uim_hci_reset(&inst->hci);
+	if (err < 0) {
+		if (!cancelled(inst))
+			UIM_ERR("Can't read the controller version: %s",
+					uim_hci_cmd_result(&cmd));
 		return -1;
 	}
 
-	/*Set the UART flow control */
-	if (flow_ctrl)
-		ti.c_cflag |= CRTSCTS;
-	else
-		ti.c_cflag &= ~CRTSCTS;
+	uim_bts_name(name, sizeof(name), rsp[6] | rsp[7] << 8);
+	snprintf(path, size, "%s/%s", fw_path, name);
+	return 0;
+}
 
-	/*
-	 * Set the parameters associated with the UART
-	 * The change will occur immediately by using TCSANOW
-	 */
-	if (tcsetattr(dev_fd, TCSANOW, &ti) < 0) {
-		UIM_ERR(" Can't set port settings");
-		return -1;
-	}
+/* Function to download the init script at the final UART rate,
+ * in place of the download KIM does after the line discipline is set
+ */
+static int download_firmware(struct uim_inst *inst)
+{
+	struct uim_bts_ops ops = {
+		.ctx = inst,
+		.rate = bts_rate,
+		.change_speed = bts_change_speed,
+		.set_host_rate = bts_set_host_rate,
+	};
+	char path[PATH_MAX];
 
-	tcflush(dev_fd, TCIOFLUSH);
+	UIM_START_FUNC();
 
-	/*Set the actual baud rate */
-	ioctl(dev_fd, TCGETS2, &ti2);
-	ti2.c_cflag &= ~CBAUD;
-	ti2.c_cflag |= BOTHER;
-	ti2.c_ospeed = baud_rate;
-	ioctl(dev_fd, TCSETS2, &ti2);
+	uim_trace_begin(&inst->trace, UIM_TRACE_FW_DOWNLOAD);
+	if (bts_path(inst, path, sizeof(path)) < 0)
+		return -1;
+	if (uim_bts_load(&inst->bts, path) < 0)
+		return -1;
+	if (uim_bts_run(&inst->bts, &inst->hci, &ops) < 0) {
+		if (!cancelled(inst))
+			UIM_ERR("Init script %s failed", path);
+		return -1;
+	}
+	uim_trace_end(&inst->trace, UIM_TRACE_FW_DOWNLOAD);
 
-	UIM_DBG(" set_custom_baud_rate() done");
 	return 0;
 }
 
@@ -281,70 +626,33 @@ static int set_custom_baud_rate(int dev_fd, int baud_rate, int flow_ctrl)
  * on receiving a notification from the ST KIM driver to install the line
  * discipline, this function does UART configuration necessary for the STK
  */
-int st_uart_config(unsigned char install)
+static int uart_config(struct uim_inst *inst, unsigned char install)
 {
-	int ldisc, len, fd, flow_ctrl;
-	unsigned char buf[UART_DEV_NAME_LEN+1];
-	uim_speed_change_cmd cmd;
-	char uart_dev_name[UART_DEV_NAME_LEN+1];
+	int ldisc, flow_ctrl, err;
+	const char *uart_dev_name;
 	long cust_baud_rate;
 
-	uim_bdaddr_change_cmd addr_cmd;
-
 	UIM_START_FUNC();
 
 	if (install == '1') {
-		memset(buf, 0, UART_DEV_NAME_LEN+1);
-		fd = open(DEV_NAME_SYSFS, O_RDONLY);
-		if (fd < 0) {
-			UIM_ERR("Can't open %s, error (%s)", DEV_NAME_SYSFS, strerror(errno));
+		if (uim_cfg_get(&inst->cfg, &inst->trace) < 0) {
+			UIM_ERR("Can't read the KIM configuration");
 			return -1;
 		}
-		len = read(fd, buf, UART_DEV_NAME_LEN);
-		if (len < 0) {
-			UIM_ERR("read err (%s)", strerror(errno));
-			close(fd);
-			return len;
-		}
-		sscanf((const char *) buf, "%s", uart_dev_name);
-		close(fd);
-
-		memset(buf, 0, UART_DEV_NAME_LEN+1);
-		fd = open(BAUD_RATE_SYSFS, O_RDONLY);
-		if (fd < 0) {
-			UIM_ERR("Can't open %s", BAUD_RATE_SYSFS);
+		uart_dev_name = inst->cfg.dev_name;
+		cust_baud_rate = inst->cfg.baud_rate;
+		flow_ctrl = inst->cfg.flow_ctrl;
+		if (cancelled(inst))
 			return -1;
-		}
-		len = read(fd, buf, UART_DEV_NAME_LEN);
-		if (len < 0) {
-			UIM_ERR("read err (%s)", strerror(errno));
-			close(fd);
-			return len;
-		}
-		close(fd);
-		sscanf((const char *) buf, "%ld", &cust_baud_rate);
-
-		memset(buf, 0, UART_DEV_NAME_LEN+1);
-		fd = open(FLOW_CTRL_SYSFS, O_RDONLY);
-		if (fd < 0) {
-			UIM_ERR("Can't open %s", FLOW_CTRL_SYSFS);
-			/* As fd was not opened, it's not necessary to close it */
-			return -1;
-		}
-		len = read(fd, buf, UART_DEV_NAME_LEN);
-		if (len < 0) {
-			UIM_ERR("read err (%s)", strerror(errno));
-			close(fd);
-			return len;
-		}
-		close(fd);
-		sscanf((const char *) buf, "%d", &flow_ctrl);
 
 		UIM_VER(" signal received, opening %s", uart_dev_name);
 
-		dev_fd = open(uart_dev_name, O_RDWR);
-		if (dev_fd < 0) {
-			UIM_ERR("Can't open %s, error (%s)", uart_dev_name, strerror(errno));
+		uim_trace_begin(&inst->trace, UIM_TRACE_UART_OPEN);
+		if (open_uart(inst, uart_dev_name) < 0)
+			return -1;
+		uim_trace_end(&inst->trace, UIM_TRACE_UART_OPEN);
+		if (cancelled(inst)) {
+			close_uart(inst);
 			return -1;
 		}
 
@@ -354,101 +662,236 @@ int st_uart_config(unsigned char install)
 		 * Set only the default baud rate.
 		 * This will set the baud rate to default 115200
 		 */
-		if (set_baud_rate(dev_fd) < 0) {
-			UIM_ERR("set_baudrate() failed");
-			close(dev_fd);
+		uim_trace_begin(&inst->trace, UIM_TRACE_SET_BAUD_RATE);
+		if (warm_uart) {
+			/* the controller was powered up, drop its noise */
+			uim_transport_flush(&inst->tr, TCIOFLUSH);
+			if (uim_transport_set_rate(&inst->tr, UIM_BAUD_DEFAULT, 1) < 0) {
+				close_uart(inst);
+				return -1;
+			}
+		} else {
+			if (set_baud_rate(&inst->tr) < 0) {
+				UIM_ERR("set_baudrate() failed");
+				close_uart(inst);
+				return -1;
+			}
+			fcntl(inst->dev_fd, F_SETFL, fcntl(inst->dev_fd, F_GETFL) | O_NONBLOCK);
+		}
+		uim_trace_end(&inst->trace, UIM_TRACE_SET_BAUD_RATE);
+		inst->baud = UIM_BAUD_DEFAULT;
+
+		if (cancelled(inst)) {
+			close_uart(inst);
 			return -1;
 		}
 
-		fcntl(dev_fd, F_SETFL, fcntl(dev_fd, F_GETFL) | O_NONBLOCK);
-		/* Set only the custom baud rate */
-		if (cust_baud_rate != 115200) {
-
-			UIM_VER("Setting speed to %ld", cust_baud_rate);
-			/* Forming the packet for Change speed command */
-			cmd.uart_prefix = HCI_COMMAND_PKT;
-			cmd.hci_hdr.opcode = HCI_HDR_OPCODE;
-			cmd.hci_hdr.plen = sizeof(unsigned long);
-			cmd.speed = cust_baud_rate;
-
-			/* Writing the change speed command to the UART
-			 * This will change the UART speed at the controller
-			 * side
-			 */
-			UIM_VER(" Setting speed to %d", cust_baud_rate);
-			len = write(dev_fd, &cmd, sizeof(cmd));
-			if (len < 0) {
-				UIM_ERR("Failed to write speed-set command");
-				close(dev_fd);
+		uim_rx_init(&inst->rx, &inst->tr);
+		uim_rx_set_cancel(&inst->rx, inst->cancel_fd);
+		uim_rx_set_snoop(&inst->rx, &inst->snoop);
+		uim_hci_init(&inst->hci, &inst->rx);
+		uim_hci_set_rtt(&inst->hci, &inst->rtt, inst->baud);
+		uim_hci_set_metrics(&inst->hci, &inst->metrics);
+		if (baud_autotune) {
+			if (autotune_baud(inst, uart_dev_name, flow_ctrl) < 0) {
+				if (!cancelled(inst))
+					UIM_ERR("No working UART rate found");
+				close_uart(inst);
+				return -1;
+			}
+		} else if (cust_baud_rate != UIM_BAUD_DEFAULT) {
+			/* Set only the custom baud rate */
+			if (change_speed(inst, cust_baud_rate, flow_ctrl) < 0) {
+				close_uart(inst);
 				return -1;
 			}
+		}
 
-			/* Read the response for the Change speed command */
-			read_command_complete(dev_fd, HCI_HDR_OPCODE);
+		if (cancelled(inst)) {
+			close_uart(inst);
+			return -1;
+		}
 
-			UIM_VER(" Speed changed to %d", cust_baud_rate);
+		if (fw_path && download_firmware(inst) < 0) {
+			if (!cancelled(inst) && inst->link_unverified)
+				forget_baud(inst, uart_dev_name);
+			close_uart(inst);
+			return -1;
+		}
 
-			/* Set the actual custom baud rate at the host side */
-			if (set_custom_baud_rate(dev_fd, cust_baud_rate, flow_ctrl) < 0) {
-				UIM_ERR("set_custom_baud_rate() failed");
-				close(dev_fd);
+		if (cancelled(inst)) {
+			close_uart(inst);
+			return -1;
+		}
 
-				return -1;
+		/* Commands the controller takes at its final speed */
+		if (send_init_cmds(inst) < 0) {
+			if (!cancelled(inst)) {
+				UIM_ERR("Controller initialisation failed");
+				if (inst->link_unverified)
+					forget_baud(inst, uart_dev_name);
 			}
+			close_uart(inst);
+			return -1;
+		}
+
+		/* the line discipline is never installed for a link test */
+		if (link_bench) {
+			err = uim_link_bench(inst, link_bench, &inst->link);
+			if (err < 0 && !cancelled(inst))
+				UIM_ERR("Link test of %s ended early", inst->name);
+			close_uart(inst);
+			return err;
+		}
+
+		/* last chance to back out before the driver takes over */
+		if (cancelled(inst)) {
+			close_uart(inst);
+			return -1;
+		}
 
-			/* Set the uim BD address */
-			if (bd_addr) {
-
-				memset(&addr_cmd, 0, sizeof(addr_cmd));
-				/* Forming the packet for change BD address command*/
-				addr_cmd.uart_prefix = HCI_COMMAND_PKT;
-				addr_cmd.hci_hdr.opcode = WRITE_BD_ADDR_OPCODE;
-				addr_cmd.hci_hdr.plen = sizeof(bdaddr_t);
-				memcpy(&addr_cmd.addr, bd_addr, sizeof(bdaddr_t));
-
-				/* Writing the change BD address command to the UART
-				 * This will change the change BD address  at the controller
-				 * side
-				 */
-				len = write(dev_fd, &addr_cmd, sizeof(addr_cmd));
-				if (len < 0) {
-					UIM_ERR("Failed to write BD address command");
-					close(dev_fd);
-					return -1;
-				}
-
-				/* Read the response for the change BD address command */
-				read_command_complete(dev_fd, WRITE_BD_ADDR_OPCODE);
-
-				UIM_VER("BD address changed to "
-						"%02X:%02X:%02X:%02X:%02X:%02X", bd_addr->b[0],
-						bd_addr->b[1], bd_addr->b[2], bd_addr->b[3],
-						bd_addr->b[4], bd_addr->b[5]);
+		/* the tty stays with N_TTY, the channels are split here */
+		if (mux_dir) {
+			inst->mux = uim_mux_start(&inst->rx, inst->name, mux_dir);
+			if (!inst->mux) {
+				UIM_ERR("Can't serve the channels of %s", inst->name);
+				close_uart(inst);
+				return -1;
 			}
-#ifdef UIM_DEBUG
-			read_firmware_version(dev_fd);
-#endif
+			UIM_DBG("Serving %s channels in %s", inst->name, mux_dir);
+			if (inst->ready)
+				inst->ready(inst, inst->ready_data);
+			return 0;
 		}
 
 		/* After the UART speed has been changed, the IOCTL is
 		 * is called to set the line discipline to N_TI_WL
 		 */
-		ldisc = N_TI_WL;
-		if (ioctl(dev_fd, TIOCSETD, &ldisc) < 0) {
+		uim_trace_begin(&inst->trace, UIM_TRACE_SET_LDISC);
+		ldisc = line_discipline;
+		if (uim_transport_set_ldisc(&inst->tr, ldisc) < 0) {
 			UIM_ERR(" Can't set line discipline");
-			close(dev_fd);
+			close_uart(inst);
 			return -1;
 		}
+		uim_trace_end(&inst->trace, UIM_TRACE_SET_LDISC);
 		UIM_DBG("Installed N_TI_WL Line displine");
+		if (inst->ready)
+			inst->ready(inst, inst->ready_data);
 	} else {
 		UIM_DBG("Un-Installed N_TI_WL Line displine");
 		/* UNINSTALL_N_TI_WL - When the Signal is received from KIM */
-		/* closing UART fd */
-		close(dev_fd);
+		if (inst->mux) {
+			uim_mux_stop(inst->mux);
+			inst->mux = NULL;
+		}
+		if (warm_uart && inst->dev_fd >= 0) {
+			/* hand the tty back to N_TTY but keep it open */
+			ldisc = N_TTY;
+			if (uim_transport_set_ldisc(&inst->tr, ldisc) < 0) {
+				UIM_ERR(" Can't restore N_TTY (%s)", strerror(errno));
+				close_uart(inst);
+			}
+		} else {
+			/* closing UART fd */
+			close_uart(inst);
+		}
+	}
+	return 0;
+}
+
+/* Function to open and configure the UART ahead of the first install
+ * in warm mode, so that even the first bring-up finds it ready
+ */
+int st_uart_prepare(struct uim_inst *inst)
+{
+	UIM_START_FUNC();
+
+	if (!warm_uart)
+		return 0;
+
+	if (uim_cfg_get(&inst->cfg, NULL) < 0)
+		return -1;
+
+	if (open_uart(inst, inst->cfg.dev_name) < 0)
+		return -1;
+	if (uim_transport_set_rate(&inst->tr, UIM_BAUD_DEFAULT, 1) < 0) {
+		close_uart(inst);
+		return -1;
 	}
+	inst->baud = UIM_BAUD_DEFAULT;
 	return 0;
 }
 
+/* Function to account an install event in the metrics of the
+ * instance and publish them
+ */
+static void update_metrics(struct uim_inst *inst, unsigned char install,
+		int err, long us)
+{
+	struct uim_metrics *m = &inst->metrics;
+
+	if (install == '1') {
+		m->enables++;
+		if (err < 0) {
+			m->failures++;
+			if (inst->cancel)
+				m->cancels++;
+		} else {
+			uim_metrics_sample(&m->bringup, us);
+		}
+	} else {
+		m->disables++;
+	}
+	m->installed = install == '1' && !err && !link_bench;
+
+	/* the receive state is set up again by the next bring-up */
+	m->tx_bytes += inst->rx.written_bytes;
+	m->rx_bytes += inst->rx.read_bytes;
+	m->resync_bytes += inst->rx.dropped_bytes;
+	inst->rx.written_bytes = inst->rx.read_bytes = 0;
+	inst->rx.dropped_bytes = 0;
+
+	m->baud = inst->baud;
+	m->flow_ctrl = inst->cfg.flow_ctrl;
+
+	if (inst->metrics_slot)
+		uim_metrics_publish(inst->metrics_slot, m);
+}
+
+/* Function to handle an install event from the ST KIM driver
+ *
+ * Every installation is recorded as one cycle of the bring-up trace,
+ * the HCI capture of a failed one is saved to UIM_SNOOP_DIR.
+ */
+int st_uart_config(struct uim_inst *inst, unsigned char install)
+{
+	struct timespec t0, t1;
+	char path[PATH_MAX];
+	int err;
+
+	if (install != '1') {
+		err = uart_config(inst, install);
+		update_metrics(inst, install, err, 0);
+		return err;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	uim_trace_begin_cycle(&inst->trace);
+	err = uart_config(inst, install);
+	uim_trace_end_cycle(&inst->trace, err);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	update_metrics(inst, install, err, (t1.tv_sec - t0.tv_sec) * 1000000L +
+			(t1.tv_nsec - t0.tv_nsec) / 1000);
+
+	/* what the controller said is the first thing asked for */
+	if (err < 0 && !inst->cancel &&
+			uim_snoop_save(&inst->snoop, inst->name, path, sizeof(path)) == 0)
+		UIM_ERR("HCI traffic of %s saved to %s", inst->name, path);
+
+	return err;
+}
+
 /* Function to convert the BD address from ascii to hex value */
 bdaddr_t *strtoba(const char *str)
 {
@@ -479,142 +922,3 @@ bdaddr_t *strtoba(const char *str)
 exit:
 	return (bdaddr_t *) ba;
 }
-
-/*****************************************************************************/
-int main(int argc, char *argv[])
-{
-	int st_fd, err;
-	unsigned char install, previous;
-	struct pollfd p;
-	unsigned int i;
-	/* List of invalid BD addresses */
-	const bdaddr_t bd_address_ignored[] = {
-			{ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
-			{ { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF } } };
-
-	UIM_START_FUNC();
-	bd_addr = NULL;
-	err = 0;
-
-	/* Parse the user input */
-	if ((argc > 2)) {
-		UIM_ERR("Invalid arguments");
-		UIM_ERR("Usage: uim <bd address>");
-		return -1;
-	}
-	if (argc == 2) {
-		if (strlen(argv[1]) != BD_ADDR_LEN) {
-			UIM_ERR("Usage: uim XX:XX:XX:XX:XX:XX");
-			return -1;
-		}
-		/* BD address passed as string in xx:xx:xx:xx:xx:xx format */
-		strncpy(uim_bd_address, argv[1], BD_ADDR_LEN);
-		/* ensure that null terminated is correctly set at end of buf */
-		uim_bd_address[BD_ADDR_LEN]='\0';
-		bd_addr = strtoba(uim_bd_address);
-	} else {
-		/* read BD address from bd provisioning file */
-		FILE *bd_prov_file = NULL;
-		char *bd_prov_file_name = BD_PATH;
-		size_t bd_size;
-		bd_prov_file = fopen(bd_prov_file_name, "r");
-		if (bd_prov_file) {
-			bd_size = fread(uim_bd_address, sizeof(char), BD_ADDR_LEN, bd_prov_file);
-			if (bd_size == BD_ADDR_LEN) {
-				uim_bd_address[BD_ADDR_LEN] = '\0';
-				bd_addr = strtoba(uim_bd_address);
-			} else {
-				UIM_ERR("Error while reading BD address from configuration file");
-			}
-			fclose(bd_prov_file);
-		} else {
-			/* No BD provisioning file is not necessarily an error */
-			UIM_DBG("No BD address configuration file found");
-		}
-	}
-
-	if (bd_addr) {
-		/* Check if read value has to be ignored */
-		for (i = 0; i < (sizeof(bd_address_ignored) / sizeof(bdaddr_t)); i++) {
-
-			if (memcmp(&bd_address_ignored[i], bd_addr, sizeof(bdaddr_t)) == 0) {
-
-				UIM_DBG("Stored value "
-						"%02X:%02X:%02X:%02X:%02X:%02X was ignored",
-						bd_addr->b[0], bd_addr->b[1], bd_addr->b[2],
-						bd_addr->b[3], bd_addr->b[4], bd_addr->b[5]);
-				UIM_DBG("Using default chip bd address");
-
-				free(bd_addr);
-				bd_addr = NULL;
-
-				break;
-			}
-		}
-		if (bd_addr)
-			UIM_DBG("Using %s bd address", uim_bd_address);
-	} else
-		UIM_DBG("Using default chip bd address");
-
-	line_discipline = N_TI_WL;
-
-	st_fd = open(INSTALL_SYSFS_ENTRY, O_RDONLY);
-	if (st_fd < 0) {
-		UIM_DBG("unable to open %s(%s)", INSTALL_SYSFS_ENTRY, strerror(errno));
-		return -1;
-	}
-
-	/* read to start proper poll */
-	err = read(st_fd, &install, 1);
-	/* special case where bluetoothd starts before the UIM, and UIM
-	 * needs to turn on bluetooth because of that.
-	 */
-	if ((err > 0) && install == '1') {
-		UIM_DBG("install set previously...");
-		st_uart_config(install);
-	}
-
-RE_POLL:
-
-	UIM_DBG("begin polling...");
-
-	memset(&p, 0, sizeof(p));
-	p.fd = st_fd;
-	p.events = POLLERR | POLLPRI;
-
-	while (!exiting) {
-		p.revents = 0;
-		err = poll(&p, 1, -1);
-		UIM_DBG("poll broke due to event %d(PRI:%d/ERR:%d)\n", p.revents, POLLPRI, POLLERR);
-		if (err < 0 && errno == EINTR)
-			continue;
-		if (err)
-			break;
-	}
-
-	close(st_fd);
-	st_fd = open(INSTALL_SYSFS_ENTRY, O_RDONLY);
-	if (st_fd < 0) {
-		UIM_DBG("unable to open %s (%s)", INSTALL_SYSFS_ENTRY, strerror(errno));
-		return -1;
-	}
-
-	if (!exiting) {
-		previous = install;
-		err = read(st_fd, &install, 1);
-		UIM_DBG("read %c from install (previously was %c)\n", install, previous);
-		if (err > 0)
-			if (previous != install)
-				st_uart_config(install);
-			else
-				UIM_DBG("lost install event, retry later");
-
-		goto RE_POLL;
-	}
-
-	close(st_fd);
-	/* Free resources */
-	if (bd_addr)
-		free(bd_addr);
-	return 0;
-}
@@ -43,14 +43,35 @@
 #define TCSETS2      _IOW('T', 0x2B, struct termios2)
 #endif
 
+#ifndef IBSHIFT
+#define IBSHIFT		16
+#endif
+
+#ifndef ANDROID
+#include <termios.h>
+/* glibc does not export termios2, this matches the kernel layout */
+struct termios2 {
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc[ARM_NCCS];
+	speed_t c_ispeed;
+	speed_t c_ospeed;
+};
+#endif
+
 /*HCI Command and Event information*/
 #define HCI_HDR_OPCODE		0xff36
 #define WRITE_BD_ADDR_OPCODE    0xFC06
+#define HCI_READ_LOCAL_VERSION_OPCODE	0x1001
 #define RESP_PREFIX		0x04
-#define MAX_TRY			10
 
 /* HCI Packet types */
 #define HCI_COMMAND_PKT		0x01
+#define HCI_ACLDATA_PKT		0x02
+#define HCI_SCODATA_PKT		0x03
 #define HCI_EVENT_PKT		0x04
 
 /* HCI command macros*/
@@ -63,6 +84,9 @@
 #define EVT_CMD_COMPLETE	0x0E
 #define EVT_CMD_STATUS		0x0F
 
+/* Return parameters of HCI_Read_Local_Version_Information */
+#define HCI_LOCAL_VERSION_LEN	8
+
 /* use it for string lengths and buffers */
 #define UART_DEV_NAME_LEN	32
 /* BD address length in format xx:xx:xx:xx:xx:xx */
@@ -73,50 +97,27 @@
 #define BD_PATH "/config/bt/bd_addr.conf"
 
 
+/* KIM driver instances are the platform devices "kim" and "kim.N" */
+#define KIM_PLATFORM_DIR "/sys/devices/platform"
+#define KIM_DEV_NAME "kim"
+
 /* the sysfs entries with device configuration set by
- * shared transport driver
+ * shared transport driver, relative to the KIM directory
  */
-#define INSTALL_SYSFS_ENTRY "/sys/devices/platform/kim/install"
-#define DEV_NAME_SYSFS "/sys/devices/platform/kim/dev_name"
-#define BAUD_RATE_SYSFS "/sys/devices/platform/kim/baud_rate"
-#define FLOW_CTRL_SYSFS "/sys/devices/platform/kim/flow_cntrl"
+#define INSTALL_SYSFS_ENTRY "install"
+#define DEV_NAME_SYSFS "dev_name"
+#define BAUD_RATE_SYSFS "baud_rate"
+#define FLOW_CTRL_SYSFS "flow_cntrl"
 
+/* Bring-up trace written on SIGUSR1 */
 #ifdef ANDROID
-#define VERBOSE
-/*Debug logs*/
-#define UIM_ERR(fmt, arg...)  LOGE(fmt"\n" , ##arg)
-#if defined(UIM_DEBUG)		/* limited debug messages */
-#define UIM_START_FUNC()      LOGV("Inside %s", __FUNCTION__)
-#define UIM_DBG(fmt, arg...)  LOGD(fmt"\n" , ## arg)
-#define UIM_VER(fmt, arg...)
-#elif defined(VERBOSE)		/* very verbose */
-#define UIM_START_FUNC()      LOGV("@ %s\n", __FUNCTION__)
-#define UIM_DBG(fmt, arg...)  LOGD(fmt"\n" , ## arg)
-#define UIM_VER(fmt, arg...)  LOGV(fmt"\n" , ## arg)
-#else /* error msgs only */
-#define UIM_START_FUNC()
-#define UIM_DBG(fmt, arg...)
-#define UIM_VER(fmt, arg...)
-#endif
+#define UIM_TRACE_FILE "/data/misc/bluetooth/uim_trace.txt"
 #else
-#define VERBOSE
-/*Debug logs*/
-#define UIM_ERR(fmt, arg...)  printf("uim:"fmt"\n" , ##arg)
-#if defined(UIM_DEBUG)		/* limited debug messages */
-#define UIM_START_FUNC()      printf("uim: Inside %s", __FUNCTION__)
-#define UIM_DBG(fmt, arg...)  printf("uim:"fmt"\n" , ## arg)
-#define UIM_VER(fmt, arg...)
-#elif defined(VERBOSE)		/* very verbose */
-#define UIM_START_FUNC()      printf("uim:@ %s\n", __FUNCTION__)
-#define UIM_DBG(fmt, arg...)  printf("uim:"fmt"\n" , ## arg)
-#define UIM_VER(fmt, arg...)  printf("uim:"fmt"\n" , ## arg)
-#else /* error msgs only */
-#define UIM_START_FUNC()
-#define UIM_DBG(fmt, arg...)
-#define UIM_VER(fmt, arg...)
-#endif
+#define UIM_TRACE_FILE "/tmp/uim_trace.txt"
 #endif
 
+#include "uim_log.h"
+
 /* HCI command header*/
 typedef struct {
 	uint16_t        opcode;         /* OCF & OGF */
@@ -142,32 +143,22 @@ typedef struct {
 	uint16_t        opcode;
 } __attribute__ ((packed)) evt_cmd_status;
 
-/* HCI Event structure to set the cusrom baud rate*/
-typedef struct {
-	uint8_t uart_prefix;
-	hci_event_hdr hci_hdr;
-	evt_cmd_complete cmd_complete;
-	uint8_t status;
-	uint8_t data[16];
-} __attribute__ ((packed)) command_complete_t;
-
-/* HCI Command structure to set the cusrom baud rate*/
-typedef struct {
-	uint8_t uart_prefix;
-	hci_command_hdr hci_hdr;
-	uint32_t speed;
-} __attribute__ ((packed)) uim_speed_change_cmd;
-
 /* BD address structure to set the uim BD address*/
 typedef struct {
 	unsigned char b[6];
 } __attribute__((packed)) bdaddr_t;
 
-/* HCI Command structure to set the uim BD address*/
-typedef struct {
-	uint8_t uart_prefix;
-	hci_command_hdr hci_hdr;
-	bdaddr_t addr;
-} __attribute__ ((packed)) uim_bdaddr_change_cmd;\
+/* Bring-up settings, shared by the daemon and the host tools */
+extern bdaddr_t *bd_addr;
+extern int line_discipline;
+extern int baud_autotune;
+extern const char *baud_cache_file;
+extern int warm_uart;
+extern const char *fw_path;
+struct uim_link_cfg;
+extern const struct uim_link_cfg *link_bench;
+extern const char *mux_dir;
+
+bdaddr_t *strtoba(const char *str);
 
 #endif /* UIM_H */
@@ -0,0 +1,230 @@
+/*
+ *  User Mode Init manager - UART rate selection
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <linux/serial.h>
+
+#include "uim.h"
+#include "uim_baud.h"
+
+const long uim_baud_ladder[] = {
+	4000000, 3686400, 3000000, 2000000, 1500000, 921600, 460800, 230400,
+};
+
+const int uim_baud_ladder_len = sizeof(uim_baud_ladder) /
+	sizeof(uim_baud_ladder[0]);
+
+/* Function to get the base clock of the UART divisor,
+ * 0 if the driver does not tell
+ */
+long uim_baud_base(int fd)
+{
+	struct serial_struct ss;
+
+	memset(&ss, 0, sizeof(ss));
+	if (ioctl(fd, TIOCGSERIAL, &ss) < 0)
+		return 0;
+	return ss.baud_base;
+}
+
+/* Function to compute the error of a rate obtained by a
+ * rounded divisor. Without a known base clock nothing can be
+ * predicted and the rate is left for the link check to judge.
+ */
+long uim_baud_error_ppm(long baud_base, long rate)
+{
+	long divisor;
+
+	if (baud_base <= 0)
+		return 0;
+
+	divisor = (baud_base + rate / 2) / rate;
+	if (!divisor)
+		return 1000000;
+
+	return uim_baud_error_between(rate, baud_base / divisor);
+}
+
+long uim_baud_error_between(long requested, long actual)
+{
+	long long diff = (long long)actual - requested;
+
+	if (diff < 0)
+		diff = -diff;
+	return (long)(diff * 1000000 / requested);
+}
+
+/* Function to get the name rates are remembered under */
+void uim_baud_board_id(char *board, size_t size)
+{
+#ifdef ANDROID
+	char value[PROPERTY_VALUE_MAX];
+
+	property_get("ro.product.board", value, "");
+	if (!value[0])
+		property_get("ro.board.platform", value, "unknown");
+	snprintf(board, size, "%s", value);
+#else
+	struct utsname uts;
+
+	if (uname(&uts) < 0)
+		snprintf(board, size, "unknown");
+	else
+		snprintf(board, size, "%s", uts.nodename);
+#endif
+}
+
+/* Function to look up the rate stored for a board and UART,
+ * 0 if there is none
+ */
+long uim_baud_cache_load(const char *file, const char *board,
+		const char *dev)
+{
+	FILE *fp;
+	char line[UIM_BAUD_BOARD_LEN + PATH_MAX + 32];
+	char b[UIM_BAUD_BOARD_LEN], d[PATH_MAX];
+	long rate, found = 0;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		return 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%63s %4095s %ld", b, d, &rate) != 3)
+			continue;
+		if (!strcmp(b, board) && !strcmp(d, dev)) {
+			found = rate;
+			break;
+		}
+	}
+	fclose(fp);
+
+	return found > 0 ? found : 0;
+}
+
+/* Function to rewrite the cache with the entry of board and dev
+ * replaced, under the store locks
+ */
+static int replace_entry(const char *file, const char *board,
+		const char *dev, long rate)
+{
+	FILE *in, *out;
+	char tmp[PATH_MAX];
+	char line[UIM_BAUD_BOARD_LEN + PATH_MAX + 32];
+	char b[UIM_BAUD_BOARD_LEN], d[PATH_MAX];
+	long r;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >=
+			(int)sizeof(tmp)) {
+		UIM_ERR("Can't store in %s (%s)", file, strerror(ENAMETOOLONG));
+		return -1;
+	}
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		UIM_ERR("Can't create %s (%s)", tmp, strerror(errno));
+		return -1;
+	}
+	fchmod(fd, 0644);
+	out = fdopen(fd, "w");
+	if (!out) {
+		UIM_ERR("Can't create %s (%s)", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+
+	in = fopen(file, "r");
+	if (in) {
+		while (fgets(line, sizeof(line), in)) {
+			if (sscanf(line, "%63s %4095s %ld", b, d, &r) != 3)
+				continue;
+			if (!strcmp(b, board) && !strcmp(d, dev))
+				continue;
+			fputs(line, out);
+		}
+		fclose(in);
+	}
+
+	if (rate > 0)
+		fprintf(out, "%s %s %ld\n", board, dev, rate);
+
+	if (fflush(out) || fsync(fileno(out)) < 0) {
+		UIM_ERR("Can't write %s (%s)", tmp, strerror(errno));
+		fclose(out);
+		unlink(tmp);
+		return -1;
+	}
+	fclose(out);
+
+	if (rename(tmp, file) < 0) {
+		UIM_ERR("Can't replace %s (%s)", file, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/* Stores of the instance threads, one at a time */
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Function to store the rate of a board and UART, a rate of 0
+ * forgets it. The other entries are kept and the file is replaced
+ * atomically, a crash leaves either the old or the new content.
+ * Stores are serialised, within the daemon and with other processes
+ * through <file>.lock, so that none loses the entry of another.
+ */
+int uim_baud_cache_store(const char *file, const char *board,
+		const char *dev, long rate)
+{
+	char lock[PATH_MAX];
+	int fd, err;
+
+	if (snprintf(lock, sizeof(lock), "%s.lock", file) >=
+			(int)sizeof(lock)) {
+		UIM_ERR("Can't store in %s (%s)", file, strerror(ENAMETOOLONG));
+		return -1;
+	}
+
+	pthread_mutex_lock(&store_lock);
+	fd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 || flock(fd, LOCK_EX) < 0) {
+		UIM_ERR("Can't lock %s (%s)", lock, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		pthread_mutex_unlock(&store_lock);
+		return -1;
+	}
+	err = replace_entry(file, board, dev, rate);
+	close(fd);
+	pthread_mutex_unlock(&store_lock);
+
+	return err;
+}
@@ -0,0 +1,57 @@
+/*
+ *  User Mode Init manager - UART rate selection
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_BAUD_H
+#define UIM_BAUD_H
+
+#include <stddef.h>
+
+/* Rate both sides start from after a controller reset */
+#define UIM_BAUD_DEFAULT	115200
+
+/* Largest rate error accepted on the host side, in parts per million.
+ * Half of the usual UART budget, the controller takes the other half.
+ */
+#define UIM_BAUD_MAX_ERROR_PPM	20000
+
+/* Time allowed for the round trip verifying a new rate */
+#define UIM_BAUD_PROBE_TIMEOUT_MS	50
+
+/* Rates that worked before, one "<board> <device> <rate>" line each */
+#ifdef ANDROID
+#define UIM_BAUD_CACHE_FILE "/data/misc/bluetooth/uim_baud.conf"
+#else
+#define UIM_BAUD_CACHE_FILE "/tmp/uim_baud.conf"
+#endif
+
+#define UIM_BAUD_BOARD_LEN	64
+
+/* Candidate rates of the controller, fastest first */
+extern const long uim_baud_ladder[];
+extern const int uim_baud_ladder_len;
+
+long uim_baud_base(int fd);
+long uim_baud_error_ppm(long baud_base, long rate);
+long uim_baud_error_between(long requested, long actual);
+void uim_baud_board_id(char *board, size_t size);
+long uim_baud_cache_load(const char *file, const char *board,
+		const char *dev);
+int uim_baud_cache_store(const char *file, const char *board,
+		const char *dev, long rate);
+
+#endif /* UIM_BAUD_H */
@@ -0,0 +1,421 @@
+/*
+ *  User Mode Init manager - bring-up latency benchmark
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Runs st_uart_config() install/uninstall cycles against the simulated
+ * controller and reports the time to line discipline installation.
+ *
+ * The binary is linked with -Wl,--wrap for every system call wrapper
+ * used on the bring-up path, the wrappers below count the calls made
+ * from the benchmark thread only so the simulator is not accounted.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include "uim.h"
+#include "uim_sim.h"
+#include "uim_trace.h"
+#include "uim_inst.h"
+
+enum {
+	SC_OPEN,
+	SC_CLOSE,
+	SC_READ,
+	SC_WRITE,
+	SC_WRITEV,
+	SC_POLL,
+	SC_IOCTL,
+	SC_FCNTL,
+	SC_TCFLUSH,
+	SC_TCGETATTR,
+	SC_TCSETATTR,
+	SC_NANOSLEEP,
+	SC_MAX
+};
+
+static const char *sc_names[SC_MAX] = {
+	"open", "close", "read", "write", "writev", "poll", "ioctl", "fcntl",
+	"tcflush", "tcgetattr", "tcsetattr", "nanosleep",
+};
+
+static __thread int counting;
+static unsigned long sc_count[SC_MAX];
+
+static inline void count(int sc)
+{
+	if (counting)
+		sc_count[sc]++;
+}
+
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+int __real_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+int __real_ioctl(int fd, unsigned long req, ...);
+int __real_fcntl(int fd, int cmd, ...);
+int __real_tcflush(int fd, int queue);
+int __real_tcgetattr(int fd, struct termios *ti);
+int __real_tcsetattr(int fd, int act, const struct termios *ti);
+int __real_nanosleep(const struct timespec *req, struct timespec *rem);
+
+int __wrap_open(const char *path, int flags, ...)
+{
+	va_list ap;
+	int mode = 0;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	count(SC_OPEN);
+	return __real_open(path, flags, mode);
+}
+
+int __wrap_close(int fd)
+{
+	count(SC_CLOSE);
+	return __real_close(fd);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t len)
+{
+	count(SC_READ);
+	return __real_read(fd, buf, len);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t len)
+{
+	count(SC_WRITE);
+	return __real_write(fd, buf, len);
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	count(SC_WRITEV);
+	return __real_writev(fd, iov, iovcnt);
+}
+
+int __wrap_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	count(SC_POLL);
+	return __real_poll(fds, nfds, timeout);
+}
+
+int __wrap_ioctl(int fd, unsigned long req, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, req);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+	count(SC_IOCTL);
+	return __real_ioctl(fd, req, arg);
+}
+
+int __wrap_fcntl(int fd, int cmd, ...)
+{
+	va_list ap;
+	long arg;
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, long);
+	va_end(ap);
+	count(SC_FCNTL);
+	return __real_fcntl(fd, cmd, arg);
+}
+
+int __wrap_tcflush(int fd, int queue)
+{
+	count(SC_TCFLUSH);
+	return __real_tcflush(fd, queue);
+}
+
+int __wrap_tcgetattr(int fd, struct termios *ti)
+{
+	count(SC_TCGETATTR);
+	return __real_tcgetattr(fd, ti);
+}
+
+int __wrap_tcsetattr(int fd, int act, const struct termios *ti)
+{
+	count(SC_TCSETATTR);
+	return __real_tcsetattr(fd, act, ti);
+}
+
+int __wrap_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	count(SC_NANOSLEEP);
+	return __real_nanosleep(req, rem);
+}
+
+static long elapsed_us(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000000L +
+		(b->tv_nsec - a->tv_nsec) / 1000;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *) a, y = *(const long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(void)
+{
+	UIM_ERR("Usage: uim_bench [-n cycles] [-b baud] [-f flow] "
+			"[-d delay_us] [-j jitter_us] [-c ncmd] [-a bd address] "
+			"[-A] [-w] [-v] [-l level] [-D] [-F script] "
+			"[-L count[,size[,window]]]");
+}
+
+/* The simulated KIM instance */
+static struct uim_inst inst;
+static struct uim_link_cfg link_cfg;
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+	struct uim_sim_cfg cfg = {
+		.baud_rate = 3000000,
+		.flow_ctrl = 1,
+		.delay_us = 200,
+		.jitter_us = 100,
+		.ncmd = 1,
+	};
+	struct uim_sim sim;
+	struct timespec t0, t1;
+	unsigned long install_sc[SC_MAX], uninstall_sc[SC_MAX];
+	unsigned long cycles = 2000, i, done = 0, failed = 0;
+	unsigned long phase_n[UIM_TRACE_PHASES];
+	long phase_us[UIM_TRACE_PHASES], us;
+	const struct uim_trace_cycle *cycle;
+	long *samples;
+	char baud_cache[PATH_MAX], line[256];
+	int opt, sc, verbose = 0, out_fd = -1, null_fd, defer = 0;
+
+	bd_addr = strtoba("00:17:E8:00:00:01");
+
+	while ((opt = getopt(argc, argv, "n:b:f:d:j:c:a:Awvl:DF:L:")) != -1) {
+		switch (opt) {
+		case 'n':
+			cycles = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			cfg.baud_rate = strtol(optarg, NULL, 0);
+			break;
+		case 'f':
+			cfg.flow_ctrl = atoi(optarg);
+			break;
+		case 'd':
+			cfg.delay_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			cfg.jitter_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cfg.ncmd = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			free(bd_addr);
+			bd_addr = strtoba(optarg);
+			break;
+		case 'A':
+			baud_autotune = 1;
+			break;
+		case 'w':
+			warm_uart = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'l':
+			uim_log_level = uim_log_parse_level(optarg);
+			if (uim_log_level < 0) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'D':
+			/* format the logs between cycles, as the daemon does */
+			defer = 1;
+			break;
+		case 'F':
+			fw_path = optarg;
+			break;
+		case 'L':
+			/* every cycle tests the link at the line rate */
+			if (uim_link_parse(&link_cfg, optarg) < 0) {
+				usage();
+				return -1;
+			}
+			link_bench = &link_cfg;
+			cfg.wire = 1;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	samples = calloc(cycles ? cycles : 1, sizeof(*samples));
+	if (!samples)
+		return -1;
+
+	if (uim_sim_start(&sim, &cfg) < 0)
+		return -1;
+
+	uim_inst_init(&inst, sim.sysfs_dir, 0);
+	/* the pty has no N_TI_WL, the default discipline stands in */
+	line_discipline = N_TTY;
+	/* probed rates must not leak into the system wide cache */
+	if (snprintf(baud_cache, sizeof(baud_cache), "%s.baud", sim.sysfs_dir) >=
+			(int)sizeof(baud_cache)) {
+		UIM_ERR("Path of the rate cache too long");
+		uim_sim_stop(&sim);
+		return -1;
+	}
+	baud_cache_file = baud_cache;
+
+	/* keep the bring-up debug output out of the measurement */
+	if (!verbose) {
+		fflush(stdout);
+		out_fd = dup(STDOUT_FILENO);
+		null_fd = open("/dev/null", O_WRONLY);
+		if (null_fd >= 0) {
+			dup2(null_fd, STDOUT_FILENO);
+			close(null_fd);
+		}
+	}
+
+	if (defer && uim_log_defer() < 0)
+		return -1;
+
+	/* warm mode configures the UART ahead, as the daemon does */
+	if (st_uart_prepare(&inst) < 0)
+		UIM_ERR("Can't prepare the UART");
+
+	memset(install_sc, 0, sizeof(install_sc));
+	memset(uninstall_sc, 0, sizeof(uninstall_sc));
+	memset(phase_n, 0, sizeof(phase_n));
+	memset(phase_us, 0, sizeof(phase_us));
+
+	for (i = 0; i < cycles; i++) {
+		uim_sim_set_install(&sim, '1');
+
+		memset(sc_count, 0, sizeof(sc_count));
+		counting = 1;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (st_uart_config(&inst, '1') < 0) {
+			counting = 0;
+			failed++;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		counting = 0;
+		for (sc = 0; sc < SC_MAX; sc++)
+			install_sc[sc] += sc_count[sc];
+		samples[done++] = elapsed_us(&t0, &t1);
+
+		cycle = uim_trace_last(&inst.trace);
+		for (sc = 0; cycle && sc < UIM_TRACE_PHASES; sc++) {
+			us = uim_trace_span_us(&cycle->span[sc]);
+			if (us >= 0) {
+				phase_us[sc] += us;
+				phase_n[sc]++;
+			}
+		}
+
+		uim_sim_set_install(&sim, '0');
+
+		memset(sc_count, 0, sizeof(sc_count));
+		counting = 1;
+		st_uart_config(&inst, '0');
+		counting = 0;
+		for (sc = 0; sc < SC_MAX; sc++)
+			uninstall_sc[sc] += sc_count[sc];
+
+		uim_log_flush();
+	}
+
+	if (out_fd >= 0) {
+		fflush(stdout);
+		dup2(out_fd, STDOUT_FILENO);
+		close(out_fd);
+	}
+
+	printf("cycles %lu ok %lu failed %lu (delay %uus jitter %uus baud %ld)\n",
+			cycles, done, failed, cfg.delay_us, cfg.jitter_us,
+			cfg.baud_rate);
+	if (done) {
+		qsort(samples, done, sizeof(*samples), cmp_long);
+		printf("time to ldisc us: p50 %ld p99 %ld max %ld\n",
+				samples[done / 2], samples[(done * 99) / 100],
+				samples[done - 1]);
+
+		printf("%-10s %10s %10s\n", "syscall", "install", "uninstall");
+		for (sc = 0; sc < SC_MAX; sc++)
+			printf("%-10s %10.2f %10.2f\n", sc_names[sc],
+					(double) install_sc[sc] / done,
+					(double) uninstall_sc[sc] / done);
+
+		printf("%-22s %10s\n", "phase", "mean us");
+		for (sc = 0; sc < UIM_TRACE_PHASES; sc++)
+			if (phase_n[sc])
+				printf("%-22s %10.1f\n", uim_trace_phase_name(sc),
+						(double) phase_us[sc] / phase_n[sc]);
+
+		printf("command round trips\n");
+		for (sc = 0; sc < inst.rtt.n; sc++) {
+			uim_rtt_format(&inst.rtt.entry[sc], line, sizeof(line));
+			printf("  %s\n", line);
+		}
+
+		if (link_bench) {
+			uim_link_format(&inst.link, line, sizeof(line));
+			printf("last link test\n  %s\n", line);
+		}
+	}
+	uim_sim_stop(&sim);
+	unlink(baud_cache);
+	printf("simulator: %lu commands, %lu unknown, %lu looped, "
+			"last speed %lu\n", sim.cmds, sim.unknown_cmds,
+			sim.looped, sim.speed);
+
+	free(samples);
+	free(bd_addr);
+
+	return failed ? 1 : 0;
+}
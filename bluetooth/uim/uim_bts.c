@@ -0,0 +1,358 @@
+/*
+ *  User Mode Init manager - TI BTS init scripts
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "uim.h"
+#include "uim_bts.h"
+
+/* Script commands carry their own opcode, the description only gives
+ * the reply policy. Some are answered by a command status alone.
+ */
+static const struct uim_hci_desc bts_cmd = {
+	.name = "bts_command",
+	.plen = UIM_HCI_PLEN_VAR,
+	.reply = UIM_REPLY_CMD_STATUS,
+	.rsp_len = 0,
+	.timeout_ms = UIM_BTS_CMD_TIMEOUT_MS,
+	.retries = 0,
+};
+
+/* Commands of a script in flight at the same time, the controller
+ * credits decide how many are actually written
+ */
+#define BTS_WINDOW	UIM_HCI_MAX_INFLIGHT
+
+struct bts_slot {
+	struct uim_hci_cmd cmd;
+	uint8_t status;		/* expected, from the wait after it */
+};
+
+struct bts_run {
+	struct uim_hci *hci;
+	struct bts_slot slot[BTS_WINDOW];
+	unsigned int head;	/* oldest command not checked yet */
+	unsigned int tail;	/* next free slot */
+	int cmds;
+	int max_inflight;
+};
+
+static inline uint16_t le16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static inline uint32_t le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Function to get the script name the kernel KIM driver would ask
+ * for, from the LMP subversion of the controller
+ */
+void uim_bts_name(char *name, size_t size, uint16_t lmp_subversion)
+{
+	unsigned int chip, maj, min;
+
+	chip = (lmp_subversion & 0x7c00) >> 10;
+	min = lmp_subversion & 0x007f;
+	maj = (lmp_subversion & 0x0380) >> 7;
+	if (lmp_subversion & 0x8000)
+		maj |= 0x0008;
+
+	snprintf(name, size, "TIInit_%u.%u.%u.bts", chip, maj, min);
+}
+
+void uim_bts_release(struct uim_bts *bts)
+{
+	if (bts->map && bts->mapped)
+		munmap((void *)bts->map, bts->len);
+	else
+		free((void *)bts->map);
+	bts->map = NULL;
+	bts->len = 0;
+}
+
+/* Function to map a cached image, if it still belongs to the script */
+static int map_image(struct uim_bts *bts, const char *path,
+		const struct stat *src)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct uim_bts_image)) {
+		close(fd);
+		return -1;
+	}
+	/* the CRC only tells it is intact, not who wrote it */
+	if (!uim_bts_image_trusted(&st)) {
+		UIM_ERR("Ignoring %s, others may write it", path);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	if (uim_bts_image_check(map, st.st_size, src) < 0) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	bts->map = map;
+	bts->len = st.st_size;
+	bts->mapped = 1;
+	return 0;
+}
+
+/* Function to load the compiled form of a script
+ *
+ * An image of the same unchanged script is kept. Otherwise a cached
+ * image is mapped, and only when there is none the script is compiled
+ * and the image cached for the next time.
+ */
+int uim_bts_load(struct uim_bts *bts, const char *path)
+{
+	char img[PATH_MAX];
+	unsigned char *image;
+	struct stat st;
+	size_t len;
+	int i;
+
+	if (stat(path, &st) < 0) {
+		UIM_ERR("Can't find %s (%s)", path, strerror(errno));
+		return -1;
+	}
+	if (bts->map && !strcmp(bts->path, path) && bts->dev == st.st_dev &&
+			bts->ino == st.st_ino && bts->mtime == st.st_mtime &&
+			bts->size == st.st_size)
+		return 0;
+	uim_bts_release(bts);
+
+	for (i = 0; i < 2 && !bts->map; i++) {
+		if (uim_bts_image_path(img, sizeof(img), path, i) < 0)
+			continue;
+		if (map_image(bts, img, &st) == 0)
+			UIM_DBG("Using compiled %s", img);
+	}
+
+	if (!bts->map) {
+		if (uim_bts_compile(path, &image, &len) < 0)
+			return -1;
+		for (i = 0; i < 2; i++) {
+			if (uim_bts_image_path(img, sizeof(img), path, i) < 0)
+				continue;
+			if (uim_bts_image_save(img, image, len) == 0) {
+				UIM_DBG("Cached compiled script as %s", img);
+				break;
+			}
+		}
+		bts->map = image;
+		bts->len = len;
+		bts->mapped = 0;
+	}
+
+	snprintf(bts->path, sizeof(bts->path), "%s", path);
+	bts->dev = st.st_dev;
+	bts->ino = st.st_ino;
+	bts->mtime = st.st_mtime;
+	bts->size = st.st_size;
+	return 0;
+}
+
+/* Function to collect the reply of the oldest command in flight */
+static int check_oldest(struct bts_run *run)
+{
+	struct bts_slot *s = &run->slot[run->head++ % BTS_WINDOW];
+
+	uim_hci_wait(run->hci, &s->cmd);
+	if (s->cmd.state != UIM_CMD_DONE || s->cmd.status != s->status) {
+		if (s->cmd.state != UIM_CMD_CANCELLED)
+			UIM_ERR(" Script command 0x%04x: %s, status 0x%02x",
+					s->cmd.opcode, uim_hci_cmd_result(&s->cmd),
+					s->cmd.status);
+		return -1;
+	}
+	return 0;
+}
+
+/* Function to wait for every command in flight, before an op that
+ * depends on all of them
+ */
+static int drain(struct bts_run *run)
+{
+	while (run->head != run->tail)
+		if (check_oldest(run) < 0)
+			return -1;
+	return 0;
+}
+
+/* Function to submit a command, the packet was checked when the
+ * script was compiled
+ */
+static int send_command(struct bts_run *run, const unsigned char *pkt,
+		uint8_t status)
+{
+	struct bts_slot *s;
+
+	if (run->tail - run->head == BTS_WINDOW && check_oldest(run) < 0)
+		return -1;
+
+	s = &run->slot[run->tail++ % BTS_WINDOW];
+	s->status = status;
+	uim_hci_cmd_init_opcode(&s->cmd, &bts_cmd, le16(pkt + 1), pkt + 4,
+			pkt[3]);
+	if (uim_hci_submit(run->hci, &s->cmd) < 0)
+		return -1;
+
+	if ((int)(run->tail - run->head) > run->max_inflight)
+		run->max_inflight = run->tail - run->head;
+	return 0;
+}
+
+/* Function to wait for an event that is not the reply to a command */
+static int wait_event(struct bts_run *run, const unsigned char *evt,
+		uint32_t len, uint32_t msec)
+{
+	unsigned char buf[1 + HCI_EVENT_HDR_SIZE + 255];
+	struct timespec deadline;
+	int rd;
+
+	uim_deadline_set(&deadline, msec ? (int)msec : UIM_RX_TIMEOUT_MS);
+	for (;;) {
+		rd = uim_rx_read_event(run->hci->rx, buf, sizeof(buf),
+				uim_deadline_ms_left(&deadline));
+		if (rd < 0)
+			return -1;
+		if ((uint32_t)rd >= len && !memcmp(buf, evt, len))
+			return 0;
+		UIM_VER(" Ignoring event 0x%02x while waiting for 0x%02x",
+				buf[1], evt[1]);
+	}
+}
+
+/* Function to sleep for a delay op, still leaving when the bring-up
+ * is cancelled
+ */
+static int delay(struct bts_run *run, uint32_t msec)
+{
+	struct timespec deadline;
+	struct pollfd p;
+	int left;
+
+	p.fd = run->hci->rx->cancel_fd;
+	p.events = POLLIN;
+	uim_deadline_set(&deadline, msec);
+	while ((left = uim_deadline_ms_left(&deadline)) > 0) {
+		p.revents = 0;
+		if (poll(&p, p.fd >= 0 ? 1 : 0, left) > 0) {
+			errno = ECANCELED;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Function to run a compiled script
+ *
+ * Commands are written straight from the image, as many at a time as
+ * the controller grants credits for. Every other op first collects
+ * the replies of all the commands in flight. Speed changes the UART
+ * already runs at are skipped.
+ */
+int uim_bts_run(const struct uim_bts *bts, struct uim_hci *hci,
+		const struct uim_bts_ops *ops)
+{
+	const unsigned char *p, *end, *data;
+	struct uim_bts_op op;
+	struct bts_run run;
+	long rate;
+
+	memset(&run, 0, sizeof(run));
+	run.hci = hci;
+
+	p = bts->map + sizeof(struct uim_bts_image);
+	end = bts->map + bts->len;
+	while (p + sizeof(op) <= end) {
+		memcpy(&op, p, sizeof(op));
+		data = p + sizeof(op);
+		if (data + op.len > end)
+			goto fail;
+		p = data + op.len;
+
+		switch (op.type) {
+		case UIM_BTS_OP_CMD:
+			if (send_command(&run, data, op.status) < 0)
+				goto fail;
+			run.cmds++;
+			break;
+		case UIM_BTS_OP_SPEED:
+			rate = le32(data);
+			if (rate == ops->rate(ops->ctx))
+				break;
+			if (drain(&run) < 0 || ops->change_speed(ops->ctx, rate) < 0)
+				goto fail;
+			break;
+		case UIM_BTS_OP_SERIAL:
+			rate = le32(data);
+			if (rate == ops->rate(ops->ctx))
+				break;
+			if (drain(&run) < 0 ||
+					ops->set_host_rate(ops->ctx, rate, le32(data + 4)) < 0)
+				goto fail;
+			break;
+		case UIM_BTS_OP_WAIT:
+			if (drain(&run) < 0 ||
+					wait_event(&run, data + 4, op.len - 4, le32(data)) < 0)
+				goto fail;
+			break;
+		case UIM_BTS_OP_DELAY:
+			if (drain(&run) < 0 || delay(&run, le32(data)) < 0)
+				goto fail;
+			break;
+		default:
+			goto fail;
+		}
+	}
+
+	if (drain(&run) < 0)
+		goto fail;
+	UIM_DBG(" Ran %s: %d commands, up to %d in flight", bts->path,
+			run.cmds, run.max_inflight);
+	return 0;
+
+fail:
+	uim_hci_reset(hci);
+	return -1;
+}
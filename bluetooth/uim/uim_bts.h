@@ -0,0 +1,131 @@
+/*
+ *  User Mode Init manager - TI BTS init scripts
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_BTS_H
+#define UIM_BTS_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "uim_hci.h"
+
+/* Layout of a .bts file: a header, then actions until the end of the
+ * file. All fields are little endian.
+ */
+#define BTS_MAGIC		0x42535442	/* "BTSB" */
+#define BTS_HEADER_SIZE		32		/* magic, version, 24 reserved */
+#define BTS_ACTION_HDR_SIZE	4		/* type, size */
+
+enum bts_action_type {
+	BTS_ACTION_SEND_COMMAND = 1,	/* H4 command packet */
+	BTS_ACTION_WAIT_EVENT = 2,	/* msec, size, H4 event packet */
+	BTS_ACTION_SERIAL = 3,		/* baud, flow control of the host */
+	BTS_ACTION_DELAY = 4,		/* msec */
+	BTS_ACTION_RUN_SCRIPT = 5,
+	BTS_ACTION_REMARKS = 6,		/* text */
+};
+
+/* Time allowed for the reply to one script command */
+#define UIM_BTS_CMD_TIMEOUT_MS	500
+
+/* A script is run from a compiled image: remarks and unknown actions
+ * are gone, waits for the reply of the command before them are folded
+ * into that command as its expected status and speed changes carry
+ * their rate. The image is stored as <script>.img next to the script,
+ * or in UIM_BTS_CACHE_DIR when that is not writable, and is rebuilt
+ * whenever the size or mtime of the script no longer match.
+ * UIM_BTS_CACHE_DIR is private to the daemon, and an image is only
+ * used when nobody but its owner, the daemon or root, could write it.
+ * Fields are in host byte order.
+ */
+#define UIM_BTS_IMAGE_MAGIC	0x424d4955	/* "UIMB" */
+#define UIM_BTS_IMAGE_VERSION	1
+
+#ifdef ANDROID
+#define UIM_BTS_CACHE_DIR	"/data/misc/bluetooth/uim"
+#else
+#define UIM_BTS_CACHE_DIR	"/tmp/uim_bts"
+#endif
+
+struct uim_bts_image {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t cmds;		/* command ops, for the logs */
+	uint32_t len;		/* bytes of ops following the header */
+	uint32_t crc;		/* CRC-32 of the ops */
+	uint64_t src_size;	/* script the image was built from */
+	int64_t src_mtime;
+};
+
+/* Every op is this header followed by len bytes */
+struct uim_bts_op {
+	uint8_t type;
+	uint8_t status;		/* expected status of a command */
+	uint16_t len;
+};
+
+enum uim_bts_op_type {
+	UIM_BTS_OP_CMD = 1,	/* H4 command packet */
+	UIM_BTS_OP_SPEED,	/* rate of a speed change, reply included */
+	UIM_BTS_OP_SERIAL,	/* rate and flow control of the host side */
+	UIM_BTS_OP_WAIT,	/* msec, H4 event packet */
+	UIM_BTS_OP_DELAY,	/* msec */
+};
+
+/* A compiled script in memory. It stays between bring-ups and is only
+ * redone when the script changed.
+ */
+struct uim_bts {
+	char path[PATH_MAX];	/* of the script */
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+	const unsigned char *map;	/* image, NULL while none is loaded */
+	size_t len;
+	int mapped;		/* map is a file mapping, not allocated */
+};
+
+/* Actions changing the UART rate are carried out by the bring-up */
+struct uim_bts_ops {
+	void *ctx;
+	long (*rate)(void *ctx);
+	/* speed change command, then the host side */
+	int (*change_speed)(void *ctx, long rate);
+	/* host side only */
+	int (*set_host_rate)(void *ctx, long rate, int flow_ctrl);
+};
+
+void uim_bts_name(char *name, size_t size, uint16_t lmp_subversion);
+uint32_t uim_bts_crc32(uint32_t crc, const unsigned char *buf, size_t len);
+int uim_bts_compile(const char *path, unsigned char **image, size_t *len);
+int uim_bts_image_check(const unsigned char *image, size_t len,
+		const struct stat *src);
+int uim_bts_image_trusted(const struct stat *st);
+int uim_bts_image_path(char *path, size_t size, const char *script,
+		int cache_dir);
+int uim_bts_image_save(const char *path, const unsigned char *image,
+		size_t len);
+int uim_bts_load(struct uim_bts *bts, const char *path);
+void uim_bts_release(struct uim_bts *bts);
+int uim_bts_run(const struct uim_bts *bts, struct uim_hci *hci,
+		const struct uim_bts_ops *ops);
+
+#endif /* UIM_BTS_H */
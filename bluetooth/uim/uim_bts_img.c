@@ -0,0 +1,348 @@
+/*
+ *  User Mode Init manager - TI BTS script compiler
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "uim.h"
+#include "uim_bts.h"
+
+static inline uint16_t le16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static inline uint32_t le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* CRC-32 (IEEE 802.3), four bits at a time */
+static const uint32_t crc_nibble[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+uint32_t uim_bts_crc32(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	crc = ~crc;
+	while (len--) {
+		crc ^= *buf++;
+		crc = (crc >> 4) ^ crc_nibble[crc & 0x0f];
+		crc = (crc >> 4) ^ crc_nibble[crc & 0x0f];
+	}
+	return ~crc;
+}
+
+/* Function to append an op made of up to two pieces of data */
+static unsigned char *put_op(unsigned char *out, uint8_t type,
+		const void *data, uint16_t len, const void *more, uint16_t more_len)
+{
+	struct uim_bts_op op = { type, 0, len + more_len };
+
+	memcpy(out, &op, sizeof(op));
+	memcpy(out + sizeof(op), data, len);
+	if (more_len)
+		memcpy(out + sizeof(op) + len, more, more_len);
+	return out + sizeof(op) + op.len;
+}
+
+static inline int is_cmd_complete(const unsigned char *evt, uint32_t len,
+		uint16_t opcode)
+{
+	return len >= 6 && evt[0] == HCI_EVENT_PKT &&
+		evt[1] == EVT_CMD_COMPLETE && le16(evt + 4) == opcode;
+}
+
+/* Function to compile the actions of a mapped script into ops at out,
+ * which has room for at least len bytes. Returns the size of the ops.
+ */
+static long compile(const char *path, const unsigned char *map, size_t len,
+		unsigned char *out, uint16_t *cmds)
+{
+	const unsigned char *p = map + BTS_HEADER_SIZE, *end = map + len;
+	const unsigned char *data;
+	unsigned char *o = out, *last = NULL;
+	int speed_reply = 0;
+	uint16_t type, size;
+	uint32_t evt_len;
+
+	*cmds = 0;
+	while (p + BTS_ACTION_HDR_SIZE <= end) {
+		type = le16(p);
+		size = le16(p + 2);
+		data = p + BTS_ACTION_HDR_SIZE;
+		if (data + size > end) {
+			UIM_ERR("%s: action truncated at offset %ld", path,
+					(long)(p - map));
+			return -1;
+		}
+		p = data + size;
+
+		switch (type) {
+		case BTS_ACTION_SEND_COMMAND:
+			if (size < 1 + HCI_COMMAND_HDR_SIZE ||
+					data[0] != HCI_COMMAND_PKT ||
+					data[3] != size - 1 - HCI_COMMAND_HDR_SIZE) {
+				UIM_ERR("%s: malformed command at offset %ld",
+						path, (long)(data - map));
+				return -1;
+			}
+			last = NULL;
+			speed_reply = 0;
+			if (le16(data + 1) == HCI_HDR_OPCODE && data[3] >= 4) {
+				/* carried out by the bring-up, reply included */
+				o = put_op(o, UIM_BTS_OP_SPEED, data + 4, 4, NULL, 0);
+				speed_reply = 1;
+				break;
+			}
+			last = o;
+			o = put_op(o, UIM_BTS_OP_CMD, data, size, NULL, 0);
+			(*cmds)++;
+			break;
+
+		case BTS_ACTION_WAIT_EVENT:
+			if (size < 8 || (evt_len = le32(data + 4)) > size - 8u) {
+				UIM_ERR("%s: malformed wait at offset %ld", path,
+						(long)(data - map));
+				return -1;
+			}
+			if (last && evt_len >= 7 && is_cmd_complete(data + 8,
+					evt_len, le16(last + sizeof(struct uim_bts_op) + 1))) {
+				((struct uim_bts_op *)last)->status = data[8 + 6];
+			} else if (!speed_reply ||
+					!is_cmd_complete(data + 8, evt_len, HCI_HDR_OPCODE)) {
+				/* msec followed by the event */
+				o = put_op(o, UIM_BTS_OP_WAIT, data, 4, data + 8, evt_len);
+			}
+			last = NULL;
+			speed_reply = 0;
+			break;
+
+		case BTS_ACTION_SERIAL:
+		case BTS_ACTION_DELAY:
+			if (size < (type == BTS_ACTION_SERIAL ? 8 : 4)) {
+				UIM_ERR("%s: malformed action at offset %ld", path,
+						(long)(data - map));
+				return -1;
+			}
+			o = put_op(o, type == BTS_ACTION_SERIAL ? UIM_BTS_OP_SERIAL :
+					UIM_BTS_OP_DELAY, data,
+					type == BTS_ACTION_SERIAL ? 8 : 4, NULL, 0);
+			last = NULL;
+			speed_reply = 0;
+			break;
+
+		case BTS_ACTION_REMARKS:
+			UIM_VER(" %.*s", (int)strnlen((const char *)data, size), data);
+			break;
+
+		default:
+			UIM_DBG(" Dropping script action %u", type);
+			break;
+		}
+	}
+
+	return o - out;
+}
+
+/* Function to compile a script into an allocated image */
+int uim_bts_compile(const char *path, unsigned char **image, size_t *len)
+{
+	struct uim_bts_image hdr;
+	struct stat st;
+	unsigned char *map, *out;
+	long ops;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		UIM_ERR("Can't open %s (%s)", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < BTS_HEADER_SIZE) {
+		UIM_ERR("%s is too short for a script", path);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		UIM_ERR("Can't map %s (%s)", path, strerror(errno));
+		return -1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	if (le32(map) != BTS_MAGIC) {
+		UIM_ERR("%s is not a BTS script", path);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	/* ops never take more room than the actions they come from */
+	out = malloc(sizeof(hdr) + st.st_size);
+	if (!out) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+	ops = compile(path, map, st.st_size, out + sizeof(hdr), &hdr.cmds);
+	munmap(map, st.st_size);
+	if (ops < 0) {
+		free(out);
+		return -1;
+	}
+
+	hdr.magic = UIM_BTS_IMAGE_MAGIC;
+	hdr.version = UIM_BTS_IMAGE_VERSION;
+	hdr.len = ops;
+	hdr.crc = uim_bts_crc32(0, out + sizeof(hdr), ops);
+	hdr.src_size = st.st_size;
+	hdr.src_mtime = st.st_mtime;
+	memcpy(out, &hdr, sizeof(hdr));
+
+	*image = out;
+	*len = sizeof(hdr) + ops;
+	UIM_DBG("Compiled %s: %u commands, %lu of %ld bytes", path, hdr.cmds,
+			(unsigned long)*len, (long)st.st_size);
+	return 0;
+}
+
+/* Function to check an image is intact and built from the script
+ * described by src
+ */
+int uim_bts_image_check(const unsigned char *image, size_t len,
+		const struct stat *src)
+{
+	struct uim_bts_image hdr;
+
+	if (len < sizeof(hdr))
+		return -1;
+	memcpy(&hdr, image, sizeof(hdr));
+	if (hdr.magic != UIM_BTS_IMAGE_MAGIC ||
+			hdr.version != UIM_BTS_IMAGE_VERSION ||
+			hdr.len != len - sizeof(hdr))
+		return -1;
+	if (hdr.src_size != (uint64_t)src->st_size ||
+			hdr.src_mtime != (int64_t)src->st_mtime)
+		return -1;
+	if (hdr.crc != uim_bts_crc32(0, image + sizeof(hdr), hdr.len)) {
+		UIM_ERR("Compiled script is corrupted");
+		return -1;
+	}
+	return 0;
+}
+
+/* Function to tell whether a file may be trusted to hold commands for
+ * the controller: a regular file nobody but us or root could change
+ */
+int uim_bts_image_trusted(const struct stat *st)
+{
+	return S_ISREG(st->st_mode) &&
+		(st->st_uid == geteuid() || st->st_uid == 0) &&
+		!(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+/* Function to create the cache directory, or check the one found is
+ * ours and private
+ */
+static int cache_dir_ready(void)
+{
+	struct stat st;
+
+	if (mkdir(UIM_BTS_CACHE_DIR, 0700) < 0 && errno != EEXIST)
+		return -1;
+	if (lstat(UIM_BTS_CACHE_DIR, &st) < 0)
+		return -1;
+	if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+			(st.st_mode & 077)) {
+		UIM_ERR("Not caching in %s, it is not private", UIM_BTS_CACHE_DIR);
+		return -1;
+	}
+	return 0;
+}
+
+/* Function to get where the image of a script is cached, -1 if the
+ * cache directory can't be used
+ */
+int uim_bts_image_path(char *path, size_t size, const char *script,
+		int cache_dir)
+{
+	char name[PATH_MAX];
+
+	if (!cache_dir) {
+		snprintf(path, size, "%s.img", script);
+		return 0;
+	}
+	if (cache_dir_ready() < 0)
+		return -1;
+	snprintf(name, sizeof(name), "%s", script);
+	snprintf(path, size, "%s/%s.img", UIM_BTS_CACHE_DIR, basename(name));
+	return 0;
+}
+
+/* Function to store an image, replacing the old one atomically. The
+ * file is written under a fresh name, nothing planted there is
+ * followed.
+ */
+int uim_bts_image_save(const char *path, const unsigned char *image,
+		size_t len)
+{
+	char tmp[PATH_MAX];
+	ssize_t wr;
+	size_t off = 0;
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -1;
+	fchmod(fd, 0644);
+
+	while (off < len) {
+		wr = write(fd, image + off, len - off);
+		if (wr < 0 && errno == EINTR)
+			continue;
+		if (wr <= 0)
+			break;
+		off += wr;
+	}
+	if (off < len || fsync(fd) < 0) {
+		UIM_ERR("Can't write %s (%s)", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	close(fd);
+
+	if (rename(tmp, path) < 0) {
+		UIM_ERR("Can't replace %s (%s)", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
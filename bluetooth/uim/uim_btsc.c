@@ -0,0 +1,76 @@
+/*
+ *  User Mode Init manager - TI BTS script compiler (host)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "uim.h"
+#include "uim_bts.h"
+
+static void usage(void)
+{
+	UIM_ERR("Usage: uim_btsc [-v] [-o image] <script.bts>");
+}
+
+/* Compiles a script ahead of time, uim uses the image as long as it
+ * is installed next to the script with the same size and mtime
+ */
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+	const char *out = NULL;
+	char path[PATH_MAX];
+	unsigned char *image;
+	size_t len;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vo:")) != -1) {
+		switch (opt) {
+		case 'v':
+			uim_log_level = UIM_LOG_VER;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+	if (argc - optind != 1) {
+		usage();
+		return -1;
+	}
+
+	if (!out) {
+		uim_bts_image_path(path, sizeof(path), argv[optind], 0);
+		out = path;
+	}
+	if (uim_bts_compile(argv[optind], &image, &len) < 0)
+		return -1;
+	if (uim_bts_image_save(out, image, len) < 0) {
+		free(image);
+		return -1;
+	}
+	printf("%s: %lu bytes\n", out, (unsigned long)len);
+	free(image);
+
+	return 0;
+}
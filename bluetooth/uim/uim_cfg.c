@@ -0,0 +1,202 @@
+/*
+ *  User Mode Init manager - KIM configuration cache
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "uim_cfg.h"
+
+static const char *attr_names[UIM_CFG_ATTRS] = {
+	[UIM_CFG_DEV_NAME] = DEV_NAME_SYSFS,
+	[UIM_CFG_BAUD_RATE] = BAUD_RATE_SYSFS,
+	[UIM_CFG_FLOW_CTRL] = FLOW_CTRL_SYSFS,
+};
+
+static const enum uim_trace_phase attr_phases[UIM_CFG_ATTRS] = {
+	[UIM_CFG_DEV_NAME] = UIM_TRACE_SYSFS_DEV_NAME,
+	[UIM_CFG_BAUD_RATE] = UIM_TRACE_SYSFS_BAUD_RATE,
+	[UIM_CFG_FLOW_CTRL] = UIM_TRACE_SYSFS_FLOW_CTRL,
+};
+
+/* Events after which the cached value can no longer be trusted */
+#define CFG_WATCH_MASK	(IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+		IN_DELETE_SELF | IN_MOVE_SELF)
+
+void uim_cfg_init(struct uim_cfg *cfg, const char *dir)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	snprintf(cfg->dir, sizeof(cfg->dir), "%s", dir);
+	cfg->notify_fd = -1;
+	cfg->stale = 1;
+}
+
+void uim_cfg_release(struct uim_cfg *cfg)
+{
+	if (cfg->notify_fd >= 0)
+		close(cfg->notify_fd);
+	cfg->notify_fd = -1;
+	cfg->stale = 1;
+}
+
+/* Function to set up the watches, done before the attributes are
+ * read so that a change racing with the read is not lost
+ */
+static void watch_attrs(struct uim_cfg *cfg)
+{
+	char path[PATH_MAX];
+	int i;
+
+	/* dropping the instance drops all the old watches at once */
+	if (cfg->notify_fd >= 0)
+		close(cfg->notify_fd);
+
+	cfg->notify_fd = inotify_init();
+	if (cfg->notify_fd < 0) {
+		UIM_DBG(" inotify unavailable (%s), reading every time",
+				strerror(errno));
+		return;
+	}
+	fcntl(cfg->notify_fd, F_SETFL, O_NONBLOCK);
+
+	for (i = 0; i < UIM_CFG_ATTRS; i++) {
+		if (snprintf(path, sizeof(path), "%s/%s", cfg->dir,
+					attr_names[i]) >= (int)sizeof(path)) {
+			UIM_DBG(" Can't watch %s/%s (%s)", cfg->dir,
+					attr_names[i], strerror(ENAMETOOLONG));
+			close(cfg->notify_fd);
+			cfg->notify_fd = -1;
+			return;
+		}
+		if (inotify_add_watch(cfg->notify_fd, path, CFG_WATCH_MASK) < 0) {
+			UIM_DBG(" Can't watch %s (%s)", path, strerror(errno));
+			close(cfg->notify_fd);
+			cfg->notify_fd = -1;
+			return;
+		}
+	}
+}
+
+/* Function to find out whether anything changed since the last
+ * load, costs a single non-blocking read
+ */
+static void check_notify(struct uim_cfg *cfg)
+{
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+	ssize_t len;
+
+	if (cfg->notify_fd < 0) {
+		cfg->stale = 1;
+		return;
+	}
+
+	/* any event, including IN_IGNORED for a vanished file, counts */
+	while ((len = read(cfg->notify_fd, buf, sizeof(buf))) > 0)
+		cfg->stale = 1;
+	if (len < 0 && errno != EAGAIN && errno != EINTR)
+		cfg->stale = 1;
+}
+
+static int read_attr(struct uim_cfg *cfg, enum uim_cfg_attr attr,
+		char *buf, int size)
+{
+	char path[PATH_MAX];
+	int fd, len;
+
+	if (snprintf(path, sizeof(path), "%s/%s", cfg->dir, attr_names[attr]) >=
+			(int)sizeof(path)) {
+		UIM_ERR("Can't open %s/%s, error (%s)", cfg->dir,
+				attr_names[attr], strerror(ENAMETOOLONG));
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		UIM_ERR("Can't open %s, error (%s)", path, strerror(errno));
+		return -1;
+	}
+
+	len = read(fd, buf, size - 1);
+	if (len < 0) {
+		UIM_ERR("read err (%s)", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	buf[len] = '\0';
+	close(fd);
+
+	return 0;
+}
+
+static int load_attrs(struct uim_cfg *cfg, struct uim_trace *trace)
+{
+	char buf[UART_DEV_NAME_LEN + 1];
+	int i;
+
+	for (i = 0; i < UIM_CFG_ATTRS; i++) {
+		if (trace)
+			uim_trace_begin(trace, attr_phases[i]);
+		if (read_attr(cfg, i, buf, sizeof(buf)) < 0)
+			return -1;
+
+		switch (i) {
+		case UIM_CFG_DEV_NAME:
+			if (sscanf(buf, "%32s", cfg->dev_name) != 1)
+				return -1;
+			break;
+		case UIM_CFG_BAUD_RATE:
+			if (sscanf(buf, "%ld", &cfg->baud_rate) != 1)
+				return -1;
+			break;
+		case UIM_CFG_FLOW_CTRL:
+			if (sscanf(buf, "%d", &cfg->flow_ctrl) != 1)
+				return -1;
+			break;
+		}
+		if (trace)
+			uim_trace_end(trace, attr_phases[i]);
+	}
+
+	return 0;
+}
+
+/* Function to make the cached configuration current
+ *
+ * The attributes are only read when they were never read or changed
+ * since, the load is recorded in the trace when one is given.
+ */
+int uim_cfg_get(struct uim_cfg *cfg, struct uim_trace *trace)
+{
+	if (!cfg->stale)
+		check_notify(cfg);
+	if (!cfg->stale)
+		return 0;
+
+	UIM_DBG(" Loading configuration from %s", cfg->dir);
+	watch_attrs(cfg);
+	if (load_attrs(cfg, trace) < 0)
+		return -1;
+
+	/* without a watch nothing would tell about the next change */
+	cfg->stale = cfg->notify_fd < 0;
+	return 0;
+}
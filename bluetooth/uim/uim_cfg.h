@@ -0,0 +1,55 @@
+/*
+ *  User Mode Init manager - KIM configuration cache
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_CFG_H
+#define UIM_CFG_H
+
+#include <limits.h>
+
+#include "uim.h"
+#include "uim_trace.h"
+
+/* Attributes making up the UART configuration */
+enum uim_cfg_attr {
+	UIM_CFG_DEV_NAME,
+	UIM_CFG_BAUD_RATE,
+	UIM_CFG_FLOW_CTRL,
+	UIM_CFG_ATTRS
+};
+
+/* UART configuration exported by one KIM instance.
+ *
+ * The attributes are parsed once and watched with inotify, they are
+ * only read again after one of them changed or went away (driver
+ * rebind). Without inotify every lookup reads them again.
+ */
+struct uim_cfg {
+	char dir[PATH_MAX];
+	int notify_fd;
+	int stale;
+
+	char dev_name[UART_DEV_NAME_LEN + 1];
+	long baud_rate;
+	int flow_ctrl;
+};
+
+void uim_cfg_init(struct uim_cfg *cfg, const char *dir);
+void uim_cfg_release(struct uim_cfg *cfg);
+int uim_cfg_get(struct uim_cfg *cfg, struct uim_trace *trace);
+
+#endif /* UIM_CFG_H */
@@ -0,0 +1,263 @@
+/*
+ *  User Mode Init manager - control socket
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef ANDROID
+#include <cutils/sockets.h>
+#endif
+
+#include "uim.h"
+#include "uim_ctl.h"
+
+static void drop_client(struct uim_ctl_client *client)
+{
+	if (client->src.fd < 0)
+		return;
+	uim_loop_del(client->ctl->loop, &client->src);
+	close(client->src.fd);
+	client->src.fd = -1;
+}
+
+/* Function to run every complete line received from a client */
+static void client_event(struct uim_loop *loop, struct uim_loop_src *src,
+		uint32_t events)
+{
+	struct uim_ctl_client *client = src->data;
+	struct uim_ctl *ctl = client->ctl;
+	char *nl;
+	int rd;
+
+	rd = read(src->fd, client->line + client->len,
+			sizeof(client->line) - client->len);
+	if (rd < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (rd <= 0) {
+		drop_client(client);
+		return;
+	}
+	client->len += rd;
+
+	while (client->src.fd >= 0 &&
+			(nl = memchr(client->line, '\n', client->len))) {
+		*nl = '\0';
+		if (nl > client->line && nl[-1] == '\r')
+			nl[-1] = '\0';
+		ctl->cb(ctl, client, client->line);
+		client->len -= nl + 1 - client->line;
+		memmove(client->line, nl + 1, client->len);
+	}
+
+	if (client->len == sizeof(client->line)) {
+		uim_ctl_reply(client, "error line too long");
+		drop_client(client);
+	}
+}
+
+static void listen_event(struct uim_loop *loop, struct uim_loop_src *src,
+		uint32_t events)
+{
+	struct uim_ctl *ctl = src->data;
+	struct uim_ctl_client *client = NULL;
+	int fd, i;
+
+	fd = accept(src->fd, NULL, NULL);
+	if (fd < 0)
+		return;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	for (i = 0; i < UIM_CTL_MAX_CLIENTS; i++)
+		if (ctl->client[i].src.fd < 0) {
+			client = &ctl->client[i];
+			break;
+		}
+	if (!client) {
+		UIM_DBG("Too many control clients");
+		close(fd);
+		return;
+	}
+
+	client->ctl = ctl;
+	client->src.fd = fd;
+	client->src.events = EPOLLIN;
+	client->src.cb = client_event;
+	client->src.data = client;
+	client->len = 0;
+	client->subscribed = 0;
+	if (uim_loop_add(ctl->loop, &client->src) < 0) {
+		close(fd);
+		client->src.fd = -1;
+	}
+}
+
+/* Function to get the listening socket, the one init created for us
+ * when there is one, otherwise bound at path
+ */
+static int listen_socket(struct uim_ctl *ctl, const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+#ifdef ANDROID
+	fd = android_get_control_socket(UIM_CTL_SOCKET_NAME);
+	if (fd >= 0 && !strcmp(path, UIM_CTL_SOCKET)) {
+		ctl->path = NULL;
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		return listen(fd, UIM_CTL_MAX_CLIENTS) < 0 ? -1 : fd;
+	}
+#endif
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		UIM_ERR("Control socket path %s too long", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	/* a socket left behind by an earlier instance */
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			chmod(path, 0660) < 0 ||
+			listen(fd, UIM_CTL_MAX_CLIENTS) < 0) {
+		close(fd);
+		return -1;
+	}
+	ctl->path = path;
+	return fd;
+}
+
+/* Function to start serving requests on path from the loop */
+int uim_ctl_open(struct uim_ctl *ctl, struct uim_loop *loop, const char *path,
+		uim_ctl_cb cb, void *data)
+{
+	int i;
+
+	memset(ctl, 0, sizeof(*ctl));
+	ctl->loop = loop;
+	ctl->cb = cb;
+	ctl->data = data;
+	for (i = 0; i < UIM_CTL_MAX_CLIENTS; i++)
+		ctl->client[i].src.fd = -1;
+
+	ctl->listen_src.fd = listen_socket(ctl, path);
+	if (ctl->listen_src.fd < 0) {
+		UIM_ERR("Can't listen on %s (%s)", path, strerror(errno));
+		return -1;
+	}
+	ctl->listen_src.events = EPOLLIN;
+	ctl->listen_src.cb = listen_event;
+	ctl->listen_src.data = ctl;
+	if (uim_loop_add(loop, &ctl->listen_src) < 0) {
+		uim_ctl_release(ctl);
+		return -1;
+	}
+	UIM_DBG("Control socket on %s", path);
+	return 0;
+}
+
+void uim_ctl_release(struct uim_ctl *ctl)
+{
+	int i;
+
+	for (i = 0; i < UIM_CTL_MAX_CLIENTS; i++)
+		drop_client(&ctl->client[i]);
+	if (ctl->listen_src.fd >= 0) {
+		uim_loop_del(ctl->loop, &ctl->listen_src);
+		close(ctl->listen_src.fd);
+	}
+	ctl->listen_src.fd = -1;
+	if (ctl->path)
+		unlink(ctl->path);
+	ctl->path = NULL;
+}
+
+static int send_line(struct uim_ctl_client *client, const char *fmt,
+		va_list ap)
+{
+	char line[256];
+	int len;
+
+	len = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+	if (len < 0)
+		return -1;
+	if (len > (int)sizeof(line) - 2)
+		len = sizeof(line) - 2;
+	line[len++] = '\n';
+
+	/* a client gone meanwhile must not raise SIGPIPE */
+	if (send(client->src.fd, line, len, MSG_NOSIGNAL) != len) {
+		UIM_DBG("Dropping control client fd %d", client->src.fd);
+		drop_client(client);
+		return -1;
+	}
+	return 0;
+}
+
+/* Function to send one line to a client, dropping it on failure */
+int uim_ctl_reply(struct uim_ctl_client *client, const char *fmt, ...)
+{
+	va_list ap;
+	int err;
+
+	if (client->src.fd < 0)
+		return -1;
+	va_start(ap, fmt);
+	err = send_line(client, fmt, ap);
+	va_end(ap);
+	return err;
+}
+
+/* Function to have uim_ctl_notify() lines pushed to a client */
+void uim_ctl_subscribe(struct uim_ctl_client *client)
+{
+	client->subscribed = 1;
+}
+
+/* Function to push one line to every subscribed client */
+void uim_ctl_notify(struct uim_ctl *ctl, const char *fmt, ...)
+{
+	struct uim_ctl_client *client;
+	va_list ap;
+	int i;
+
+	for (i = 0; i < UIM_CTL_MAX_CLIENTS; i++) {
+		client = &ctl->client[i];
+		if (client->src.fd < 0 || !client->subscribed)
+			continue;
+		va_start(ap, fmt);
+		send_line(client, fmt, ap);
+		va_end(ap);
+	}
+}
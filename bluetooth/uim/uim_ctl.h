@@ -0,0 +1,79 @@
+/*
+ *  User Mode Init manager - control socket
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_CTL_H
+#define UIM_CTL_H
+
+#include "uim_loop.h"
+
+/* Socket the daemon listens on. On Android init creates it from
+ * "socket uim stream 660 bluetooth bluetooth" in the service entry.
+ */
+#ifdef ANDROID
+#define UIM_CTL_SOCKET_NAME	"uim"
+#define UIM_CTL_SOCKET		"/dev/socket/uim"
+#else
+#define UIM_CTL_SOCKET		"/tmp/uim.sock"
+#endif
+
+/* Clients connected at the same time, more are turned away */
+#define UIM_CTL_MAX_CLIENTS	8
+
+/* Longest request line, newline included */
+#define UIM_CTL_LINE_MAX	128
+
+struct uim_ctl;
+struct uim_ctl_client;
+
+/* Called with each request line, newline stripped. The handler answers
+ * through uim_ctl_reply(), ending with "ok" or "error <reason>".
+ */
+typedef void (*uim_ctl_cb)(struct uim_ctl *ctl, struct uim_ctl_client *client,
+		char *line);
+
+struct uim_ctl_client {
+	struct uim_ctl *ctl;
+	struct uim_loop_src src;	/* src.fd is -1 for a free slot */
+	char line[UIM_CTL_LINE_MAX];
+	int len;
+	int subscribed;			/* takes the pushed notifications */
+};
+
+/* Line based request/reply server on a unix stream socket, run from
+ * the event loop. Replies and notifications are short and written
+ * without blocking, a client that does not keep up is dropped.
+ */
+struct uim_ctl {
+	struct uim_loop *loop;
+	struct uim_loop_src listen_src;
+	const char *path;		/* unlinked on release, NULL if inherited */
+	uim_ctl_cb cb;
+	void *data;
+	struct uim_ctl_client client[UIM_CTL_MAX_CLIENTS];
+};
+
+int uim_ctl_open(struct uim_ctl *ctl, struct uim_loop *loop, const char *path,
+		uim_ctl_cb cb, void *data);
+void uim_ctl_release(struct uim_ctl *ctl);
+int uim_ctl_reply(struct uim_ctl_client *client, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void uim_ctl_subscribe(struct uim_ctl_client *client);
+void uim_ctl_notify(struct uim_ctl *ctl, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+#endif /* UIM_CTL_H */
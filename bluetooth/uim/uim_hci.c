@@ -0,0 +1,538 @@
+/*
+ *  User Mode Init manager - HCI command engine
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "uim.h"
+#include "uim_rx.h"
+#include "uim_hci.h"
+
+/* Largest event the controller can send */
+#define HCI_MAX_EVENT_SIZE	(1 + HCI_EVENT_HDR_SIZE + 255)
+
+/* Write a whole packet, waiting for room in the driver when the UART
+ * is non-blocking and its transmit buffer is full. iov is consumed.
+ */
+int uim_hci_write_packet(struct uim_rx *rx, struct iovec *iov, int iovcnt,
+		const struct timespec *deadline)
+{
+	ssize_t wr;
+	int err;
+
+	while (iovcnt) {
+		wr = uim_transport_writev(rx->tr, iov, iovcnt);
+		if (wr < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return -1;
+			err = uim_transport_wait(rx->tr, POLLOUT, rx->cancel_fd,
+					uim_deadline_ms_left(deadline));
+			if (err == 0)
+				errno = ETIMEDOUT;
+			if (err <= 0 && errno != EINTR)
+				return -1;
+			continue;
+		}
+		rx->written_bytes += wr;
+		while (iovcnt && wr >= (ssize_t) iov->iov_len) {
+			wr -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *) iov->iov_base + wr;
+			iov->iov_len -= wr;
+		}
+	}
+
+	return 0;
+}
+
+static struct uim_rtt_entry *rtt_entry(struct uim_hci *hci,
+		const struct uim_hci_cmd *cmd)
+{
+	return hci->rtt ? uim_rtt_get(hci->rtt, cmd->opcode, hci->baud) : NULL;
+}
+
+/* Time allowed for the attempt about to be made, the retries of a
+ * command back off from the learned deadline. The last attempt, the
+ * only one of a command that is never retried, always gets the full
+ * timeout: giving up early there fails the command outright.
+ */
+static int attempt_timeout(struct uim_hci *hci, const struct uim_hci_cmd *cmd)
+{
+	struct uim_rtt_entry *e = rtt_entry(hci, cmd);
+
+	if (!e)
+		return cmd->desc->timeout_ms;
+	e->max_ms = cmd->desc->timeout_ms;
+	if (cmd->tries > 1)
+		e->retries++;
+	if (cmd->tries > cmd->desc->retries)
+		return cmd->desc->timeout_ms;
+	return uim_rtt_deadline_ms(e, cmd->tries - 1, cmd->desc->timeout_ms);
+}
+
+/* Header and parameters leave in a single writev, the parameters
+ * straight from the caller's buffer
+ */
+static int send_cmd(struct uim_hci *hci, struct uim_hci_cmd *cmd)
+{
+	struct iovec iov[2], sent[2];
+
+	iov[0].iov_base = cmd->hdr;
+	iov[0].iov_len = sizeof(cmd->hdr);
+	iov[1].iov_base = (void *) cmd->param;
+	iov[1].iov_len = cmd->plen;
+	/* uim_hci_write_packet() consumes iov */
+	sent[0] = iov[0];
+	sent[1] = iov[1];
+
+	cmd->tries++;
+	clock_gettime(CLOCK_MONOTONIC, &cmd->sent);
+	uim_deadline_set(&cmd->deadline, attempt_timeout(hci, cmd));
+
+	if (uim_hci_write_packet(hci->rx, iov, cmd->plen ? 2 : 1,
+				&cmd->deadline) < 0) {
+		UIM_ERR(" Failed to write %s (%s)", cmd->desc->name,
+				strerror(errno));
+		cmd->state = UIM_CMD_FAILED;
+		return -1;
+	}
+	if (hci->rx->snoop)
+		uim_snoop_record(hci->rx->snoop, UIM_SNOOP_SENT, sent, 2);
+
+	hci->credits--;
+	cmd->state = UIM_CMD_SENT;
+	hci->sent[hci->nsent++] = cmd;
+
+	return 0;
+}
+
+/* Write queued commands for as long as the controller has room */
+static void flush_queue(struct uim_hci *hci)
+{
+	struct uim_hci_cmd *cmd;
+
+	while (hci->queue_head && hci->credits > 0 &&
+			hci->nsent < UIM_HCI_MAX_INFLIGHT) {
+		cmd = hci->queue_head;
+		hci->queue_head = cmd->next;
+		if (!hci->queue_head)
+			hci->queue_tail = NULL;
+		cmd->next = NULL;
+		send_cmd(hci, cmd);
+	}
+}
+
+static void unqueue(struct uim_hci *hci, struct uim_hci_cmd *cmd)
+{
+	struct uim_hci_cmd **p, *prev = NULL;
+
+	for (p = &hci->queue_head; *p; prev = *p, p = &(*p)->next) {
+		if (*p == cmd) {
+			*p = cmd->next;
+			if (hci->queue_tail == cmd)
+				hci->queue_tail = prev;
+			cmd->next = NULL;
+			return;
+		}
+	}
+}
+
+/* Index of the oldest sent command with the given opcode, or -1 */
+static int find_sent(struct uim_hci *hci, uint16_t opcode)
+{
+	int i;
+
+	for (i = 0; i < hci->nsent; i++)
+		if (hci->sent[i]->opcode == opcode)
+			return i;
+
+	return -1;
+}
+
+static struct uim_hci_cmd *remove_sent(struct uim_hci *hci, int i)
+{
+	struct uim_hci_cmd *cmd = hci->sent[i];
+
+	memmove(&hci->sent[i], &hci->sent[i + 1],
+			(hci->nsent - i - 1) * sizeof(cmd));
+	hci->nsent--;
+
+	return cmd;
+}
+
+/* Function to account the round trip of a reply. Replies to a retried
+ * command are not, it is unknown which attempt they answer.
+ */
+static void sample_rtt(struct uim_hci *hci, const struct uim_hci_cmd *cmd)
+{
+	struct uim_rtt_entry *e = rtt_entry(hci, cmd);
+	struct uim_metrics_cmd *mc;
+	struct timespec now;
+	long us;
+
+	if (cmd->tries != 1 || (!e && !hci->metrics))
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - cmd->sent.tv_sec) * 1000000L +
+		(now.tv_nsec - cmd->sent.tv_nsec) / 1000;
+	if (e)
+		uim_rtt_sample(e, us);
+	if (!hci->metrics)
+		return;
+	mc = uim_metrics_cmd(hci->metrics, cmd->opcode);
+	if (mc)
+		uim_metrics_sample(&mc->rtt, us);
+	else
+		hci->metrics->other_cmds++;
+}
+
+static void complete(struct uim_hci_cmd *cmd, uint8_t status,
+		const unsigned char *rsp, int len)
+{
+	cmd->status = status;
+	cmd->rsp_len = 0;
+	if (cmd->rsp && len > 0) {
+		cmd->rsp_len = len < cmd->rsp_size ? len : cmd->rsp_size;
+		memcpy(cmd->rsp, rsp, cmd->rsp_len);
+	}
+	cmd->state = UIM_CMD_DONE;
+}
+
+/* Update the credits and complete the matching command, if any.
+ * Replies not matching what the command description expects fail
+ * the command instead of being taken as a success.
+ */
+static void process_event(struct uim_hci *hci, const unsigned char *evt,
+		int len)
+{
+	struct uim_hci_cmd *cmd;
+	uint16_t opcode;
+	int i;
+
+	switch (evt[1]) {
+	case EVT_CMD_COMPLETE:
+		if (len < 1 + HCI_EVENT_HDR_SIZE + EVT_CMD_COMPLETE_SIZE) {
+			UIM_ERR(" Error in response: plen is 0x%02x", evt[2]);
+			return;
+		}
+		hci->credits = evt[3];
+		opcode = evt[4] | evt[5] << 8;
+		if (!opcode)
+			return;
+
+		i = find_sent(hci, opcode);
+		if (i < 0) {
+			UIM_ERR(" Unexpected command complete for 0x%04x", opcode);
+			return;
+		}
+		cmd = remove_sent(hci, i);
+		sample_rtt(hci, cmd);
+
+		/* plen >= 4 for EVT_CMD_COMPLETE */
+		if (len < 1 + HCI_EVENT_HDR_SIZE + EVT_CMD_COMPLETE_SIZE + 1) {
+			UIM_ERR(" Error in response to %s: plen is not >= 4, but 0x%02x!",
+					cmd->desc->name, evt[2]);
+			cmd->state = UIM_CMD_FAILED;
+			return;
+		}
+		if (evt[6] == 0 && len - 7 < cmd->desc->rsp_len) {
+			UIM_ERR(" Error in response to %s: %d parameter bytes, not %d",
+					cmd->desc->name, len - 7, cmd->desc->rsp_len);
+			cmd->state = UIM_CMD_FAILED;
+			return;
+		}
+		complete(cmd, evt[6], evt + 7, len - 7);
+		break;
+
+	case EVT_CMD_STATUS:
+		if (len < 1 + HCI_EVENT_HDR_SIZE + EVT_CMD_STATUS_SIZE) {
+			UIM_ERR(" Error in response: plen is 0x%02x", evt[2]);
+			return;
+		}
+		hci->credits = evt[4];
+		opcode = evt[5] | evt[6] << 8;
+		if (!opcode)
+			return;
+
+		i = find_sent(hci, opcode);
+		if (i < 0) {
+			UIM_ERR(" Unexpected command status for 0x%04x", opcode);
+			return;
+		}
+		/* a pending status only completes commands that do not
+		 * produce a command complete of their own
+		 */
+		if (evt[3] == 0 &&
+				hci->sent[i]->desc->reply == UIM_REPLY_CMD_COMPLETE)
+			return;
+		cmd = remove_sent(hci, i);
+		sample_rtt(hci, cmd);
+		complete(cmd, evt[3], NULL, 0);
+		break;
+
+	default:
+		UIM_VER(" Ignoring event 0x%02x", evt[1]);
+		break;
+	}
+}
+
+/* Apply the retry policy to a command whose reply did not come in time */
+static void handle_timeout(struct uim_hci *hci, struct uim_hci_cmd *cmd)
+{
+	struct uim_rtt_entry *e;
+	struct uim_metrics_cmd *mc;
+	int i;
+
+	if (cmd->state == UIM_CMD_SENT && (e = rtt_entry(hci, cmd)))
+		e->timeouts++;
+	if (cmd->state == UIM_CMD_SENT && hci->metrics) {
+		hci->metrics->timeouts++;
+		mc = uim_metrics_cmd(hci->metrics, cmd->opcode);
+		if (mc)
+			mc->timeouts++;
+	}
+
+	if (cmd->state == UIM_CMD_QUEUED) {
+		unqueue(hci, cmd);
+		cmd->state = UIM_CMD_TIMEOUT;
+	} else {
+		for (i = 0; i < hci->nsent; i++) {
+			if (hci->sent[i] == cmd) {
+				remove_sent(hci, i);
+				break;
+			}
+		}
+
+		if (cmd->tries <= cmd->desc->retries) {
+			UIM_ERR(" No reply to %s, retrying (%d/%d)", cmd->desc->name,
+					cmd->tries, cmd->desc->retries);
+			cmd->state = UIM_CMD_QUEUED;
+			cmd->next = hci->queue_head;
+			hci->queue_head = cmd;
+			if (!hci->queue_tail)
+				hci->queue_tail = cmd;
+			/* the lost reply took the credit with it */
+			if (hci->credits <= 0)
+				hci->credits = 1;
+		} else {
+			UIM_ERR(" No reply to %s", cmd->desc->name);
+			cmd->state = UIM_CMD_TIMEOUT;
+		}
+	}
+
+	/* do not stall the rest of the queue on a lost reply */
+	if (hci->credits <= 0 && !hci->nsent)
+		hci->credits = 1;
+	flush_queue(hci);
+}
+
+void uim_hci_init(struct uim_hci *hci, struct uim_rx *rx)
+{
+	memset(hci, 0, sizeof(*hci));
+	hci->rx = rx;
+	/* the host may always send one command before hearing from
+	 * the controller
+	 */
+	hci->credits = 1;
+}
+
+/* Function to learn the deadlines of the commands into rtt, for the
+ * UART rate given. Cleared by uim_hci_init().
+ */
+void uim_hci_set_rtt(struct uim_hci *hci, struct uim_rtt *rtt, long baud)
+{
+	hci->rtt = rtt;
+	hci->baud = baud;
+}
+
+/* Function to count the latencies and timeouts of the commands into
+ * metrics. Cleared by uim_hci_init().
+ */
+void uim_hci_set_metrics(struct uim_hci *hci, struct uim_metrics *metrics)
+{
+	hci->metrics = metrics;
+}
+
+/* Function to find the in-flight command whose reply is due first,
+ * the one a queued command waits for
+ */
+static struct uim_hci_cmd *first_due(struct uim_hci *hci)
+{
+	struct uim_hci_cmd *due = NULL;
+	int i;
+
+	for (i = 0; i < hci->nsent; i++)
+		if (!due || uim_deadline_before(&hci->sent[i]->deadline,
+					&due->deadline))
+			due = hci->sent[i];
+	return due;
+}
+
+static void abort_all(struct uim_hci *hci, enum uim_hci_cmd_state state)
+{
+	struct uim_hci_cmd *cmd;
+	int i;
+
+	while ((cmd = hci->queue_head)) {
+		hci->queue_head = cmd->next;
+		cmd->next = NULL;
+		cmd->state = state;
+	}
+	hci->queue_tail = NULL;
+
+	for (i = 0; i < hci->nsent; i++)
+		hci->sent[i]->state = state;
+	hci->nsent = 0;
+	hci->credits = 1;
+}
+
+/* Forget every queued or in-flight command, marking them failed */
+void uim_hci_reset(struct uim_hci *hci)
+{
+	abort_all(hci, UIM_CMD_FAILED);
+}
+
+/* Prepare a command from its description. plen is only used by
+ * descriptions of variable length.
+ */
+void uim_hci_cmd_init(struct uim_hci_cmd *cmd, const struct uim_hci_desc *desc,
+		const unsigned char *param, uint8_t plen)
+{
+	uim_hci_cmd_init_opcode(cmd, desc, desc->opcode, param, plen);
+}
+
+/* Same for commands whose opcode is only known when sent, as those of
+ * an init script: desc only gives the reply and retry policy.
+ */
+void uim_hci_cmd_init_opcode(struct uim_hci_cmd *cmd,
+		const struct uim_hci_desc *desc, uint16_t opcode,
+		const unsigned char *param, uint8_t plen)
+{
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->desc = desc;
+	cmd->opcode = opcode;
+	cmd->param = param;
+	cmd->plen = desc->plen == UIM_HCI_PLEN_VAR ? plen : desc->plen;
+
+	cmd->hdr[0] = HCI_COMMAND_PKT;
+	cmd->hdr[1] = opcode & 0xff;
+	cmd->hdr[2] = opcode >> 8;
+	cmd->hdr[3] = cmd->plen;
+}
+
+/* Function to queue a command towards the controller
+ *
+ * The command is written right away when the controller has a free
+ * credit, otherwise as soon as a reply to an earlier command returns
+ * one. The reply is collected by uim_hci_wait().
+ */
+int uim_hci_submit(struct uim_hci *hci, struct uim_hci_cmd *cmd)
+{
+	cmd->state = UIM_CMD_QUEUED;
+	cmd->tries = 0;
+	cmd->next = NULL;
+	/* only bounds the wait for credits nothing in flight will return */
+	uim_deadline_set(&cmd->deadline, cmd->desc->timeout_ms);
+	if (hci->queue_tail)
+		hci->queue_tail->next = cmd;
+	else
+		hci->queue_head = cmd;
+	hci->queue_tail = cmd;
+
+	flush_queue(hci);
+
+	return cmd->state == UIM_CMD_FAILED ? -1 : 0;
+}
+
+/* Function to wait for the reply of a submitted command
+ *
+ * Events answering other in-flight commands are dispatched on the way,
+ * and their credits used to send what is still queued. A command left
+ * without reply is sent again as its description allows. While the
+ * command is queued, a lost reply is charged to the in-flight command
+ * holding it back, not to the command never written.
+ * Returns 0 when the command completed with a success status.
+ */
+int uim_hci_wait(struct uim_hci *hci, struct uim_hci_cmd *cmd)
+{
+	unsigned char evt[HCI_MAX_EVENT_SIZE];
+	struct uim_hci_cmd *due;
+	int len;
+
+	while (cmd->state == UIM_CMD_QUEUED || cmd->state == UIM_CMD_SENT) {
+		due = cmd;
+		if (cmd->state == UIM_CMD_QUEUED && hci->nsent)
+			due = first_due(hci);
+
+		len = uim_rx_read_event(hci->rx, evt, sizeof(evt),
+				uim_deadline_ms_left(&due->deadline));
+		if (len < 0) {
+			/* nobody waits for any of the replies anymore */
+			if (errno == ECANCELED) {
+				abort_all(hci, UIM_CMD_CANCELLED);
+				break;
+			}
+			handle_timeout(hci, due);
+			continue;
+		}
+		if (len >= 1 + HCI_EVENT_HDR_SIZE)
+			process_event(hci, evt, len);
+		flush_queue(hci);
+	}
+
+	if (cmd->state == UIM_CMD_DONE && cmd->status)
+		UIM_ERR(" %s failed with status 0x%02x", cmd->desc->name,
+				cmd->status);
+
+	return (cmd->state == UIM_CMD_DONE && cmd->status == 0) ? 0 : -1;
+}
+
+/* Submit a command and wait for its reply */
+int uim_hci_send(struct uim_hci *hci, struct uim_hci_cmd *cmd)
+{
+	if (uim_hci_submit(hci, cmd) < 0)
+		return -1;
+	return uim_hci_wait(hci, cmd);
+}
+
+const char *uim_hci_cmd_result(const struct uim_hci_cmd *cmd)
+{
+	switch (cmd->state) {
+	case UIM_CMD_DONE:
+		return cmd->status ? "error status" : "ok";
+	case UIM_CMD_TIMEOUT:
+		return "timeout";
+	case UIM_CMD_FAILED:
+		return "failed";
+	case UIM_CMD_CANCELLED:
+		return "cancelled";
+	default:
+		return "pending";
+	}
+}
@@ -0,0 +1,128 @@
+/*
+ *  User Mode Init manager - HCI command engine
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_HCI_H
+#define UIM_HCI_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "uim_rx.h"
+#include "uim_rtt.h"
+#include "uim_metrics.h"
+
+/* Commands that may be waiting for their reply at the same time */
+#define UIM_HCI_MAX_INFLIGHT	8
+
+/* Largest set of return parameters a reply can carry */
+#define UIM_HCI_RSP_MAX		255
+
+/* Parameter length of commands whose size is only known when sent */
+#define UIM_HCI_PLEN_VAR	0xff
+
+/* Reply a command is answered with */
+enum uim_hci_reply {
+	UIM_REPLY_CMD_COMPLETE,	/* command complete with a status byte */
+	UIM_REPLY_CMD_STATUS,	/* command status, or command complete */
+};
+
+/* Static description of one HCI command: what goes out, what must come
+ * back, and how long and how often to try.
+ */
+struct uim_hci_desc {
+	const char *name;
+	uint16_t opcode;
+	uint8_t plen;		/* or UIM_HCI_PLEN_VAR */
+	enum uim_hci_reply reply;
+	uint8_t rsp_len;	/* return parameters required after status */
+	int timeout_ms;		/* per attempt */
+	int retries;		/* extra attempts after a timeout */
+};
+
+enum uim_hci_cmd_state {
+	UIM_CMD_IDLE,
+	UIM_CMD_QUEUED,		/* waiting for a controller credit */
+	UIM_CMD_SENT,		/* waiting for command complete/status */
+	UIM_CMD_DONE,		/* valid reply received, see status */
+	UIM_CMD_TIMEOUT,	/* no reply within the retry policy */
+	UIM_CMD_FAILED,		/* not written or malformed reply */
+	UIM_CMD_CANCELLED,	/* the wait for it was cancelled */
+};
+
+/* One instance of a described command and, once completed, its reply.
+ * The caller owns the structure until the command left the engine.
+ * param is referenced, not copied, until the command is written.
+ */
+struct uim_hci_cmd {
+	const struct uim_hci_desc *desc;
+	uint16_t opcode;
+	const unsigned char *param;
+	uint8_t plen;
+	unsigned char hdr[1 + HCI_COMMAND_HDR_SIZE];
+
+	enum uim_hci_cmd_state state;
+	int tries;
+	struct timespec sent;		/* of the last attempt */
+	struct timespec deadline;	/* of the attempt, or of the submit */
+	uint8_t status;
+	unsigned char *rsp;	/* return parameters following the status */
+	int rsp_size;
+	int rsp_len;
+
+	struct uim_hci_cmd *next;
+};
+
+/* Command flow towards one controller.
+ *
+ * credits mirrors the Num_HCI_Command_Packets value of the last
+ * command complete or command status event: commands are written as
+ * long as the controller announced room for them, the rest wait in a
+ * FIFO. Replies are matched back to the sent commands by opcode.
+ *
+ * With rtt set, every attempt gets a deadline learned from the round
+ * trips of its opcode at the current rate instead of the fixed one.
+ */
+struct uim_hci {
+	struct uim_rx *rx;
+	struct uim_rtt *rtt;	/* NULL for the fixed timeouts */
+	long baud;
+	struct uim_metrics *metrics;	/* NULL if not counted */
+	int credits;
+	struct uim_hci_cmd *queue_head;
+	struct uim_hci_cmd *queue_tail;
+	struct uim_hci_cmd *sent[UIM_HCI_MAX_INFLIGHT];
+	int nsent;
+};
+
+void uim_hci_init(struct uim_hci *hci, struct uim_rx *rx);
+void uim_hci_reset(struct uim_hci *hci);
+void uim_hci_set_rtt(struct uim_hci *hci, struct uim_rtt *rtt, long baud);
+void uim_hci_set_metrics(struct uim_hci *hci, struct uim_metrics *metrics);
+void uim_hci_cmd_init(struct uim_hci_cmd *cmd, const struct uim_hci_desc *desc,
+		const unsigned char *param, uint8_t plen);
+void uim_hci_cmd_init_opcode(struct uim_hci_cmd *cmd,
+		const struct uim_hci_desc *desc, uint16_t opcode,
+		const unsigned char *param, uint8_t plen);
+int uim_hci_submit(struct uim_hci *hci, struct uim_hci_cmd *cmd);
+int uim_hci_wait(struct uim_hci *hci, struct uim_hci_cmd *cmd);
+int uim_hci_send(struct uim_hci *hci, struct uim_hci_cmd *cmd);
+const char *uim_hci_cmd_result(const struct uim_hci_cmd *cmd);
+int uim_hci_write_packet(struct uim_rx *rx, struct iovec *iov, int iovcnt,
+		const struct timespec *deadline);
+
+#endif /* UIM_HCI_H */
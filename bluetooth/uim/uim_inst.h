@@ -0,0 +1,94 @@
+/*
+ *  User Mode Init manager - KIM instances
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_INST_H
+#define UIM_INST_H
+
+#include <limits.h>
+
+#include "uim.h"
+#include "uim_transport.h"
+#include "uim_rx.h"
+#include "uim_hci.h"
+#include "uim_cfg.h"
+#include "uim_trace.h"
+#include "uim_snoop.h"
+#include "uim_bts.h"
+#include "uim_link.h"
+#include "uim_metrics.h"
+#include "uim_mux.h"
+
+/* KIM instances served by one daemon */
+#define UIM_MAX_INSTANCES	4
+
+/* One KIM driver instance and the UART it asks uim to configure.
+ * Instances share nothing, each one is brought up on its own.
+ */
+struct uim_inst {
+	char name[NAME_MAX + 1];	/* platform device, "kim" or "kim.N" */
+	char dir[PATH_MAX];		/* its sysfs directory */
+	int index;			/* discovery order, 0 is the main one */
+
+	/* configuration of the KIM instance, kept between bring-ups */
+	struct uim_cfg cfg;
+
+	int dev_fd;
+	/* name dev_fd was opened with */
+	char dev_fd_name[UART_DEV_NAME_LEN + 1];
+	/* set while the UART runs at a stored rate not checked yet */
+	int link_unverified;
+	/* rate the UART runs at, 0 while closed */
+	long baud;
+
+	struct uim_transport tr;
+	struct uim_rx rx;
+	struct uim_hci hci;
+	/* command round trips, for the deadlines of the next bring-ups */
+	struct uim_rtt rtt;
+
+	/* per-phase timings of the last bring-up cycles */
+	struct uim_trace trace;
+	/* HCI traffic of the last bring-up cycles */
+	struct uim_snoop snoop;
+	/* init script, mapped while the file stays the same */
+	struct uim_bts bts;
+	/* last link test, with link_bench set */
+	struct uim_link_result link;
+	/* counted during a bring-up, published to metrics_slot after it */
+	struct uim_metrics metrics;
+	struct uim_metrics_slot *metrics_slot;
+	/* channels served from user space, with mux_dir set */
+	struct uim_mux *mux;
+
+	/* called from the bring-up as soon as the channels are served,
+	 * before the bookkeeping that follows
+	 */
+	void (*ready)(struct uim_inst *inst, void *data);
+	void *ready_data;
+
+	/* set, and cancel_fd made readable, to abort a running bring-up */
+	volatile int cancel;
+	int cancel_fd;
+};
+
+void uim_inst_init(struct uim_inst *inst, const char *dir, int index);
+int kim_attr_open(const struct uim_inst *inst, const char *attr);
+int st_uart_config(struct uim_inst *inst, unsigned char install);
+int st_uart_prepare(struct uim_inst *inst);
+
+#endif /* UIM_INST_H */
@@ -0,0 +1,329 @@
+/*
+ *  User Mode Init manager - UART link self-test
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "uim.h"
+#include "uim_inst.h"
+#include "uim_link.h"
+
+static const struct uim_hci_desc hci_write_loopback_mode = {
+	.name = "write_loopback_mode",
+	.opcode = HCI_WRITE_LOOPBACK_MODE_OPCODE,
+	.plen = 1,
+	.reply = UIM_REPLY_CMD_COMPLETE,
+	.timeout_ms = UIM_RX_TIMEOUT_MS,
+	.retries = 2,
+};
+
+static long elapsed_us(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000000L +
+		(b->tv_nsec - a->tv_nsec) / 1000;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *) a, y = *(const long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int set_loopback(struct uim_inst *inst, unsigned char mode)
+{
+	struct uim_hci_cmd cmd;
+	int err;
+
+	uim_hci_cmd_init(&cmd, &hci_write_loopback_mode, &mode, 0);
+	err = uim_hci_send(&inst->hci, &cmd);
+	if (err < 0)
+		UIM_ERR(" Can't set loopback mode %d: %s", mode,
+				uim_hci_cmd_result(&cmd));
+	uim_hci_reset(&inst->hci);
+
+	return err;
+}
+
+/* Byte at offset off of the parameters of packet seq */
+static inline unsigned char pattern(uint32_t seq, unsigned int off)
+{
+	if (off < UIM_LINK_MIN_SIZE)
+		return seq >> (8 * off);
+	return seq + off;
+}
+
+static int send_packet(struct uim_inst *inst, unsigned char *pkt,
+		uint32_t seq, unsigned int size)
+{
+	struct timespec deadline;
+	struct iovec iov;
+	unsigned int i;
+
+	pkt[0] = HCI_COMMAND_PKT;
+	pkt[1] = HCI_READ_LOCAL_VERSION_OPCODE & 0xff;
+	pkt[2] = HCI_READ_LOCAL_VERSION_OPCODE >> 8;
+	pkt[3] = size;
+	for (i = 0; i < size; i++)
+		pkt[1 + HCI_COMMAND_HDR_SIZE + i] = pattern(seq, i);
+
+	iov.iov_base = pkt;
+	iov.iov_len = 1 + HCI_COMMAND_HDR_SIZE + size;
+	uim_deadline_set(&deadline, UIM_LINK_TIMEOUT_MS);
+	if (uim_hci_write_packet(&inst->rx, &iov, 1, &deadline) < 0) {
+		UIM_ERR(" Failed to write loopback packet (%s)", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Function to decode a Loopback Command event, returns 0 and the
+ * sequence number of an echo whose header is intact, -1 otherwise.
+ * *intact tells whether the pattern came back unchanged too.
+ */
+static int parse_echo(const unsigned char *evt, int len, unsigned int size,
+		uint32_t *seq, int *intact)
+{
+	const unsigned char *param = evt + 1 + HCI_EVENT_HDR_SIZE +
+		HCI_COMMAND_HDR_SIZE;
+	unsigned int i;
+
+	if (len != 1 + HCI_EVENT_HDR_SIZE + HCI_COMMAND_HDR_SIZE + (int) size ||
+			evt[2] != HCI_COMMAND_HDR_SIZE + size ||
+			(evt[3] | evt[4] << 8) != HCI_READ_LOCAL_VERSION_OPCODE ||
+			evt[5] != size)
+		return -1;
+
+	*seq = param[0] | param[1] << 8 | param[2] << 16 |
+		(uint32_t) param[3] << 24;
+	*intact = 1;
+	for (i = UIM_LINK_MIN_SIZE; i < size; i++)
+		if (param[i] != pattern(*seq, i)) {
+			*intact = 0;
+			break;
+		}
+	return 0;
+}
+
+/* Function to log a result, in records short enough to be deferred */
+static void log_result(const struct uim_inst *inst,
+		const struct uim_link_result *res)
+{
+	UIM_DBG("link %s: %ld baud, flow %d, %lu of %lu echoed, %lu lost, "
+			"%lu corrupt", inst->name, res->baud, res->flow_ctrl,
+			res->received, res->sent, res->lost, res->corrupt);
+	UIM_DBG("link %s: tx %ld B/s, rx %ld B/s, rtt p50 %ld p99 %ld "
+			"max %ld us", inst->name, res->tx_bytes_s,
+			res->rx_bytes_s, res->rtt_p50_us, res->rtt_p99_us,
+			res->rtt_max_us);
+	if (res->icount_valid)
+		UIM_DBG("link %s: frame %d overrun %d parity %d brk %d "
+				"buf_overrun %d", inst->name,
+				res->icount.frame, res->icount.overrun,
+				res->icount.parity, res->icount.brk,
+				res->icount.buf_overrun);
+}
+
+/* Function to read the count, size and window of a link test from a
+ * "count[,size[,window]]" string, NULL for the defaults
+ */
+int uim_link_parse(struct uim_link_cfg *cfg, const char *str)
+{
+	cfg->count = UIM_LINK_DEFAULT_COUNT;
+	cfg->size = UIM_LINK_DEFAULT_SIZE;
+	cfg->window = UIM_LINK_DEFAULT_WINDOW;
+
+	if (str && sscanf(str, "%u,%u,%u", &cfg->count, &cfg->size,
+				&cfg->window) < 1)
+		return -1;
+	if (!cfg->count || cfg->count > UIM_LINK_MAX_COUNT ||
+			cfg->size < UIM_LINK_MIN_SIZE ||
+			cfg->size > UIM_LINK_MAX_SIZE ||
+			!cfg->window || cfg->window > UIM_LINK_MAX_WINDOW)
+		return -1;
+	return 0;
+}
+
+/* Function to measure the UART link of a configured instance
+ *
+ * Loopback packets are kept window deep in flight until count of them
+ * were sent. The controller echoes in order, an echo overtaking the
+ * oldest packets in flight means those were lost. A timeout gives up
+ * on everything in flight, UIM_LINK_MAX_TIMEOUTS in a row end the run.
+ * The HCI capture is paused meanwhile, it would only hold the pattern.
+ * Returns -1 when loopback could not be set up or the run was ended
+ * early, the result is filled in either way.
+ */
+int uim_link_bench(struct uim_inst *inst, const struct uim_link_cfg *cfg,
+		struct uim_link_result *res)
+{
+	unsigned char pkt[1 + HCI_COMMAND_HDR_SIZE + UIM_LINK_MAX_SIZE];
+	unsigned char evt[1 + HCI_EVENT_HDR_SIZE + 255];
+	struct timespec start, now, sent[UIM_LINK_MAX_WINDOW];
+	struct serial_icounter_struct ic;
+	struct uim_snoop *snoop = inst->rx.snoop;
+	unsigned long next = 0, oldest = 0, nrtt = 0;
+	unsigned long wire;
+	uint32_t seq;
+	long *rtt;
+	int len, intact, timeouts = 0, err = -1;
+
+	UIM_START_FUNC();
+
+	memset(res, 0, sizeof(*res));
+	res->baud = inst->baud;
+	res->flow_ctrl = inst->cfg.flow_ctrl;
+	res->size = cfg->size;
+
+	rtt = malloc(cfg->count * sizeof(*rtt));
+	if (!rtt)
+		return -1;
+	if (set_loopback(inst, HCI_LOOPBACK_LOCAL) < 0) {
+		free(rtt);
+		return -1;
+	}
+	uim_rx_set_snoop(&inst->rx, NULL);
+
+	res->icount_valid = ioctl(inst->dev_fd, TIOCGICOUNT, &res->icount) == 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (oldest < cfg->count) {
+		while (next < cfg->count && next - oldest < cfg->window) {
+			clock_gettime(CLOCK_MONOTONIC, &sent[next % cfg->window]);
+			if (send_packet(inst, pkt, next, cfg->size) < 0)
+				goto out;
+			next++;
+			res->sent++;
+		}
+
+		len = uim_rx_read_event(&inst->rx, evt, sizeof(evt),
+				UIM_LINK_TIMEOUT_MS);
+		if (len < 0) {
+			if (inst->cancel || ++timeouts == UIM_LINK_MAX_TIMEOUTS)
+				goto out;
+			/* whatever is in flight is gone */
+			res->lost += next - oldest;
+			oldest = next;
+			continue;
+		}
+		timeouts = 0;
+
+		if (evt[1] != EVT_LOOPBACK_COMMAND) {
+			res->other++;
+			continue;
+		}
+		if (parse_echo(evt, len, cfg->size, &seq, &intact) < 0 ||
+				seq < oldest || seq >= next) {
+			/* taken for the oldest, echoes do not overtake */
+			res->corrupt++;
+			oldest++;
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		res->lost += seq - oldest;
+		oldest = seq + 1;
+		if (!intact) {
+			res->corrupt++;
+			continue;
+		}
+		res->received++;
+		rtt[nrtt++] = elapsed_us(&sent[seq % cfg->window], &now);
+	}
+	err = 0;
+
+out:
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	res->lost += next - oldest;
+	res->elapsed_us = elapsed_us(&start, &now);
+	if (res->icount_valid &&
+			ioctl(inst->dev_fd, TIOCGICOUNT, &ic) == 0) {
+		res->icount.rx = ic.rx - res->icount.rx;
+		res->icount.tx = ic.tx - res->icount.tx;
+		res->icount.frame = ic.frame - res->icount.frame;
+		res->icount.overrun = ic.overrun - res->icount.overrun;
+		res->icount.parity = ic.parity - res->icount.parity;
+		res->icount.brk = ic.brk - res->icount.brk;
+		res->icount.buf_overrun = ic.buf_overrun - res->icount.buf_overrun;
+	} else {
+		res->icount_valid = 0;
+	}
+
+	if (res->elapsed_us > 0) {
+		wire = 1 + HCI_COMMAND_HDR_SIZE + cfg->size;
+		res->tx_bytes_s = (long long) res->sent * wire * 1000000 /
+			res->elapsed_us;
+		/* the echo carries the command without its packet type */
+		wire += HCI_EVENT_HDR_SIZE;
+		res->rx_bytes_s = (long long) (res->received + res->corrupt) *
+			wire * 1000000 / res->elapsed_us;
+	}
+	if (nrtt) {
+		qsort(rtt, nrtt, sizeof(*rtt), cmp_long);
+		res->rtt_p50_us = rtt[nrtt / 2];
+		res->rtt_p99_us = rtt[(nrtt * 99) / 100];
+		res->rtt_max_us = rtt[nrtt - 1];
+	}
+	free(rtt);
+
+	/* echoes still on their way are ignored by the command engine */
+	if (!inst->cancel && set_loopback(inst, 0) < 0)
+		err = -1;
+	uim_rx_set_snoop(&inst->rx, snoop);
+	log_result(inst, res);
+
+	return err;
+}
+
+/* Function to describe a link test result on one line */
+int uim_link_format(const struct uim_link_result *res, char *buf, size_t size)
+{
+	int len, load = 0;
+
+	/* 8N1, ten bits per byte */
+	if (res->baud)
+		load = (long long) res->rx_bytes_s * 10 * 100 / res->baud;
+
+	len = snprintf(buf, size, "baud %ld flow %d size %u sent %lu "
+			"received %lu lost %lu corrupt %lu other %lu "
+			"tx %ldB/s rx %ldB/s load %d%% "
+			"rtt p50 %ldus p99 %ldus max %ldus",
+			res->baud, res->flow_ctrl, res->size, res->sent,
+			res->received, res->lost, res->corrupt, res->other,
+			res->tx_bytes_s, res->rx_bytes_s, load,
+			res->rtt_p50_us, res->rtt_p99_us, res->rtt_max_us);
+	if (len < 0 || (size_t) len >= size)
+		return len;
+
+	if (res->icount_valid)
+		len += snprintf(buf + len, size - len,
+				" frame %d overrun %d parity %d brk %d "
+				"buf_overrun %d",
+				res->icount.frame, res->icount.overrun,
+				res->icount.parity, res->icount.brk,
+				res->icount.buf_overrun);
+	else
+		len += snprintf(buf + len, size - len, " errors n/a");
+	return len;
+}
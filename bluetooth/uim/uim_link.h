@@ -0,0 +1,89 @@
+/*
+ *  User Mode Init manager - UART link self-test
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_LINK_H
+#define UIM_LINK_H
+
+#include <stddef.h>
+#include <linux/serial.h>
+
+#include "uim.h"
+
+struct uim_inst;
+
+/* The controller is put in HCI local loopback mode, where it sends
+ * every command packet back in a Loopback Command event instead of
+ * executing it. Sized HCI_Read_Local_Version commands carrying a
+ * sequence number and a pattern are kept in flight and checked on
+ * their way back. The opcode is harmless should loopback not engage.
+ */
+#define HCI_WRITE_LOOPBACK_MODE_OPCODE	0x1802
+#define HCI_LOOPBACK_LOCAL		0x01
+#define EVT_LOOPBACK_COMMAND		0x19
+
+/* Largest parameter size still echoed whole: the event carries the
+ * command header and parameters in its 255 bytes
+ */
+#define UIM_LINK_MAX_SIZE	(255 - HCI_COMMAND_HDR_SIZE)
+#define UIM_LINK_MIN_SIZE	4	/* the sequence number */
+#define UIM_LINK_MAX_WINDOW	32
+#define UIM_LINK_MAX_COUNT	1000000
+
+/* Time allowed for the oldest packet in flight to come back, and the
+ * consecutive expiries after which the link is given up
+ */
+#define UIM_LINK_TIMEOUT_MS	500
+#define UIM_LINK_MAX_TIMEOUTS	3
+
+#define UIM_LINK_DEFAULT_COUNT	1000
+#define UIM_LINK_DEFAULT_SIZE	UIM_LINK_MAX_SIZE
+#define UIM_LINK_DEFAULT_WINDOW	4
+
+struct uim_link_cfg {
+	unsigned int count;	/* packets to send */
+	unsigned int size;	/* parameter bytes per packet */
+	unsigned int window;	/* packets in flight */
+};
+
+struct uim_link_result {
+	long baud;
+	int flow_ctrl;
+	unsigned int size;
+	unsigned long sent;
+	unsigned long received;
+	unsigned long lost;	/* never came back */
+	unsigned long corrupt;	/* came back altered */
+	unsigned long other;	/* unrelated events */
+	long elapsed_us;
+	long tx_bytes_s;	/* H4 bytes on the wire, each way */
+	long rx_bytes_s;
+	long rtt_p50_us;
+	long rtt_p99_us;
+	long rtt_max_us;
+	/* UART error counters over the run, when the driver has them */
+	int icount_valid;
+	struct serial_icounter_struct icount;
+};
+
+int uim_link_parse(struct uim_link_cfg *cfg, const char *str);
+int uim_link_bench(struct uim_inst *inst, const struct uim_link_cfg *cfg,
+		struct uim_link_result *res);
+int uim_link_format(const struct uim_link_result *res, char *buf,
+		size_t size);
+
+#endif /* UIM_LINK_H */
@@ -0,0 +1,493 @@
+/*
+ *  User Mode Init manager - deferred logging
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "uim.h"
+#include "uim_log.h"
+
+volatile int uim_log_level = UIM_LOG_DBG;
+
+static const char *level_names[UIM_LOG_LEVELS] = {
+	[UIM_LOG_ERR] = "err",
+	[UIM_LOG_DBG] = "dbg",
+	[UIM_LOG_VER] = "ver",
+	[UIM_LOG_FUNC] = "func",
+};
+
+/* Records shared by all threads. Writers claim an index with one
+ * atomic add and publish the slot through its seq, the single reader
+ * flushing them detects slots overwritten under its feet.
+ */
+static struct {
+	struct uim_log_slot slot[UIM_LOG_SLOTS];
+	volatile unsigned int tail;	/* next index handed out */
+	unsigned int head;		/* next index to flush */
+	unsigned long lost;
+	int kick_fd;			/* -1 while formatting directly */
+	volatile int kicked;		/* kick_fd signalled since the flush */
+} ring = { .kick_fd = -1 };
+
+/* Kinds of arguments a conversion consumes */
+enum arg_type {
+	ARG_NONE,
+	ARG_INT,
+	ARG_UINT,
+	ARG_DOUBLE,
+	ARG_STR,
+	ARG_PTR,
+};
+
+/* One conversion of a format string, rewritten with the length
+ * modifier of the value as it is stored
+ */
+struct spec {
+	char text[24];
+	char conv;
+	char lmod;		/* 'H' for hh, 'q' for ll, 0 for none */
+	int stars;		/* '*' widths and precisions */
+	enum arg_type type;
+};
+
+/* Function to parse a conversion, p points after the '%' */
+static const char *parse_spec(const char *p, struct spec *sp)
+{
+	int n = 0;
+
+	sp->stars = 0;
+	sp->lmod = 0;
+	sp->text[n++] = '%';
+	while (*p && strchr("-+ #0123456789.*", *p) &&
+			n < (int)sizeof(sp->text) - 4) {
+		if (*p == '*')
+			sp->stars++;
+		sp->text[n++] = *p++;
+	}
+	while (*p && strchr("hlLqjzt", *p)) {
+		if (*p == sp->lmod && (*p == 'h' || *p == 'l'))
+			sp->lmod = *p == 'h' ? 'H' : 'q';
+		else
+			sp->lmod = *p;
+		p++;
+	}
+
+	sp->conv = *p;
+	switch (sp->conv) {
+	case 'd': case 'i': case 'c':
+		sp->type = ARG_INT;
+		break;
+	case 'u': case 'x': case 'X': case 'o':
+		sp->type = ARG_UINT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+	case 'a': case 'A':
+		sp->type = ARG_DOUBLE;
+		break;
+	case 's':
+		sp->type = ARG_STR;
+		break;
+	case 'p':
+		sp->type = ARG_PTR;
+		break;
+	default:
+		sp->type = ARG_NONE;
+		break;
+	}
+	if (sp->type == ARG_INT && sp->conv != 'c') {
+		sp->text[n++] = 'l';
+		sp->text[n++] = 'l';
+	} else if (sp->type == ARG_UINT) {
+		sp->text[n++] = 'l';
+		sp->text[n++] = 'l';
+	}
+	sp->text[n++] = sp->conv;
+	sp->text[n] = '\0';
+
+	return *p ? p + 1 : p;
+}
+
+static unsigned char *put(unsigned char *a, unsigned char *end,
+		const void *v, size_t len)
+{
+	if (!a || a + len > end)
+		return NULL;
+	memcpy(a, v, len);
+	return a + len;
+}
+
+/* Function to store the arguments of a record, in the order the
+ * format string consumes them. Classifying the conversions is all
+ * the parsing done here, nothing is formatted.
+ */
+static void capture(struct uim_log_slot *s, const char *fmt, va_list ap)
+{
+	unsigned char *a = s->args, *end = s->args + sizeof(s->args);
+	const char *p = fmt, *str;
+	struct spec sp;
+	long long v;
+	unsigned long long u;
+	double d;
+	uint8_t n;
+	int i;
+
+	s->truncated = 0;
+	while (a && (p = strchr(p, '%'))) {
+		p = parse_spec(p + 1, &sp);
+		if (sp.conv == '%' || sp.type == ARG_NONE)
+			continue;
+		for (i = 0; i < sp.stars; i++) {
+			v = va_arg(ap, int);
+			a = put(a, end, &v, sizeof(v));
+		}
+
+		switch (sp.type) {
+		case ARG_INT:
+			if (sp.lmod == 'q' || sp.lmod == 'j')
+				v = va_arg(ap, long long);
+			else if (sp.lmod == 'l' || sp.lmod == 'z' || sp.lmod == 't')
+				v = va_arg(ap, long);
+			else
+				v = va_arg(ap, int);
+			a = put(a, end, &v, sizeof(v));
+			break;
+		case ARG_UINT:
+			if (sp.lmod == 'q' || sp.lmod == 'j')
+				u = va_arg(ap, unsigned long long);
+			else if (sp.lmod == 'l' || sp.lmod == 'z' || sp.lmod == 't')
+				u = va_arg(ap, unsigned long);
+			else
+				u = va_arg(ap, unsigned int);
+			a = put(a, end, &u, sizeof(u));
+			break;
+		case ARG_DOUBLE:
+			d = va_arg(ap, double);
+			a = put(a, end, &d, sizeof(d));
+			break;
+		case ARG_PTR:
+			u = (uintptr_t)va_arg(ap, void *);
+			a = put(a, end, &u, sizeof(u));
+			break;
+		case ARG_STR:
+			str = va_arg(ap, const char *);
+			if (!str)
+				str = "(null)";
+			if (!a || a + 1 > end) {
+				a = NULL;
+				break;
+			}
+			/* as much of the string as fits */
+			n = strnlen(str, 255) < (size_t)(end - a - 1) ?
+				strnlen(str, 255) : end - a - 1;
+			*a++ = n;
+			memcpy(a, str, n);
+			a += n;
+			if (str[n])
+				s->truncated = 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (!a) {
+		s->truncated = 1;
+		a = end;
+	}
+	s->len = a - s->args;
+}
+
+static const unsigned char *get(const unsigned char *a,
+		const unsigned char *end, void *v, size_t len)
+{
+	if (!a || a + len > end)
+		return NULL;
+	memcpy(v, a, len);
+	return a + len;
+}
+
+/* Function to turn a record back into text, done when flushing */
+static void format_slot(const struct uim_log_slot *s, char *out, int size)
+{
+	const unsigned char *a = s->args, *end = s->args + s->len;
+	const char *p = s->fmt, *pct;
+	char text[64], str[256];
+	struct spec sp;
+	long long v;
+	unsigned long long u;
+	double d;
+	int len = 0, i, j, k;
+
+#define ROOM	(len < size ? size - len : 0)
+#define OUT	(out + (len < size ? len : size - 1))
+	out[0] = '\0';
+	while (a && (pct = strchr(p, '%'))) {
+		len += snprintf(OUT, ROOM, "%.*s", (int)(pct - p), p);
+		p = parse_spec(pct + 1, &sp);
+		if (sp.conv == '%') {
+			len += snprintf(OUT, ROOM, "%%");
+			continue;
+		}
+		if (sp.type == ARG_NONE)
+			continue;
+
+		/* the stored '*' values become plain digits */
+		for (i = j = 0; sp.text[i] && j < (int)sizeof(text) - 12; i++) {
+			if (sp.text[i] != '*') {
+				text[j++] = sp.text[i];
+				continue;
+			}
+			a = get(a, end, &v, sizeof(v));
+			if (!a)
+				break;
+			j += snprintf(text + j, sizeof(text) - j, "%d", (int)v);
+		}
+		text[j] = '\0';
+		if (!a)
+			break;
+
+		switch (sp.type) {
+		case ARG_INT:
+			a = get(a, end, &v, sizeof(v));
+			if (a && sp.conv == 'c')
+				len += snprintf(OUT, ROOM, text, (int)v);
+			else if (a)
+				len += snprintf(OUT, ROOM, text, v);
+			break;
+		case ARG_UINT:
+			a = get(a, end, &u, sizeof(u));
+			if (a)
+				len += snprintf(OUT, ROOM, text, u);
+			break;
+		case ARG_DOUBLE:
+			a = get(a, end, &d, sizeof(d));
+			if (a)
+				len += snprintf(OUT, ROOM, text, d);
+			break;
+		case ARG_PTR:
+			a = get(a, end, &u, sizeof(u));
+			if (a)
+				len += snprintf(OUT, ROOM, text,
+						(void *)(uintptr_t)u);
+			break;
+		case ARG_STR:
+			if (a >= end) {
+				a = NULL;
+				break;
+			}
+			k = *a++;
+			if (a + k > end) {
+				a = NULL;
+				break;
+			}
+			memcpy(str, a, k);
+			str[k] = '\0';
+			a += k;
+			len += snprintf(OUT, ROOM, text, str);
+			break;
+		default:
+			break;
+		}
+	}
+	if (a)
+		len += snprintf(OUT, ROOM, "%s", p);
+	if (s->truncated)
+		snprintf(OUT, ROOM, " [truncated]");
+#undef ROOM
+#undef OUT
+}
+
+/* Function to write one line. A deferred one carries the time it was
+ * recorded at, the flush happens later.
+ */
+static void emit_line(int level, uint64_t ts_us, int deferred,
+		const char *line)
+{
+	unsigned long long sec = ts_us / 1000000, usec = ts_us % 1000000;
+#ifdef ANDROID
+	static const int prio[UIM_LOG_LEVELS] = {
+		ANDROID_LOG_ERROR, ANDROID_LOG_DEBUG,
+		ANDROID_LOG_VERBOSE, ANDROID_LOG_VERBOSE,
+	};
+
+	if (deferred)
+		LOG_PRI(prio[level], LOG_TAG, "[%llu.%06llu] %s", sec, usec, line);
+	else
+		LOG_PRI(prio[level], LOG_TAG, "%s", line);
+#else
+	if (deferred)
+		printf("uim:[%llu.%06llu] %s\n", sec, usec, line);
+	else
+		printf("uim:%s\n", line);
+#endif
+}
+
+static void emit(const struct uim_log_slot *s, int deferred)
+{
+	char line[512];
+
+	format_slot(s, line, sizeof(line));
+	emit_line(s->level, s->ts_us, deferred, line);
+}
+
+/* Function behind the UIM_ERR/UIM_DBG/UIM_VER macros
+ *
+ * Once deferred, a record is a format pointer, a timestamp and the
+ * raw arguments in a shared ring, formatting waits for the flush.
+ * Otherwise it is formatted and written at once. errno is preserved
+ * either way, callers log before reporting it.
+ */
+void uim_log_record(int level, const char *fmt, ...)
+{
+	struct uim_log_slot local, *s = &local;
+	struct timespec ts;
+	unsigned int idx = 0;
+	int err = errno;
+	va_list ap;
+
+	if (ring.kick_fd >= 0) {
+		idx = __sync_fetch_and_add(&ring.tail, 1);
+		s = &ring.slot[idx & UIM_LOG_MASK];
+		s->seq = 0;
+		__sync_synchronize();
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	s->ts_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	s->level = level;
+	s->fmt = fmt;
+	va_start(ap, fmt);
+	capture(s, fmt, ap);
+	va_end(ap);
+
+	if (s == &local) {
+		emit(s, 0);
+	} else {
+		__sync_synchronize();
+		s->seq = idx + 1;
+		/* one wakeup per flush, not per record */
+		if (!ring.kicked && __sync_bool_compare_and_swap(&ring.kicked, 0, 1)) {
+			uint64_t one = 1;
+
+			if (write(ring.kick_fd, &one, sizeof(one)) < 0)
+				ring.kicked = 0;
+		}
+	}
+	errno = err;
+}
+
+/* Function to switch to deferred records. Returns an eventfd that
+ * becomes readable when records wait, the owner calls uim_log_flush()
+ * some time after.
+ */
+int uim_log_defer(void)
+{
+	if (ring.kick_fd >= 0)
+		return ring.kick_fd;
+
+	ring.head = ring.tail;
+	ring.kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring.kick_fd < 0)
+		UIM_ERR("Can't defer logging (%s)", strerror(errno));
+	return ring.kick_fd;
+}
+
+/* Function to format and write every complete record, from a single
+ * thread. It stops at a record still being written.
+ */
+void uim_log_flush(void)
+{
+	struct uim_log_slot copy, *s;
+	unsigned int tail, seq;
+	uint64_t count;
+	char line[64];
+
+	if (ring.kick_fd < 0)
+		return;
+
+	while (read(ring.kick_fd, &count, sizeof(count)) > 0)
+		;
+	ring.kicked = 0;
+	__sync_synchronize();
+
+	for (;;) {
+		tail = ring.tail;
+		if (ring.head == tail)
+			break;
+		/* writers went round the ring meanwhile */
+		if (tail - ring.head > UIM_LOG_SLOTS) {
+			ring.lost += tail - UIM_LOG_SLOTS - ring.head;
+			ring.head = tail - UIM_LOG_SLOTS;
+		}
+
+		s = &ring.slot[ring.head & UIM_LOG_MASK];
+		seq = s->seq;
+		if (seq != ring.head + 1) {
+			if (ring.tail - ring.head > UIM_LOG_SLOTS)
+				continue;
+			break;
+		}
+		__sync_synchronize();
+		copy = *s;
+		__sync_synchronize();
+		ring.head++;
+		if (s->seq != seq) {
+			ring.lost++;
+			continue;
+		}
+
+		if (ring.lost) {
+			snprintf(line, sizeof(line), "%lu log records lost",
+					ring.lost);
+			emit_line(UIM_LOG_ERR, copy.ts_us, 1, line);
+			ring.lost = 0;
+		}
+		emit(&copy, 1);
+	}
+	fflush(stdout);
+}
+
+const char *uim_log_level_name(int level)
+{
+	if (level < 0 || level >= UIM_LOG_LEVELS)
+		return "unknown";
+	return level_names[level];
+}
+
+/* Function to get a level from its name or number, -1 if invalid */
+int uim_log_parse_level(const char *name)
+{
+	char *end;
+	long level;
+	int i;
+
+	for (i = 0; i < UIM_LOG_LEVELS; i++)
+		if (!strcmp(name, level_names[i]))
+			return i;
+	level = strtol(name, &end, 10);
+	if (*name && !*end && level >= 0 && level < UIM_LOG_LEVELS)
+		return level;
+	return -1;
+}
@@ -0,0 +1,78 @@
+/*
+ *  User Mode Init manager - deferred logging
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_LOG_H
+#define UIM_LOG_H
+
+#include <stdint.h>
+
+/* Levels, each one includes the ones before it */
+enum uim_log_level {
+	UIM_LOG_ERR,		/* UIM_ERR */
+	UIM_LOG_DBG,		/* UIM_DBG, the default */
+	UIM_LOG_VER,		/* UIM_VER */
+	UIM_LOG_FUNC,		/* UIM_START_FUNC */
+	UIM_LOG_LEVELS
+};
+
+/* Records kept until the next flush, must be a power of two */
+#define UIM_LOG_SLOTS		512
+#define UIM_LOG_MASK		(UIM_LOG_SLOTS - 1)
+
+/* Room for the arguments of one record, longer ones are truncated */
+#define UIM_LOG_ARG_SPACE	104
+
+/* Delay between the first deferred record and the flush formatting it */
+#define UIM_LOG_FLUSH_MS	50
+
+/* One record: the format string is kept by reference, it is always a
+ * literal, and the arguments by value in the order they are consumed.
+ * Strings are copied, everything else takes 8 bytes.
+ */
+struct uim_log_slot {
+	volatile unsigned int seq;	/* index + 1 once complete */
+	uint8_t level;
+	uint8_t len;			/* bytes of args used */
+	uint8_t truncated;		/* some arguments did not fit */
+	uint8_t pad;
+	const char *fmt;
+	uint64_t ts_us;			/* CLOCK_MONOTONIC */
+	unsigned char args[UIM_LOG_ARG_SPACE];
+};
+
+/* Records at or below this level are kept, the rest cost one compare */
+extern volatile int uim_log_level;
+
+void uim_log_record(int level, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+int uim_log_defer(void);
+void uim_log_flush(void);
+const char *uim_log_level_name(int level);
+int uim_log_parse_level(const char *name);
+
+#define UIM_LOG(level, fmt, arg...) do { \
+	if ((level) <= uim_log_level) \
+		uim_log_record(level, fmt, ##arg); \
+} while (0)
+
+#define UIM_ERR(fmt, arg...)	UIM_LOG(UIM_LOG_ERR, fmt, ##arg)
+#define UIM_DBG(fmt, arg...)	UIM_LOG(UIM_LOG_DBG, fmt, ##arg)
+#define UIM_VER(fmt, arg...)	UIM_LOG(UIM_LOG_VER, fmt, ##arg)
+#define UIM_START_FUNC()	UIM_LOG(UIM_LOG_FUNC, "@ %s", __FUNCTION__)
+
+#endif /* UIM_LOG_H */
@@ -0,0 +1,145 @@
+/*
+ *  User Mode Init manager - event loop
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "uim.h"
+#include "uim_loop.h"
+
+int uim_loop_init(struct uim_loop *loop)
+{
+	loop->running = 0;
+	loop->epfd = epoll_create(UIM_LOOP_MAX_EVENTS);
+	if (loop->epfd < 0) {
+		UIM_ERR("Can't create epoll instance (%s)", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+void uim_loop_release(struct uim_loop *loop)
+{
+	if (loop->epfd >= 0)
+		close(loop->epfd);
+	loop->epfd = -1;
+}
+
+/* Function to watch a source, errno tells why it could not be added */
+int uim_loop_add(struct uim_loop *loop, struct uim_loop_src *src)
+{
+	struct epoll_event ev;
+	int err;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = src->events;
+	ev.data.ptr = src;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0) {
+		err = errno;
+		UIM_DBG("Can't watch fd %d (%s)", src->fd, strerror(err));
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int uim_loop_del(struct uim_loop *loop, struct uim_loop_src *src)
+{
+	struct epoll_event ev;
+
+	/* pre 2.6.9 kernels want an event even though it is ignored */
+	memset(&ev, 0, sizeof(ev));
+	return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, &ev);
+}
+
+/* Function to dispatch events until uim_loop_stop() is called from
+ * one of the callbacks
+ */
+int uim_loop_run(struct uim_loop *loop)
+{
+	struct epoll_event ev[UIM_LOOP_MAX_EVENTS];
+	struct uim_loop_src *src;
+	int n, i;
+
+	loop->running = 1;
+	while (loop->running) {
+		n = epoll_wait(loop->epfd, ev, UIM_LOOP_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			UIM_ERR("epoll_wait failed (%s)", strerror(errno));
+			return -1;
+		}
+		for (i = 0; i < n && loop->running; i++) {
+			src = ev[i].data.ptr;
+			src->cb(loop, src, ev[i].events);
+		}
+	}
+	return 0;
+}
+
+void uim_loop_stop(struct uim_loop *loop)
+{
+	loop->running = 0;
+}
+
+/* Function to create a one-shot monotonic timer for the loop */
+int uim_timer_open(void)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		UIM_ERR("Can't create timer (%s)", strerror(errno));
+	return fd;
+}
+
+/* Function to (re)arm a timer, a timeout of 0 disarms it */
+int uim_timer_arm(int fd, int timeout_ms)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = timeout_ms / 1000;
+	its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000L;
+	return timerfd_settime(fd, 0, &its, NULL);
+}
+
+/* Function to receive the signals of set through a descriptor. They
+ * are blocked in the calling thread, which must be the main one before
+ * any other thread was started so that all of them inherit the mask.
+ */
+int uim_signal_open(const sigset_t *set)
+{
+	int fd;
+
+	if (pthread_sigmask(SIG_BLOCK, set, NULL)) {
+		UIM_ERR("Can't block signals");
+		return -1;
+	}
+	fd = signalfd(-1, set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0)
+		UIM_ERR("Can't create signalfd (%s)", strerror(errno));
+	return fd;
+}
@@ -0,0 +1,60 @@
+/*
+ *  User Mode Init manager - event loop
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_LOOP_H
+#define UIM_LOOP_H
+
+#include <stdint.h>
+#include <signal.h>
+
+/* Events handled per epoll_wait() */
+#define UIM_LOOP_MAX_EVENTS	8
+
+struct uim_loop;
+struct uim_loop_src;
+
+typedef void (*uim_loop_cb)(struct uim_loop *loop, struct uim_loop_src *src,
+		uint32_t events);
+
+/* One file descriptor watched by the loop. The caller owns both the
+ * structure and the descriptor, they must outlive the registration.
+ */
+struct uim_loop_src {
+	int fd;
+	uint32_t events;	/* EPOLLIN, EPOLLPRI ... */
+	uim_loop_cb cb;
+	void *data;
+};
+
+struct uim_loop {
+	int epfd;
+	int running;
+};
+
+int uim_loop_init(struct uim_loop *loop);
+void uim_loop_release(struct uim_loop *loop);
+int uim_loop_add(struct uim_loop *loop, struct uim_loop_src *src);
+int uim_loop_del(struct uim_loop *loop, struct uim_loop_src *src);
+int uim_loop_run(struct uim_loop *loop);
+void uim_loop_stop(struct uim_loop *loop);
+
+int uim_timer_open(void);
+int uim_timer_arm(int fd, int timeout_ms);
+int uim_signal_open(const sigset_t *set);
+
+#endif /* UIM_LOOP_H */
@@ -0,0 +1,1217 @@
+/*
+ *  User Mode Init manager - For shared transport
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <poll.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/types.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#ifdef ANDROID
+#include <private/android_filesystem_config.h>
+#endif
+
+#include "uim.h"
+#include "uim_trace.h"
+#include "uim_inst.h"
+#include "uim_loop.h"
+#include "uim_queue.h"
+#include "uim_ctl.h"
+#include "bd_addr_record.h"
+
+/* BD address as string */
+static char uim_bd_address[BD_ADDR_LEN+1];
+/* BD address taken from the binary record */
+static bdaddr_t bd_record_addr;
+
+/* Directory searched for KIM instances */
+static const char *kim_platform_dir = KIM_PLATFORM_DIR;
+
+/* Where requests are taken from */
+static const char *ctl_path = UIM_CTL_SOCKET;
+
+/* Page the instance metrics are published to */
+static const char *metrics_path = UIM_METRICS_FILE;
+static struct uim_metrics_page *metrics_page;
+static size_t metrics_size;
+
+/* Link test run by every install with --bench-link */
+static struct uim_link_cfg link_cfg;
+
+static const struct option long_opts[] = {
+	{ "bench-link", optional_argument, NULL, 'L' },
+	{ "mux", optional_argument, NULL, 'M' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/* Install edges closer than this are settled together */
+#define INSTALL_SETTLE_MS	20
+
+/* Period at which an install entry that cannot be polled is read */
+#define INSTALL_POLL_MS		50
+
+/* KIM instances served, each by its own thread */
+static struct uim_inst *insts[UIM_MAX_INSTANCES];
+static int ninsts;
+
+/* What happened to the install events of an instance. Written by
+ * both threads, only with atomic increments.
+ */
+struct uim_reconcile_stats {
+	unsigned long events;		/* notifications read */
+	unsigned long bounces;		/* notifications without a change */
+	unsigned long merged;		/* states replaced before being acted on */
+	unsigned long dropped;		/* runs that found nothing to do */
+	unsigned long restarts;		/* bring-ups redone after a missed off */
+	unsigned long runs;		/* st_uart_config() calls */
+	unsigned long cancelled;	/* bring-ups aborted half way */
+};
+
+#define STAT_INC(w, field)	__sync_fetch_and_add(&(w)->stats.field, 1)
+
+/* Changes of state kept for the loop to push, more than it can miss
+ * between two wakeups in practice
+ */
+#define UIM_STATUS_HISTORY	8
+
+/* State of an instance as reported on the control socket */
+struct uim_status {
+	unsigned long seq;		/* bumped on every change of state */
+	const char *history[UIM_STATUS_HISTORY];	/* by seq */
+	const char *state;		/* "off", "starting" or "ready" */
+	long baud;
+	long last_us;			/* duration of the last bring-up */
+	const char *error;		/* why it failed, "none" if it did not */
+};
+
+/* What the last bring-up or teardown of an instance left behind, for
+ * the loop to answer from while the next one runs
+ */
+struct uim_report {
+	struct uim_trace trace;
+	struct uim_snoop snoop;
+	struct uim_rtt rtt;
+	struct uim_link_result link;
+	/* channels served, cleared before the UART is touched again */
+	struct uim_mux *mux;
+};
+
+/* Daemon side of an instance: the install entry watched by the event
+ * loop and the thread reconciling the UART with it.
+ *
+ * The loop only records the state the KIM asks for. The thread
+ * compares it with the state the UART is actually in, and only does
+ * the work needed to go from one to the other. So a burst of edges
+ * costs at most one teardown and one bring-up, and always ends in the
+ * state asked for last.
+ *
+ * States travel through a lock-free queue, neither side ever waits
+ * for the other. A bring-up the loop learns is no longer wanted is
+ * cancelled: it stops at its next step, or at once if it waits for
+ * the controller. The loop never touches the instance itself, it
+ * reports from copies the thread publishes between bring-ups.
+ */
+struct uim_watch {
+	struct uim_inst *inst;
+	int st_fd;
+	unsigned char install;		/* last value read */
+	int off_seen;			/* an off edge since the last post */
+	struct uim_loop_src install_src;
+	int poll_fd;
+	struct uim_loop_src poll_src;
+	int polled;			/* entry read periodically */
+
+	/* leading edges are posted at once, the ones following within
+	 * INSTALL_SETTLE_MS only when the window closes
+	 */
+	int settle_fd;
+	struct uim_loop_src settle_src;
+	int settling;
+	int dirty;
+
+	/* states for the thread, the doorbell rings after each push */
+	struct uim_queue queue;
+	int doorbell_fd;
+	volatile int stop;
+	struct uim_reconcile_stats stats;
+	pthread_t thread;
+	int started;
+
+	/* state the thread is working towards, 0 while idle */
+	volatile unsigned char target;
+
+	/* state the UART is in, only touched by the thread */
+	unsigned char actual;
+
+	/* written by the thread, read by the loop */
+	pthread_mutex_t status_lock;
+	struct uim_status status;
+	/* state and seq last pushed to subscribers, loop side */
+	const char *announced;
+	unsigned long announced_seq;
+
+	/* written by the thread after each configure(), read by the loop */
+	pthread_mutex_t report_lock;
+	struct uim_report report;
+};
+
+static struct uim_watch watches[UIM_MAX_INSTANCES];
+
+/* Main event loop and its signal source */
+static struct uim_loop loop;
+static struct uim_loop_src signal_src;
+
+/* Control socket, and the eventfd threads ring on status updates */
+static struct uim_ctl ctl;
+static int ctl_open;
+static struct uim_loop_src notify_src;
+
+/* Deferred log records are formatted UIM_LOG_FLUSH_MS after the first
+ * of them, by the loop and away from the UART exchanges
+ */
+static struct uim_loop_src log_src;
+static struct uim_loop_src log_timer_src;
+
+/* Function to save the HCI capture of an instance, NULL on failure */
+static const char *save_snoop(struct uim_watch *w)
+{
+	static char path[PATH_MAX];
+	int err;
+
+	pthread_mutex_lock(&w->report_lock);
+	err = uim_snoop_save(&w->report.snoop, w->inst->name, path,
+			sizeof(path));
+	pthread_mutex_unlock(&w->report_lock);
+	return err < 0 ? NULL : path;
+}
+
+/* Function to answer with the command round trips of an instance,
+ * one line per opcode and rate
+ */
+static void reply_rtt(struct uim_ctl_client *client, struct uim_watch *w)
+{
+	char line[256];
+	int i;
+
+	pthread_mutex_lock(&w->report_lock);
+	for (i = 0; i < w->report.rtt.n; i++) {
+		uim_rtt_format(&w->report.rtt.entry[i], line, sizeof(line));
+		uim_ctl_reply(client, "%s %s", w->inst->name, line);
+	}
+	pthread_mutex_unlock(&w->report_lock);
+}
+
+/* Function to answer with the last link test of an instance */
+static void reply_link(struct uim_ctl_client *client, struct uim_watch *w)
+{
+	char line[256];
+
+	pthread_mutex_lock(&w->report_lock);
+	uim_link_format(&w->report.link, line, sizeof(line));
+	pthread_mutex_unlock(&w->report_lock);
+	uim_ctl_reply(client, "%s %s", w->inst->name, line);
+}
+
+/* Function to answer with the traffic of every channel an instance
+ * serves from user space
+ */
+static void reply_mux(struct uim_ctl_client *client, struct uim_watch *w)
+{
+	const char *name = w->inst->name;
+	const struct uim_mux *mux;
+	char line[PATH_MAX + 128];
+	int i;
+
+	/* the channels are not stopped while the report refers to them */
+	pthread_mutex_lock(&w->report_lock);
+	mux = w->report.mux;
+	if (!mux) {
+		pthread_mutex_unlock(&w->report_lock);
+		uim_ctl_reply(client, "%s none", name);
+		return;
+	}
+	for (i = 0; i < UIM_MUX_CHANNELS; i++) {
+		uim_mux_format(mux, i, line, sizeof(line));
+		uim_ctl_reply(client, "%s %s", name, line);
+	}
+	uim_ctl_reply(client, "%s resync %lu writes %lu sleeps %lu wakeups %lu",
+			name, mux->resync_bytes, mux->writes, mux->sleeps,
+			mux->wakeups);
+	pthread_mutex_unlock(&w->report_lock);
+}
+
+/* Function to write the bring-up trace of every instance to
+ * UIM_TRACE_FILE, and their HCI captures next to it
+ */
+static void dump_trace(void)
+{
+	char line[NAME_MAX + 128];
+	struct uim_reconcile_stats st;
+	int fd, i, len;
+
+	fd = open(UIM_TRACE_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		UIM_ERR("Can't open %s (%s)", UIM_TRACE_FILE, strerror(errno));
+		return;
+	}
+	for (i = 0; i < ninsts; i++) {
+		len = snprintf(line, sizeof(line), "instance %s\n", insts[i]->name);
+		pthread_mutex_lock(&watches[i].report_lock);
+		if (write(fd, line, len) != len ||
+				uim_trace_dump(&watches[i].report.trace, fd) < 0)
+			UIM_ERR("Failed to write %s (%s)", UIM_TRACE_FILE,
+					strerror(errno));
+		pthread_mutex_unlock(&watches[i].report_lock);
+		save_snoop(&watches[i]);
+
+		st = watches[i].stats;
+		len = snprintf(line, sizeof(line), "events %lu bounces %lu "
+				"merged %lu dropped %lu restarts %lu runs %lu "
+				"cancelled %lu\n", st.events, st.bounces, st.merged,
+				st.dropped, st.restarts, st.runs, st.cancelled);
+		if (write(fd, line, len) != len)
+			UIM_ERR("Failed to write %s (%s)", UIM_TRACE_FILE,
+					strerror(errno));
+	}
+	close(fd);
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+/* Function to find the KIM instances, "kim" and "kim.N" exporting an
+ * install entry. They are sorted by name so that the main "kim" one
+ * comes first.
+ */
+static int discover_instances(void)
+{
+	char names[UIM_MAX_INSTANCES][NAME_MAX + 1];
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+	int i, n = 0;
+	size_t len = strlen(KIM_DEV_NAME);
+
+	dir = opendir(kim_platform_dir);
+	if (!dir) {
+		UIM_ERR("Can't open %s (%s)", kim_platform_dir, strerror(errno));
+		return -1;
+	}
+	while ((de = readdir(dir)) && n < UIM_MAX_INSTANCES) {
+		if (strncmp(de->d_name, KIM_DEV_NAME, len) ||
+				(de->d_name[len] && de->d_name[len] != '.'))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s/%s", kim_platform_dir,
+				de->d_name, INSTALL_SYSFS_ENTRY);
+		if (access(path, R_OK) < 0)
+			continue;
+		snprintf(names[n++], NAME_MAX + 1, "%s", de->d_name);
+	}
+	closedir(dir);
+
+	qsort(names, n, sizeof(names[0]), cmp_name);
+	for (i = 0; i < n; i++) {
+		insts[i] = malloc(sizeof(*insts[i]));
+		if (!insts[i])
+			return -1;
+		snprintf(path, sizeof(path), "%s/%s", kim_platform_dir, names[i]);
+		uim_inst_init(insts[i], path, i);
+		UIM_DBG("Found KIM instance %s", names[i]);
+	}
+	ninsts = n;
+
+	return n;
+}
+
+/* Function to copy what the instance recorded for the loop to report,
+ * with mux the channels it may report on until the next call
+ */
+static void publish_report(struct uim_watch *w, struct uim_mux *mux)
+{
+	struct uim_inst *inst = w->inst;
+
+	pthread_mutex_lock(&w->report_lock);
+	w->report.trace = inst->trace;
+	w->report.snoop = inst->snoop;
+	w->report.rtt = inst->rtt;
+	w->report.link = inst->link;
+	w->report.mux = mux;
+	pthread_mutex_unlock(&w->report_lock);
+}
+
+/* Function to configure an instance. The loop keeps reporting from the
+ * last copy meanwhile, it never waits for a bring-up.
+ */
+static int configure(struct uim_watch *w, unsigned char install)
+{
+	int err;
+
+	/* the channels may be stopped from here on */
+	pthread_mutex_lock(&w->report_lock);
+	w->report.mux = NULL;
+	pthread_mutex_unlock(&w->report_lock);
+
+	err = st_uart_config(w->inst, install);
+	publish_report(w, w->inst->mux);
+
+	STAT_INC(w, runs);
+	if (err < 0 && w->inst->cancel)
+		STAT_INC(w, cancelled);
+
+	return err;
+}
+
+static void ring(int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) < 0)
+		UIM_ERR("Can't signal fd %d (%s)", fd, strerror(errno));
+}
+
+static void drain(int fd)
+{
+	uint64_t count;
+
+	while (read(fd, &count, sizeof(count)) > 0)
+		;
+}
+
+/* Function to publish the state of an instance, the loop pushes it to
+ * the subscribers. A completed install also reports how it went.
+ */
+static void set_status(struct uim_watch *w, const char *state, int install,
+		int err)
+{
+	struct uim_inst *inst = w->inst;
+	const struct uim_trace_cycle *cycle;
+	int phase;
+
+	pthread_mutex_lock(&w->status_lock);
+	if (state != w->status.state) {
+		w->status.seq++;
+		w->status.history[w->status.seq % UIM_STATUS_HISTORY] = state;
+	}
+	w->status.state = state;
+	w->status.baud = inst->baud;
+	cycle = uim_trace_last(&inst->trace);
+	if (install && cycle) {
+		w->status.last_us = uim_trace_cycle_us(cycle);
+		phase = uim_trace_failed_phase(cycle);
+		if (!err)
+			w->status.error = "none";
+		else if (inst->cancel)
+			w->status.error = "cancelled";
+		else if (phase >= 0)
+			w->status.error = uim_trace_phase_name(phase);
+		else
+			w->status.error = "failed";
+	}
+	pthread_mutex_unlock(&w->status_lock);
+
+	ring(notify_src.fd);
+}
+
+/* Called by the bring-up right after the driver got the UART, so that
+ * the stack hears of it before the bring-up is accounted for
+ */
+static void announce_ready(struct uim_inst *inst, void *data)
+{
+	set_status(data, "ready", 0, 0);
+}
+
+/* Function to bring the UART to the desired state. A failed bring-up
+ * leaves it uninstalled, the KIM driver retries on its own.
+ */
+static void reconcile(struct uim_watch *w, unsigned char desired, int restart)
+{
+	int err;
+
+	if (restart && desired == '1' && w->actual == '1') {
+		/* the KIM cycled the chip in between, its ldisc is stale */
+		UIM_DBG("%s: missed an uninstall, redoing the bring-up",
+				w->inst->name);
+		configure(w, '0');
+		w->actual = '0';
+		set_status(w, "off", 0, 0);
+		STAT_INC(w, restarts);
+	}
+
+	if (desired == w->actual) {
+		STAT_INC(w, dropped);
+		return;
+	}
+
+	if (desired == '1')
+		set_status(w, "starting", 0, 0);
+	err = configure(w, desired);
+	if (err < 0 || desired != '1')
+		w->actual = '0';
+	else
+		w->actual = '1';
+	/* "ready" went out from the bring-up, this adds how it went */
+	set_status(w, w->actual == '1' ? "ready" : "off", desired == '1', err);
+}
+
+/* Function to take everything queued, only the last state counts but
+ * a restart asked for on the way is kept. Returns the number taken.
+ */
+static int take_install(struct uim_watch *w, unsigned char *desired,
+		int *restart)
+{
+	struct uim_install_req req;
+	int n = 0;
+
+	while (uim_queue_pop(&w->queue, &req) == 0) {
+		*desired = req.install;
+		*restart |= req.restart;
+		n++;
+	}
+	return n;
+}
+
+/* Thread reconciling the UART of one instance with what the loop read */
+static void *inst_thread(void *arg)
+{
+	struct uim_watch *w = arg;
+	struct uim_inst *inst = w->inst;
+	unsigned char desired;
+	int restart, n;
+
+	if (st_uart_prepare(inst) < 0)
+		UIM_ERR("Can't prepare the UART of %s, configuring it on install",
+				inst->name);
+	publish_report(w, NULL);
+
+	while (!w->stop) {
+		drain(w->doorbell_fd);
+
+		desired = w->actual;
+		restart = 0;
+		n = 0;
+		do {
+			n += take_install(w, &desired, &restart);
+			if (!n)
+				break;
+			/* published before the old cancel is cleared: anything
+			 * pushed after the queue looked empty below sees the new
+			 * target, and its cancel is not cleared anymore
+			 */
+			w->target = desired;
+			__sync_synchronize();
+			inst->cancel = 0;
+			drain(inst->cancel_fd);
+		} while (!uim_queue_empty(&w->queue));
+
+		if (n) {
+			__sync_fetch_and_add(&w->stats.merged, n - 1);
+			reconcile(w, desired, restart);
+			w->target = 0;
+			continue;
+		}
+
+		/* blocking, until the loop pushes or asks to stop */
+		if (!w->stop && uim_queue_empty(&w->queue)) {
+			struct pollfd p = { .fd = w->doorbell_fd, .events = POLLIN };
+
+			if (poll(&p, 1, -1) < 0 && errno != EINTR)
+				break;
+		}
+	}
+	return NULL;
+}
+
+/* Function to call off the bring-up the thread is busy with */
+static void cancel_bringup(struct uim_watch *w)
+{
+	w->inst->cancel = 1;
+	ring(w->inst->cancel_fd);
+}
+
+/* Function to hand the desired state over to the instance thread.
+ * A bring-up going on is cancelled if the state is anything but that
+ * bring-up completed. Without room left in the queue the state stays
+ * dirty and is posted again when the settle window closes.
+ */
+static int post_state(struct uim_watch *w, unsigned char install,
+		int restart)
+{
+	struct uim_install_req req;
+
+	req.install = install;
+	req.restart = restart;
+	if (uim_queue_push(&w->queue, &req) < 0)
+		return -1;
+	ring(w->doorbell_fd);
+
+	__sync_synchronize();
+	if (w->target == '1' && (install != '1' || restart)) {
+		UIM_DBG("%s: bring-up no longer wanted", w->inst->name);
+		cancel_bringup(w);
+	}
+	return 0;
+}
+
+static void post_install(struct uim_watch *w)
+{
+	if (post_state(w, w->install, w->off_seen) < 0) {
+		UIM_DBG("%s: queue full, posting later", w->inst->name);
+		w->dirty = 1;
+		return;
+	}
+	w->off_seen = 0;
+}
+
+/* Function to read the install entry. Reading from offset 0 gives the
+ * current value and re-arms the sysfs notification, the descriptor
+ * stays open.
+ */
+static int read_install(struct uim_watch *w, unsigned char *install)
+{
+	if (pread(w->st_fd, install, 1, 0) != 1) {
+		UIM_ERR("%s: can't read %s (%s)", w->inst->name,
+				INSTALL_SYSFS_ENTRY, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Function to record a notification of the install entry */
+static void install_changed(struct uim_watch *w, int notified)
+{
+	unsigned char install;
+
+	if (read_install(w, &install) < 0)
+		return;
+	if (!notified && install == w->install)
+		return;
+
+	UIM_DBG("%s: read %c from install (previously was %c)",
+			w->inst->name, install, w->install);
+
+	STAT_INC(w, events);
+	if (install == w->install)
+		STAT_INC(w, bounces);
+
+	/* Leaving '1' means the chip goes through an off, even when the
+	 * value came back before it was read: the next on must redo the
+	 * bring-up. An unchanged '0' is an on nobody waits for anymore.
+	 */
+	if (w->install == '1')
+		w->off_seen = 1;
+	w->install = install;
+
+	if (w->settling) {
+		w->dirty = 1;
+		STAT_INC(w, merged);
+		return;
+	}
+	post_install(w);
+	w->settling = 1;
+	uim_timer_arm(w->settle_fd, INSTALL_SETTLE_MS);
+}
+
+static void install_event(struct uim_loop *l, struct uim_loop_src *src,
+		uint32_t events)
+{
+	install_changed(src->data, 1);
+}
+
+static void poll_event(struct uim_loop *l, struct uim_loop_src *src,
+		uint32_t events)
+{
+	struct uim_watch *w = src->data;
+	uint64_t expired;
+
+	if (read(w->poll_fd, &expired, sizeof(expired)) < 0)
+		return;
+	uim_timer_arm(w->poll_fd, INSTALL_POLL_MS);
+	install_changed(w, 0);
+}
+
+static void settle_event(struct uim_loop *l, struct uim_loop_src *src,
+		uint32_t events)
+{
+	struct uim_watch *w = src->data;
+	uint64_t expired;
+
+	if (read(w->settle_fd, &expired, sizeof(expired)) < 0)
+		return;
+
+	if (!w->dirty) {
+		w->settling = 0;
+		return;
+	}
+	/* one more window, the burst may not be over */
+	w->dirty = 0;
+	post_install(w);
+	uim_timer_arm(w->settle_fd, INSTALL_SETTLE_MS);
+}
+
+static void signal_event(struct uim_loop *l, struct uim_loop_src *src,
+		uint32_t events)
+{
+	struct signalfd_siginfo si;
+
+	while (read(src->fd, &si, sizeof(si)) == sizeof(si)) {
+		switch (si.ssi_signo) {
+		case SIGUSR1:
+			/* dump the bring-up trace without disturbing the daemon */
+			dump_trace();
+			break;
+		default:
+			UIM_DBG("signal %d, exiting", si.ssi_signo);
+			uim_loop_stop(l);
+			break;
+		}
+	}
+}
+
+/* Function to push the state changes published by the threads */
+static void notify_event(struct uim_loop *l, struct uim_loop_src *src,
+		uint32_t events)
+{
+	const char *states[UIM_STATUS_HISTORY];
+	struct uim_watch *w;
+	unsigned long seq, s;
+	int i, j, n;
+
+	drain(src->fd);
+	for (i = 0; i < ninsts; i++) {
+		w = &watches[i];
+		/* every change since the last push, not only the last one */
+		n = 0;
+		pthread_mutex_lock(&w->status_lock);
+		seq = w->status.seq;
+		for (s = w->announced_seq + 1; s <= seq; s++)
+			if (seq - s < UIM_STATUS_HISTORY)
+				states[n++] = w->status.history[s % UIM_STATUS_HISTORY];
+		pthread_mutex_unlock(&w->status_lock);
+
+		w->announced_seq = seq;
+		for (j = 0; j < n; j++) {
+			w->announced = states[j];
+			uim_ctl_notify(&ctl, "%s %s", states[j], w->inst->name);
+		}
+	}
+}
+
+static void reply_status(struct uim_ctl_client *client, struct uim_watch *w)
+{
+	struct uim_status st;
+
+	pthread_mutex_lock(&w->status_lock);
+	st = w->status;
+	pthread_mutex_unlock(&w->status_lock);
+
+	uim_ctl_reply(client, "%s state=%s baud=%ld bdaddr=%s last_us=%ld error=%s",
+			w->inst->name, st.state, st.baud,
+			bd_addr && !w->inst->index ? uim_bd_address : "default",
+			st.last_us, st.error);
+}
+
+/* Function to serve one control request, see uim_ctl.h:
+ *   status [instance]	one line of state per instance
+ *   enable [instance]	bring the UART up as if install went to 1
+ *   disable [instance]	take it down as if install went to 0
+ *   subscribe		push "<state> <instance>" lines from now on
+ *   snoop [instance]	save the HCI capture, answers with its path
+ *   rtt [instance]	command round trips and the deadlines they give
+ *   link [instance]	result of the last --bench-link run
+ *   mux [instance]	traffic of the channels served with --mux
+ *   loglevel [level]	set the log level, answers with the current one
+ * Instances default to the main one. enable and disable only hold
+ * until the install entry changes again, the KIM keeps the last word.
+ */
+static void ctl_request(struct uim_ctl *c, struct uim_ctl_client *client,
+		char *line)
+{
+	char cmd[16], name[NAME_MAX + 1];
+	struct uim_watch *w = &watches[0];
+	const char *path;
+	int i, n;
+
+	n = sscanf(line, "%15s %255s", cmd, name);
+	if (n < 1)
+		return;
+
+	/* the argument is a level, not an instance */
+	if (!strcmp(cmd, "loglevel")) {
+		if (n == 2 && uim_log_parse_level(name) < 0) {
+			uim_ctl_reply(client, "error unknown level %s", name);
+			return;
+		}
+		if (n == 2)
+			uim_log_level = uim_log_parse_level(name);
+		uim_ctl_reply(client, "%s", uim_log_level_name(uim_log_level));
+		uim_ctl_reply(client, "ok");
+		return;
+	}
+
+	if (n == 2) {
+		for (i = 0; i < ninsts; i++)
+			if (!strcmp(insts[i]->name, name))
+				break;
+		if (i == ninsts) {
+			uim_ctl_reply(client, "error no instance %s", name);
+			return;
+		}
+		w = &watches[i];
+	}
+
+	if (!strcmp(cmd, "status")) {
+		for (i = 0; i < ninsts; i++)
+			if (n == 1 || w == &watches[i])
+				reply_status(client, &watches[i]);
+	} else if (!strcmp(cmd, "enable") || !strcmp(cmd, "disable")) {
+		if (post_state(w, cmd[0] == 'e' ? '1' : '0', 0) < 0) {
+			uim_ctl_reply(client, "error busy");
+			return;
+		}
+	} else if (!strcmp(cmd, "snoop")) {
+		path = save_snoop(w);
+		if (!path) {
+			uim_ctl_reply(client, "error %s", strerror(errno));
+			return;
+		}
+		uim_ctl_reply(client, "%s", path);
+	} else if (!strcmp(cmd, "rtt")) {
+		reply_rtt(client, w);
+	} else if (!strcmp(cmd, "link")) {
+		reply_link(client, w);
+	} else if (!strcmp(cmd, "mux")) {
+		reply_mux(client, w);
+	} else if (!strcmp(cmd, "subscribe")) {
+		uim_ctl_subscribe(client);
+		/* nobody has to poll for what happened before */
+		for (i = 0; i < ninsts; i++)
+			uim_ctl_reply(client, "%s %s", watches[i].announced,
+					insts[i]->name);
+	} else {
+		uim_ctl_reply(client, "error unknown command %s", cmd);
+		return;
+	}
+	uim_ctl_reply(client, "ok");
+}
+
+static void log_event(struct uim_loop *l, struct uim_loop_src *src,
+		uint32_t events)
+{
+	uint64_t count;
+
+	/* the flush empties the eventfd, only re-arm it here */
+	if (read(src->fd, &count, sizeof(count)) > 0)
+		uim_timer_arm(log_timer_src.fd, UIM_LOG_FLUSH_MS);
+}
+
+static void log_timer_event(struct uim_loop *l, struct uim_loop_src *src,
+		uint32_t events)
+{
+	uint64_t expired;
+
+	if (read(src->fd, &expired, sizeof(expired)) > 0)
+		uim_log_flush();
+}
+
+static void init_src(struct uim_loop_src *src, int fd, uint32_t events,
+		uim_loop_cb cb, void *data)
+{
+	src->fd = fd;
+	src->events = events;
+	src->cb = cb;
+	src->data = data;
+}
+
+/* Function to start serving an instance: its install entry goes into
+ * the loop and its thread waits for the states read from it
+ */
+static int watch_instance(struct uim_watch *w, struct uim_inst *inst)
+{
+	int err;
+
+	w->inst = inst;
+	w->actual = '0';
+	inst->ready = announce_ready;
+	inst->ready_data = w;
+	uim_queue_init(&w->queue);
+	pthread_mutex_init(&w->status_lock, NULL);
+	pthread_mutex_init(&w->report_lock, NULL);
+	w->status.state = w->announced = "off";
+	w->status.error = "none";
+
+	w->doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	inst->cancel_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (w->doorbell_fd < 0 || inst->cancel_fd < 0) {
+		UIM_ERR("Can't create eventfd (%s)", strerror(errno));
+		return -1;
+	}
+
+	w->st_fd = kim_attr_open(inst, INSTALL_SYSFS_ENTRY);
+	if (w->st_fd < 0) {
+		UIM_ERR("unable to open %s/%s(%s)", inst->name,
+				INSTALL_SYSFS_ENTRY, strerror(errno));
+		return -1;
+	}
+	/* read to start proper poll */
+	if (read_install(w, &w->install) < 0)
+		return -1;
+
+	w->settle_fd = uim_timer_open();
+	if (w->settle_fd < 0)
+		return -1;
+	init_src(&w->settle_src, w->settle_fd, EPOLLIN, settle_event, w);
+	if (uim_loop_add(&loop, &w->settle_src) < 0)
+		return -1;
+
+	init_src(&w->install_src, w->st_fd, EPOLLPRI | EPOLLERR,
+			install_event, w);
+	if (uim_loop_add(&loop, &w->install_src) < 0) {
+		if (errno != EPERM)
+			return -1;
+		/* a regular file, as simulators export, never signals */
+		UIM_DBG("%s: reading %s every %dms", inst->name,
+				INSTALL_SYSFS_ENTRY, INSTALL_POLL_MS);
+		w->polled = 1;
+		w->poll_fd = uim_timer_open();
+		if (w->poll_fd < 0)
+			return -1;
+		init_src(&w->poll_src, w->poll_fd, EPOLLIN, poll_event, w);
+		if (uim_loop_add(&loop, &w->poll_src) < 0)
+			return -1;
+		uim_timer_arm(w->poll_fd, INSTALL_POLL_MS);
+	}
+
+	err = pthread_create(&w->thread, NULL, inst_thread, w);
+	if (err) {
+		UIM_ERR("Can't start %s (%s)", inst->name, strerror(err));
+		return -1;
+	}
+	w->started = 1;
+
+	/* special case where bluetoothd starts before the UIM, and UIM
+	 * needs to turn on bluetooth because of that.
+	 */
+	if (w->install == '1') {
+		UIM_DBG("%s: install set previously...", inst->name);
+		post_install(w);
+	}
+	return 0;
+}
+
+/* Function to stop an instance thread, a bring-up going on is
+ * cancelled rather than waited for
+ */
+static void unwatch_instance(struct uim_watch *w)
+{
+	if (w->started) {
+		w->stop = 1;
+		__sync_synchronize();
+		if (w->target == '1')
+			cancel_bringup(w);
+		ring(w->doorbell_fd);
+		pthread_join(w->thread, NULL);
+	}
+	if (w->doorbell_fd >= 0)
+		close(w->doorbell_fd);
+	if (w->inst && w->inst->cancel_fd >= 0)
+		close(w->inst->cancel_fd);
+	if (w->st_fd >= 0)
+		close(w->st_fd);
+	if (w->settle_fd >= 0)
+		close(w->settle_fd);
+	if (w->polled && w->poll_fd >= 0)
+		close(w->poll_fd);
+}
+
+/* Function to take the BD address from the record bd_prov writes,
+ * with a single pread and no parsing. Returns -1 without a valid one.
+ */
+static int read_bd_record(void)
+{
+	struct bd_record rec;
+	ssize_t len;
+	int fd;
+
+	fd = open(BD_RECORD_PATH, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = pread(fd, &rec, sizeof(rec), 0);
+	close(fd);
+	if (!bd_record_valid(&rec, len)) {
+		UIM_ERR("Ignoring invalid BD address record %s", BD_RECORD_PATH);
+		return -1;
+	}
+
+	memcpy(bd_record_addr.b, rec.addr, sizeof(bd_record_addr.b));
+	bd_addr = &bd_record_addr;
+	/* only shown in logs and status replies */
+	snprintf(uim_bd_address, sizeof(uim_bd_address),
+			"%02X:%02X:%02X:%02X:%02X:%02X", rec.addr[0], rec.addr[1],
+			rec.addr[2], rec.addr[3], rec.addr[4], rec.addr[5]);
+	return 0;
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+	int err, opt, i;
+	sigset_t set;
+	/* List of invalid BD addresses */
+	const bdaddr_t bd_address_ignored[] = {
+			{ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+			{ { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF } } };
+
+	UIM_START_FUNC();
+	bd_addr = NULL;
+	err = 0;
+
+	/* Parse the user input */
+#ifdef ANDROID
+	{
+		char value[PROPERTY_VALUE_MAX];
+
+		if (property_get("persist.uim.loglevel", value, "") > 0 &&
+				uim_log_parse_level(value) >= 0)
+			uim_log_level = uim_log_parse_level(value);
+	}
+#endif
+
+	while ((opt = getopt_long(argc, argv, "awp:s:l:f:m:", long_opts,
+					NULL)) != -1) {
+		switch (opt) {
+		case 'a':
+			/* probe the fastest rate instead of the KIM one */
+			baud_autotune = 1;
+			break;
+		case 'w':
+			/* keep the UART open and configured when idle */
+			warm_uart = 1;
+			break;
+		case 'p':
+			/* where to look for KIM instances, for simulators */
+			kim_platform_dir = optarg;
+			break;
+		case 's':
+			ctl_path = optarg;
+			break;
+		case 'l':
+			/* err, dbg, ver or func, the default is dbg */
+			if (uim_log_parse_level(optarg) < 0) {
+				UIM_ERR("Unknown log level %s", optarg);
+				return -1;
+			}
+			uim_log_level = uim_log_parse_level(optarg);
+			break;
+		case 'f':
+			/* download the init script here, KIM must not */
+			fw_path = optarg;
+			break;
+		case 'm':
+			metrics_path = optarg;
+			break;
+		case 'L':
+			/* measure the UART link on install, never hand it over */
+			if (uim_link_parse(&link_cfg, optarg) < 0) {
+				UIM_ERR("Invalid link test %s", optarg);
+				return -1;
+			}
+			link_bench = &link_cfg;
+			break;
+		case 'M':
+			/* no N_TI_WL, split the channels in user space */
+			mux_dir = optarg ? optarg : UIM_MUX_DIR;
+			break;
+		default:
+			UIM_ERR("Usage: uim [-a] [-w] [-p platform dir] [-s socket] [-l level] "
+				"[-f script or dir] [-m metrics] "
+				"[--bench-link[=count[,size[,window]]]] [--mux[=dir]] "
+				"[<bd address>]");
+			return -1;
+		}
+	}
+	if ((argc - optind > 1)) {
+		UIM_ERR("Invalid arguments");
+		UIM_ERR("Usage: uim [-a] [-w] [-p platform dir] [-s socket] [-l level] "
+				"[-f script or dir] [-m metrics] "
+				"[--bench-link[=count[,size[,window]]]] [--mux[=dir]] "
+				"[<bd address>]");
+		return -1;
+	}
+	if (argc - optind == 1) {
+		if (strlen(argv[optind]) != BD_ADDR_LEN) {
+			UIM_ERR("Usage: uim XX:XX:XX:XX:XX:XX");
+			return -1;
+		}
+		/* BD address passed as string in xx:xx:xx:xx:xx:xx format */
+		strncpy(uim_bd_address, argv[optind], BD_ADDR_LEN);
+		/* ensure that null terminated is correctly set at end of buf */
+		uim_bd_address[BD_ADDR_LEN]='\0';
+		bd_addr = strtoba(uim_bd_address);
+	} else if (read_bd_record() < 0) {
+		/* read BD address from the text file of older bd_prov */
+		FILE *bd_prov_file = NULL;
+		char *bd_prov_file_name = BD_PATH;
+		size_t bd_size;
+		bd_prov_file = fopen(bd_prov_file_name, "r");
+		if (bd_prov_file) {
+			bd_size = fread(uim_bd_address, sizeof(char), BD_ADDR_LEN, bd_prov_file);
+			if (bd_size == BD_ADDR_LEN) {
+				uim_bd_address[BD_ADDR_LEN] = '\0';
+				bd_addr = strtoba(uim_bd_address);
+			} else {
+				UIM_ERR("Error while reading BD address from configuration file");
+			}
+			fclose(bd_prov_file);
+		} else {
+			/* No BD provisioning file is not necessarily an error */
+			UIM_DBG("No BD address configuration file found");
+		}
+	}
+
+	if (bd_addr) {
+		/* Check if read value has to be ignored */
+		for (i = 0; i < (sizeof(bd_address_ignored) / sizeof(bdaddr_t)); i++) {
+
+			if (memcmp(&bd_address_ignored[i], bd_addr, sizeof(bdaddr_t)) == 0) {
+
+				UIM_DBG("Stored value "
+						"%02X:%02X:%02X:%02X:%02X:%02X was ignored",
+						bd_addr->b[0], bd_addr->b[1], bd_addr->b[2],
+						bd_addr->b[3], bd_addr->b[4], bd_addr->b[5]);
+				UIM_DBG("Using default chip bd address");
+
+				if (bd_addr != &bd_record_addr)
+					free(bd_addr);
+				bd_addr = NULL;
+
+				break;
+			}
+		}
+		if (bd_addr)
+			UIM_DBG("Using %s bd address", uim_bd_address);
+	} else
+		UIM_DBG("Using default chip bd address");
+
+	/* Signals are taken through the loop. They are blocked before
+	 * any thread starts, so that every thread inherits the mask.
+	 */
+	sigemptyset(&set);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGUSR1);
+	signal_src.fd = uim_signal_open(&set);
+	if (signal_src.fd < 0)
+		return -1;
+	signal_src.events = EPOLLIN;
+	signal_src.cb = signal_event;
+
+	if (uim_loop_init(&loop) < 0 || uim_loop_add(&loop, &signal_src) < 0)
+		return -1;
+
+	if (discover_instances() <= 0) {
+		UIM_ERR("No KIM instance found in %s", kim_platform_dir);
+		return -1;
+	}
+
+	/* optional, the KIM is served without them */
+	metrics_page = uim_metrics_create(metrics_path, ninsts, &metrics_size);
+	for (i = 0; metrics_page && i < ninsts; i++) {
+		insts[i]->metrics_slot = &metrics_page->slot[i];
+		uim_metrics_publish(insts[i]->metrics_slot, &insts[i]->metrics);
+	}
+
+	/* from now on the threads only record, the loop formats */
+	init_src(&log_src, uim_log_defer(), EPOLLIN, log_event, NULL);
+	init_src(&log_timer_src, uim_timer_open(), EPOLLIN, log_timer_event,
+			NULL);
+	if (log_src.fd < 0 || log_timer_src.fd < 0 ||
+			uim_loop_add(&loop, &log_src) < 0 ||
+			uim_loop_add(&loop, &log_timer_src) < 0)
+		return -1;
+
+	init_src(&notify_src, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), EPOLLIN,
+			notify_event, NULL);
+	if (notify_src.fd < 0 || uim_loop_add(&loop, &notify_src) < 0)
+		return -1;
+	/* serving the KIM does not depend on it */
+	ctl_open = uim_ctl_open(&ctl, &loop, ctl_path, ctl_request, NULL) == 0;
+
+	/* every watch is unwatched on exit, even those never started */
+	for (i = 0; i < ninsts; i++) {
+		watches[i].st_fd = -1;
+		watches[i].settle_fd = -1;
+		watches[i].poll_fd = -1;
+		watches[i].doorbell_fd = -1;
+	}
+	for (i = 0; i < ninsts; i++) {
+		if (watch_instance(&watches[i], insts[i]) < 0) {
+			err = -1;
+			break;
+		}
+	}
+
+	if (!err) {
+		UIM_DBG("begin polling...");
+		err = uim_loop_run(&loop);
+	}
+
+	/* a bring-up in progress is cancelled before its thread exits */
+	for (i = 0; i < ninsts; i++) {
+		unwatch_instance(&watches[i]);
+		if (insts[i]->mux)
+			uim_mux_stop(insts[i]->mux);
+		free(insts[i]);
+	}
+	if (ctl_open)
+		uim_ctl_release(&ctl);
+	if (metrics_page) {
+		munmap(metrics_page, metrics_size);
+		unlink(metrics_path);
+	}
+	close(notify_src.fd);
+	uim_loop_release(&loop);
+	close(signal_src.fd);
+
+	/* Free resources, the address of a record is not allocated */
+	if (bd_addr && bd_addr != &bd_record_addr)
+		free(bd_addr);
+	close(log_timer_src.fd);
+	uim_log_flush();
+	return err;
+}
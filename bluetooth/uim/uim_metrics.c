@@ -0,0 +1,290 @@
+/*
+ *  User Mode Init manager - bring-up metrics
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "uim.h"
+#include "uim_metrics.h"
+
+void uim_metrics_init(struct uim_metrics *m, const char *name)
+{
+	memset(m, 0, sizeof(*m));
+	snprintf(m->name, sizeof(m->name), "%s", name);
+}
+
+void uim_metrics_sample(struct uim_metrics_hist *h, long us)
+{
+	int b = 0;
+
+	if (us < 0)
+		us = 0;
+	h->count++;
+	h->sum_us += us;
+	while (us > 1 && b < UIM_METRICS_BUCKETS - 1) {
+		us >>= 1;
+		b++;
+	}
+	h->bucket[b]++;
+}
+
+/* Function to find the counters of an opcode, adding them on first
+ * use. NULL once UIM_METRICS_OPCODES are taken.
+ */
+struct uim_metrics_cmd *uim_metrics_cmd(struct uim_metrics *m,
+		uint16_t opcode)
+{
+	unsigned int i;
+
+	for (i = 0; i < m->ncmds; i++)
+		if (m->cmd[i].opcode == opcode)
+			return &m->cmd[i];
+	if (m->ncmds == UIM_METRICS_OPCODES)
+		return NULL;
+	m->cmd[m->ncmds].opcode = opcode;
+	return &m->cmd[m->ncmds++];
+}
+
+/* Function to create the page published by the daemon, with nslots
+ * empty slots. The page stays mapped for the life of the process.
+ */
+struct uim_metrics_page *uim_metrics_create(const char *path, int nslots,
+		size_t *size)
+{
+	struct uim_metrics_page *page;
+	int fd;
+
+	*size = sizeof(*page) + nslots * sizeof(page->slot[0]);
+
+	/* readers holding the previous page keep their own copy */
+	unlink(path);
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		UIM_ERR("Can't create %s (%s)", path, strerror(errno));
+		return NULL;
+	}
+	if (ftruncate(fd, *size) < 0) {
+		UIM_ERR("Can't size %s (%s)", path, strerror(errno));
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+	page = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		UIM_ERR("Can't map %s (%s)", path, strerror(errno));
+		unlink(path);
+		return NULL;
+	}
+
+	page->version = UIM_METRICS_VERSION;
+	page->nslots = nslots;
+	page->slot_size = sizeof(page->slot[0]);
+	page->start_time = time(NULL);
+	/* readers check the magic last */
+	__sync_synchronize();
+	page->magic = UIM_METRICS_MAGIC;
+
+	return page;
+}
+
+/* Function to map the page of a running daemon read-only */
+const struct uim_metrics_page *uim_metrics_open(const char *path,
+		size_t *size)
+{
+	const struct uim_metrics_page *page;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*page)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	page = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+		return NULL;
+
+	if (page->magic != UIM_METRICS_MAGIC ||
+			page->version != UIM_METRICS_VERSION ||
+			page->slot_size != sizeof(page->slot[0]) ||
+			(size_t) st.st_size < sizeof(*page) +
+			page->nslots * sizeof(page->slot[0])) {
+		munmap((void *) page, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	*size = st.st_size;
+	return page;
+}
+
+/* Function to copy the metrics of an instance to its slot, only ever
+ * called from the thread owning the instance
+ */
+void uim_metrics_publish(struct uim_metrics_slot *slot,
+		const struct uim_metrics *m)
+{
+	slot->seq++;
+	__sync_synchronize();
+	memcpy(&slot->m, m, sizeof(*m));
+	__sync_synchronize();
+	slot->seq++;
+}
+
+/* Function to take a consistent copy of a slot, -1 if the writer kept
+ * getting in the way
+ */
+int uim_metrics_read(const struct uim_metrics_slot *slot,
+		struct uim_metrics *m)
+{
+	uint32_t seq;
+	int i;
+
+	for (i = 0; i < UIM_METRICS_READ_TRIES; i++) {
+		seq = slot->seq;
+		__sync_synchronize();
+		if (!(seq & 1)) {
+			memcpy(m, (const void *) &slot->m, sizeof(*m));
+			__sync_synchronize();
+			if (slot->seq == seq)
+				return 0;
+		}
+		sched_yield();
+	}
+	errno = EAGAIN;
+	return -1;
+}
+
+/* Function to write a line formatted into a buffer of size bytes,
+ * len is what snprintf() returned for it
+ */
+static int put(int fd, const char *line, size_t size, int len)
+{
+	if (len < 0)
+		return -1;
+	if ((size_t) len >= size) {
+		/* truncated, the line was never whole in the buffer */
+		errno = EOVERFLOW;
+		return -1;
+	}
+	return write(fd, line, len) == len ? 0 : -1;
+}
+
+/* Buckets are cumulative and bounded by their upper edge, as the
+ * exposition format of the usual collectors wants them
+ */
+static int dump_hist(int fd, const char *metric, const char *labels,
+		const struct uim_metrics_hist *h)
+{
+	char line[192];
+	uint64_t seen = 0;
+	int b;
+
+	for (b = 0; b < UIM_METRICS_BUCKETS - 1; b++) {
+		seen += h->bucket[b];
+		if (put(fd, line, sizeof(line), snprintf(line, sizeof(line),
+					"%s_bucket{%s,le=\"%lu\"} %llu\n",
+					metric, labels, 2UL << b,
+					(unsigned long long) seen)) < 0)
+			return -1;
+	}
+	if (put(fd, line, sizeof(line), snprintf(line, sizeof(line),
+				"%s_bucket{%s,le=\"+Inf\"} %llu\n",
+				metric, labels, (unsigned long long) h->count)) < 0)
+		return -1;
+	if (put(fd, line, sizeof(line), snprintf(line, sizeof(line),
+				"%s_sum{%s} %llu\n",
+				metric, labels, (unsigned long long) h->sum_us)) < 0)
+		return -1;
+	return put(fd, line, sizeof(line), snprintf(line, sizeof(line),
+				"%s_count{%s} %llu\n",
+				metric, labels, (unsigned long long) h->count));
+}
+
+/* Function to write the metrics of an instance as text, one
+ * "name{labels} value" line per figure
+ */
+int uim_metrics_dump(const struct uim_metrics *m, int fd)
+{
+	const struct {
+		const char *name;
+		uint64_t value;
+	} counters[] = {
+		{ "uim_enables_total", m->enables },
+		{ "uim_disables_total", m->disables },
+		{ "uim_failures_total", m->failures },
+		{ "uim_cancels_total", m->cancels },
+		{ "uim_tx_bytes_total", m->tx_bytes },
+		{ "uim_rx_bytes_total", m->rx_bytes },
+		{ "uim_resync_bytes_total", m->resync_bytes },
+		{ "uim_cmd_timeouts_total", m->timeouts },
+		{ "uim_cmd_untracked_total", m->other_cmds },
+	};
+	char line[192], labels[96];
+	unsigned int i;
+
+	/* the name may come from a page being torn down */
+	snprintf(labels, sizeof(labels), "instance=\"%.*s\"",
+			(int) sizeof(m->name), m->name);
+	for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+		if (put(fd, line, sizeof(line), snprintf(line, sizeof(line),
+					"%s{%s} %llu\n",
+					counters[i].name, labels,
+					(unsigned long long) counters[i].value)) < 0)
+			return -1;
+	if (put(fd, line, sizeof(line), snprintf(line, sizeof(line),
+				"uim_baud{%s} %lld\n",
+				labels, (long long) m->baud)) < 0)
+		return -1;
+	if (put(fd, line, sizeof(line), snprintf(line, sizeof(line),
+				"uim_flow_control{%s} %d\n",
+				labels, m->flow_ctrl)) < 0)
+		return -1;
+	if (put(fd, line, sizeof(line), snprintf(line, sizeof(line),
+				"uim_installed{%s} %d\n",
+				labels, m->installed)) < 0)
+		return -1;
+	if (dump_hist(fd, "uim_bringup_us", labels, &m->bringup) < 0)
+		return -1;
+
+	for (i = 0; i < m->ncmds && i < UIM_METRICS_OPCODES; i++) {
+		snprintf(labels, sizeof(labels),
+				"instance=\"%.*s\",opcode=\"0x%04x\"",
+				(int) sizeof(m->name), m->name, m->cmd[i].opcode);
+		if (put(fd, line, sizeof(line), snprintf(line, sizeof(line),
+					"uim_cmd_opcode_timeouts_total{%s} %llu\n",
+					labels,
+					(unsigned long long) m->cmd[i].timeouts)) < 0 ||
+				dump_hist(fd, "uim_cmd_rtt_us", labels,
+					&m->cmd[i].rtt) < 0)
+			return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ *  User Mode Init manager - bring-up metrics
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_METRICS_H
+#define UIM_METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Cumulative metrics of every instance, published in a file mapped by
+ * the daemon. Monitoring agents map it read-only and copy a slot out
+ * under its seqlock: seq is odd while the slot is written and changes
+ * with every write, a copy taken with the same even seq before and
+ * after is consistent. Reading never involves the daemon.
+ *
+ * The daemon counts into a private struct uim_metrics during a
+ * bring-up and publishes it whole once the bring-up is over, so the
+ * UART exchanges only ever touch plain memory.
+ */
+#ifdef ANDROID
+#define UIM_METRICS_FILE	"/data/misc/bluetooth/uim_metrics"
+#else
+#define UIM_METRICS_FILE	"/tmp/uim_metrics"
+#endif
+
+#define UIM_METRICS_MAGIC	0x534d4955	/* "UIMS" */
+#define UIM_METRICS_VERSION	1
+
+/* Bucket i counts the durations of [2^i, 2^(i+1)) us, the last one
+ * everything slower
+ */
+#define UIM_METRICS_BUCKETS	24
+
+/* Opcodes with a latency histogram, later ones are only counted */
+#define UIM_METRICS_OPCODES	16
+
+/* Attempts at a consistent copy before a reader gives up */
+#define UIM_METRICS_READ_TRIES	1000
+
+struct uim_metrics_hist {
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t bucket[UIM_METRICS_BUCKETS];
+};
+
+struct uim_metrics_cmd {
+	uint16_t opcode;
+	uint16_t reserved;
+	uint32_t reserved2;
+	uint64_t timeouts;
+	struct uim_metrics_hist rtt;	/* replies to first attempts */
+};
+
+struct uim_metrics {
+	char name[32];
+	uint64_t enables;
+	uint64_t disables;
+	uint64_t failures;	/* enables that did not install */
+	uint64_t cancels;	/* of which cancelled */
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	uint64_t resync_bytes;	/* received bytes skipped as noise */
+	uint64_t timeouts;	/* command attempts without a reply */
+	uint64_t other_cmds;	/* replies beyond UIM_METRICS_OPCODES */
+	int64_t baud;		/* 0 while the UART is closed */
+	int32_t flow_ctrl;
+	int32_t installed;
+	struct uim_metrics_hist bringup;
+	uint32_t ncmds;
+	uint32_t reserved;
+	struct uim_metrics_cmd cmd[UIM_METRICS_OPCODES];
+};
+
+struct uim_metrics_slot {
+	volatile uint32_t seq;
+	uint32_t reserved;
+	struct uim_metrics m;
+};
+
+struct uim_metrics_page {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nslots;
+	uint32_t slot_size;	/* sizeof(struct uim_metrics_slot) */
+	uint32_t reserved;
+	int64_t start_time;	/* of the daemon, seconds since the epoch */
+	struct uim_metrics_slot slot[];
+};
+
+void uim_metrics_init(struct uim_metrics *m, const char *name);
+void uim_metrics_sample(struct uim_metrics_hist *h, long us);
+struct uim_metrics_cmd *uim_metrics_cmd(struct uim_metrics *m,
+		uint16_t opcode);
+struct uim_metrics_page *uim_metrics_create(const char *path, int nslots,
+		size_t *size);
+const struct uim_metrics_page *uim_metrics_open(const char *path,
+		size_t *size);
+void uim_metrics_publish(struct uim_metrics_slot *slot,
+		const struct uim_metrics *m);
+int uim_metrics_read(const struct uim_metrics_slot *slot,
+		struct uim_metrics *m);
+int uim_metrics_dump(const struct uim_metrics *m, int fd);
+
+#endif /* UIM_METRICS_H */
@@ -0,0 +1,205 @@
+/*
+ *  User Mode Init manager - HCI engine microbenchmarks
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Runs the receive and command engines over an in-memory transport,
+ * so that only the CPU cost of the code is measured:
+ *   parse   events per second out of a stream of back-to-back events
+ *   resync  cost per byte of garbage in front of every event
+ *   command encode, write, reply match and decode of one command,
+ *           one at a time and with the whole window in flight
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "uim.h"
+#include "uim_transport.h"
+#include "uim_rx.h"
+#include "uim_hci.h"
+
+#define STREAM_SIZE	(256 * 1024)
+
+static unsigned char stream[STREAM_SIZE];
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Fill the stream with events of the sizes a bring-up sees, each one
+ * after garbage bytes. Returns the number of events.
+ */
+static int build_stream(struct uim_transport *t, int garbage, size_t *bytes)
+{
+	static const unsigned char cmd_complete[] = {
+		0x04, 0x0e, 0x04, 0x01, 0x36, 0xff, 0x00 };
+	static const unsigned char local_version[] = {
+		0x04, 0x0e, 0x0c, 0x01, 0x01, 0x10, 0x00,
+		0x06, 0x00, 0x00, 0x06, 0x0d, 0x00, 0x1f, 0x1d };
+	unsigned char evt[1 + HCI_EVENT_HDR_SIZE + 64], noise[256];
+	int n = 0;
+
+	memset(noise, 0xaa, sizeof(noise));
+	/* a vendor event with 64 bytes of parameters */
+	memset(evt, 0x55, sizeof(evt));
+	evt[0] = 0x04;
+	evt[1] = 0xff;
+	evt[2] = 64;
+
+	uim_transport_mem_rewind(t);
+	t->tail = 0;
+	for (;;) {
+		if (uim_transport_mem_push(t, noise, garbage) < 0 ||
+				uim_transport_mem_push(t, n % 4 == 3 ? evt :
+					n % 2 ? local_version : cmd_complete,
+					n % 4 == 3 ? sizeof(evt) : n % 2 ?
+					sizeof(local_version) : sizeof(cmd_complete)) < 0)
+			break;
+		n++;
+	}
+	*bytes = t->tail;
+	return n;
+}
+
+/* Read every event of the stream rounds times, ns per event */
+static double parse(struct uim_transport *t, int events, int rounds)
+{
+	unsigned char buf[1 + HCI_EVENT_HDR_SIZE + 255];
+	struct uim_rx rx;
+	double t0;
+	int r, i;
+
+	uim_rx_init(&rx, t);
+	t0 = now_ns();
+	for (r = 0; r < rounds; r++) {
+		uim_transport_mem_rewind(t);
+		for (i = 0; i < events; i++)
+			if (uim_rx_read_event(&rx, buf, sizeof(buf), 0) < 0)
+				return -1;
+	}
+	return (now_ns() - t0) / ((double)rounds * events);
+}
+
+/* Answer every command with its command complete, granting the
+ * credits given in data
+ */
+static void reply(struct uim_transport *t, const struct iovec *iov,
+		int iovcnt, void *data)
+{
+	const unsigned char *hdr = iov[0].iov_base;
+	unsigned char evt[] = { 0x04, 0x0e, 0x04, 0x01, hdr[1], hdr[2], 0x00 };
+
+	evt[3] = *(int *)data;
+	uim_transport_mem_push(t, evt, sizeof(evt));
+}
+
+static const struct uim_hci_desc bench_cmd = {
+	.name = "bench",
+	.opcode = 0xfd0c,
+	.plen = 4,
+	.reply = UIM_REPLY_CMD_COMPLETE,
+	.rsp_len = 0,
+	.timeout_ms = 100,
+	.retries = 0,
+};
+
+/* Send count commands, window at a time, ns per command */
+static double command(int window, int count)
+{
+	static const unsigned char param[4] = { 1, 2, 3, 4 };
+	struct uim_hci_cmd cmd[UIM_HCI_MAX_INFLIGHT];
+	struct uim_transport t;
+	struct uim_rx rx;
+	struct uim_hci hci;
+	double t0;
+	int n, i;
+
+	uim_transport_mem(&t, stream, sizeof(stream), reply, &window);
+	uim_rx_init(&rx, &t);
+	uim_hci_init(&hci, &rx);
+	hci.credits = window;
+
+	t0 = now_ns();
+	for (n = 0; n < count; n += window) {
+		for (i = 0; i < window; i++) {
+			uim_hci_cmd_init(&cmd[i], &bench_cmd, param, 0);
+			uim_hci_submit(&hci, &cmd[i]);
+		}
+		for (i = 0; i < window; i++)
+			if (uim_hci_wait(&hci, &cmd[i]) < 0)
+				return -1;
+	}
+	return (now_ns() - t0) / n;
+}
+
+static void usage(void)
+{
+	UIM_ERR("Usage: uim_microbench [-r rounds]");
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+	struct uim_transport t;
+	size_t bytes, clean_bytes;
+	double clean, ns;
+	int opt, rounds = 200, events, garbage;
+	static const int garbage_len[] = { 16, 64, 256 };
+	unsigned int i;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	uim_log_level = UIM_LOG_ERR;
+	uim_transport_mem(&t, stream, sizeof(stream), NULL, NULL);
+
+	events = build_stream(&t, 0, &clean_bytes);
+	clean = parse(&t, events, rounds);
+	printf("parse           %8.1f ns/event %8.1f MB/s\n", clean,
+			clean_bytes / (clean * events) * 1e3);
+
+	for (i = 0; i < sizeof(garbage_len) / sizeof(garbage_len[0]); i++) {
+		garbage = garbage_len[i];
+		events = build_stream(&t, garbage, &bytes);
+		ns = parse(&t, events, rounds);
+		printf("resync %3d      %8.1f ns/event %8.2f ns/garbage byte\n",
+				garbage, ns, (ns - clean) / garbage);
+	}
+
+	printf("command         %8.1f ns/command\n", command(1, rounds * 1000));
+	printf("command x%d      %8.1f ns/command\n", UIM_HCI_MAX_INFLIGHT,
+			command(UIM_HCI_MAX_INFLIGHT, rounds * 1000));
+
+	return 0;
+}
@@ -0,0 +1,668 @@
+/*
+ *  User Mode Init manager - user space channel multiplexer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#ifdef ANDROID
+#include <private/android_filesystem_config.h>
+#endif
+
+#include "uim.h"
+#include "uim_mux.h"
+
+/* Time the UART may refuse more bytes before a batch is given up */
+#define UIM_MUX_TX_TIMEOUT_MS	1000
+
+/* Time the controller has to acknowledge a wake-up indication before
+ * it is sent again
+ */
+#define UIM_MUX_WAKE_TIMEOUT_MS	100
+
+#define DIR_RX	0x01		/* sent by the controller */
+#define DIR_TX	0x02		/* sent to the controller */
+
+/* Framing of a channel: header bytes following the channel byte, and
+ * offset and size of the little endian payload length in the header
+ */
+struct st_proto {
+	uint8_t type;
+	uint8_t chan;
+	uint8_t hdr_len;
+	uint8_t len_off;
+	uint8_t len_size;
+	uint8_t dir;
+};
+
+static const struct st_proto protos[] = {
+	{ HCI_COMMAND_PKT, UIM_MUX_BT, 3, 2, 1, DIR_TX },
+	{ HCI_ACLDATA_PKT, UIM_MUX_BT, 4, 2, 2, DIR_RX | DIR_TX },
+	{ HCI_SCODATA_PKT, UIM_MUX_BT, 3, 2, 1, DIR_RX | DIR_TX },
+	{ HCI_EVENT_PKT, UIM_MUX_BT, 2, 1, 1, DIR_RX },
+	{ ST_FM_CH8_PKT, UIM_MUX_FM, 1, 0, 1, DIR_RX | DIR_TX },
+	{ ST_GPS_CH9_PKT, UIM_MUX_GPS, 3, 1, 2, DIR_RX | DIR_TX },
+};
+
+/* Longest channel byte and header */
+#define ST_MAX_HDR	5
+
+static const char *chan_names[UIM_MUX_CHANNELS] = { "bt", "fm", "gps" };
+
+const char *uim_mux_chan_name(int chan)
+{
+	return chan_names[chan];
+}
+
+/* Function to size the frame at the start of p, avail bytes long.
+ * Returns its length, 0 if more bytes are needed to tell or -1 if it
+ * is no frame of a channel that may go in direction dir.
+ */
+static long parse_frame(const unsigned char *p, unsigned int avail, int dir,
+		const struct st_proto **ppr)
+{
+	const struct st_proto *pr = NULL;
+	unsigned int i;
+	long len;
+
+	for (i = 0; i < sizeof(protos) / sizeof(protos[0]); i++)
+		if (protos[i].type == p[0] && (protos[i].dir & dir)) {
+			pr = &protos[i];
+			break;
+		}
+	if (!pr)
+		return -1;
+	if (avail < 1U + pr->hdr_len)
+		return 0;
+
+	len = p[1 + pr->len_off];
+	if (pr->len_size == 2)
+		len |= p[2 + pr->len_off] << 8;
+	len += 1 + pr->hdr_len;
+	if (len > UIM_MUX_MAX_FRAME)
+		return -1;
+
+	*ppr = pr;
+	return len;
+}
+
+/* parse_frame() for the received frame at ring position pos */
+static long ring_frame(const struct uim_mux *mux, unsigned int pos,
+		unsigned int avail, const struct st_proto **ppr)
+{
+	unsigned char hdr[ST_MAX_HDR];
+	unsigned int i;
+
+	if (avail > ST_MAX_HDR)
+		avail = ST_MAX_HDR;
+	for (i = 0; i < avail; i++)
+		hdr[i] = mux->ring[(pos + i) & UIM_MUX_RING_MASK];
+	return parse_frame(hdr, avail, DIR_RX, ppr);
+}
+
+/* Write a whole batch to the UART, waiting for room when its transmit
+ * buffer is full. iov is consumed, done tells how much of it went out
+ * even when the write fails.
+ */
+static int write_uart(struct uim_mux *mux, struct iovec *iov, int iovcnt,
+		size_t *done)
+{
+	ssize_t wr;
+	int err;
+
+	*done = 0;
+	while (iovcnt) {
+		wr = uim_transport_writev(mux->tr, iov, iovcnt);
+		if (wr < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return -1;
+			err = uim_transport_wait(mux->tr, POLLOUT, mux->stop_fd,
+					UIM_MUX_TX_TIMEOUT_MS);
+			if (err == 0)
+				errno = ETIMEDOUT;
+			if (err <= 0 && errno != EINTR)
+				return -1;
+			continue;
+		}
+		*done += wr;
+		while (iovcnt && wr >= (ssize_t) iov->iov_len) {
+			wr -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *) iov->iov_base + wr;
+			iov->iov_len -= wr;
+		}
+	}
+	mux->writes++;
+	return 0;
+}
+
+static void send_ll(struct uim_mux *mux, unsigned char cmd)
+{
+	struct iovec iov = { &cmd, 1 };
+	size_t done;
+
+	if (write_uart(mux, &iov, 1, &done) < 0)
+		UIM_ERR("mux: can't send HCILL 0x%02x (%s)", cmd, strerror(errno));
+}
+
+/* Function to follow the sleep state the controller announces. The
+ * acknowledgements are due before any new frame is sent, but never
+ * between the bytes of one: they are queued until send_tx().
+ */
+static void handle_ll(struct uim_mux *mux, unsigned char cmd)
+{
+	switch (cmd) {
+	case HCILL_GO_TO_SLEEP_IND:
+		mux->ll_out = HCILL_GO_TO_SLEEP_ACK;
+		mux->ll = UIM_LL_ASLEEP;
+		mux->sleeps++;
+		break;
+	case HCILL_WAKE_UP_IND:
+		/* also answers our own indication when both woke at once */
+		mux->ll_out = HCILL_WAKE_UP_ACK;
+		mux->ll = UIM_LL_AWAKE;
+		mux->wakeups++;
+		break;
+	case HCILL_WAKE_UP_ACK:
+		mux->ll = UIM_LL_AWAKE;
+		mux->wakeups++;
+		break;
+	default:
+		/* the host never asks to sleep */
+		break;
+	}
+}
+
+/* Function to hand the len bytes at the ring head, frames whole frames
+ * of one channel, to its pty in a single write straight from the ring.
+ * What the pty had no room for is dropped, except the rest of a frame
+ * it took the beginning of: the stream must stay framed.
+ */
+static void forward(struct uim_mux *mux, int chan, unsigned int len,
+		unsigned int frames)
+{
+	struct uim_mux_chan *c = &mux->chan[chan];
+	const struct st_proto *pr;
+	struct iovec iov[2];
+	unsigned int off, pos, sent = 0, spilled = 0, i;
+	ssize_t wr = 0;
+	long flen;
+
+	if (!len)
+		return;
+
+	/* nothing may overtake a frame being completed */
+	if (!c->spill_len) {
+		off = mux->head & UIM_MUX_RING_MASK;
+		iov[0].iov_base = mux->ring + off;
+		iov[0].iov_len = UIM_MUX_RING_SIZE - off < len ?
+			UIM_MUX_RING_SIZE - off : len;
+		iov[1].iov_base = mux->ring;
+		iov[1].iov_len = len - iov[0].iov_len;
+		wr = uim_transport_writev(&c->tr, iov, iov[1].iov_len ? 2 : 1);
+		if (wr < 0)
+			wr = 0;
+	}
+
+	if ((unsigned int) wr == len) {
+		sent = frames;
+	} else {
+		for (pos = 0; pos < (unsigned int) wr; pos += flen, sent++) {
+			flen = ring_frame(mux, mux->head + pos, len - pos, &pr);
+			if (pos + flen > (unsigned int) wr) {
+				c->spill_off = 0;
+				c->spill_len = spilled = pos + flen - wr;
+				for (i = 0; i < c->spill_len; i++)
+					c->spill[i] = mux->ring[(mux->head + wr + i) &
+						UIM_MUX_RING_MASK];
+				sent++;
+				break;
+			}
+		}
+		c->stats.dropped += frames - sent;
+	}
+	c->stats.rx_frames += sent;
+	c->stats.rx_bytes += wr + spilled;
+	mux->head += len;
+}
+
+static void flush_spill(struct uim_mux_chan *c)
+{
+	ssize_t wr;
+
+	wr = write(c->tr.fd, c->spill + c->spill_off,
+			c->spill_len - c->spill_off);
+	if (wr <= 0)
+		return;
+	c->spill_off += wr;
+	if (c->spill_off == c->spill_len)
+		c->spill_off = c->spill_len = 0;
+}
+
+/* Function to route every complete frame received, frames following
+ * each other on one channel leave in one write
+ */
+static void demux(struct uim_mux *mux)
+{
+	const struct st_proto *pr;
+	unsigned int avail, span = 0, frames = 0;
+	unsigned char cmd;
+	int chan = 0;
+	long len;
+
+	for (;;) {
+		avail = mux->tail - mux->head - span;
+		if (!avail)
+			break;
+		cmd = mux->ring[(mux->head + span) & UIM_MUX_RING_MASK];
+		if (cmd >= HCILL_GO_TO_SLEEP_IND && cmd <= HCILL_WAKE_UP_ACK) {
+			forward(mux, chan, span, frames);
+			span = frames = 0;
+			handle_ll(mux, cmd);
+			mux->head++;
+			continue;
+		}
+
+		len = ring_frame(mux, mux->head + span, avail, &pr);
+		if (len < 0) {
+			forward(mux, chan, span, frames);
+			span = frames = 0;
+			mux->head++;
+			mux->resync_bytes++;
+			continue;
+		}
+		if (!len || (unsigned int) len > avail)
+			break;
+
+		if (pr->chan != chan) {
+			forward(mux, chan, span, frames);
+			span = frames = 0;
+			chan = pr->chan;
+		}
+		span += len;
+		frames++;
+	}
+	forward(mux, chan, span, frames);
+}
+
+/* Read as much as the ring and the driver allow, -1 once the UART is
+ * gone
+ */
+static int read_uart(struct uim_mux *mux)
+{
+	unsigned int off, space;
+	ssize_t rd;
+
+	for (;;) {
+		off = mux->tail & UIM_MUX_RING_MASK;
+		space = UIM_MUX_RING_SIZE - (mux->tail - mux->head);
+		if (space > UIM_MUX_RING_SIZE - off)
+			space = UIM_MUX_RING_SIZE - off;
+		if (!space)
+			return 0;
+
+		rd = uim_transport_read(mux->tr, mux->ring + off, space);
+		if (rd > 0) {
+			mux->tail += rd;
+			continue;
+		}
+		if (rd < 0 && (errno == EAGAIN || errno == EINTR))
+			return 0;
+		UIM_ERR("mux: UART %s", rd ? strerror(errno) : "closed");
+		return -1;
+	}
+}
+
+/* Function to take what the clients of a channel wrote and find the
+ * whole frames in it. Bytes that start no frame of the channel are
+ * dropped one at a time until one does.
+ */
+static void read_chan(struct uim_mux *mux, int chan)
+{
+	struct uim_mux_chan *c = &mux->chan[chan];
+	const struct st_proto *pr;
+	unsigned int avail;
+	ssize_t rd;
+	long len;
+
+	rd = uim_transport_read(&c->tr, c->tx + c->tx_len,
+			UIM_MUX_TX_SIZE - c->tx_len);
+	if (rd <= 0)
+		return;
+	c->tx_len += rd;
+
+	while ((avail = c->tx_len - c->tx_ready) > 0) {
+		len = parse_frame(c->tx + c->tx_ready, avail, DIR_TX, &pr);
+		if (len < 0 || (len > 0 && pr->chan != chan)) {
+			memmove(c->tx + c->tx_ready, c->tx + c->tx_ready + 1,
+					avail - 1);
+			c->tx_len--;
+			c->stats.invalid++;
+			continue;
+		}
+		if (!len || (unsigned int) len > avail)
+			break;
+		c->tx_ready += len;
+		c->stats.tx_frames++;
+	}
+}
+
+static void wake_up(struct uim_mux *mux)
+{
+	send_ll(mux, HCILL_WAKE_UP_IND);
+	mux->ll = UIM_LL_WAKING;
+	uim_deadline_set(&mux->wake_deadline, UIM_MUX_WAKE_TIMEOUT_MS);
+}
+
+/* Function to drop the len bytes of a channel the UART took, the
+ * first rest of them completing a frame it took only part of before.
+ * Returns what is left of the frame the write stopped in, 0 if it
+ * stopped at a frame boundary.
+ */
+static unsigned int sent_tx(struct uim_mux_chan *c, unsigned int len,
+		unsigned int rest)
+{
+	const struct st_proto *pr;
+	unsigned int pos = rest;
+
+	/* the bytes up to tx_ready are whole frames */
+	while (pos < len)
+		pos += parse_frame(c->tx + pos, c->tx_ready - pos, DIR_TX, &pr);
+
+	c->stats.tx_bytes += len;
+	c->tx_len -= len;
+	c->tx_ready -= len;
+	memmove(c->tx, c->tx + len, c->tx_len);
+	return pos - len;
+}
+
+/* Function to finish the frame the UART took only part of, nothing
+ * may go out between its bytes. Returns -1 while some are left.
+ */
+static int send_rest(struct uim_mux *mux)
+{
+	struct uim_mux_chan *c = &mux->chan[mux->tx_chan];
+	struct iovec iov = { c->tx, mux->tx_rest };
+	size_t done;
+
+	if (write_uart(mux, &iov, 1, &done) < 0)
+		UIM_ERR("mux: UART write failed (%s), %lu bytes kept",
+				strerror(errno),
+				(unsigned long)(mux->tx_rest - done));
+	mux->tx_rest = sent_tx(c, done, mux->tx_rest);
+	return mux->tx_rest ? -1 : 0;
+}
+
+/* Function to send the whole frames of every channel in one write, or
+ * to wake the controller up first. What the UART did not take stays
+ * queued for the next call, behind what it did, and the rest of a
+ * frame it cut leaves before anything else.
+ */
+static void send_tx(struct uim_mux *mux)
+{
+	struct iovec iov[UIM_MUX_CHANNELS];
+	struct uim_mux_chan *c;
+	size_t done, len, total = 0;
+	int i, n = 0;
+
+	if (mux->tx_rest && send_rest(mux) < 0)
+		return;
+	if (mux->ll_out) {
+		send_ll(mux, mux->ll_out);
+		mux->ll_out = 0;
+	}
+
+	for (i = 0; i < UIM_MUX_CHANNELS; i++) {
+		c = &mux->chan[i];
+		if (!c->tx_ready)
+			continue;
+		iov[n].iov_base = c->tx;
+		iov[n].iov_len = c->tx_ready;
+		total += c->tx_ready;
+		n++;
+	}
+	if (!n)
+		return;
+
+	if (mux->ll == UIM_LL_WAKING &&
+			uim_deadline_ms_left(&mux->wake_deadline) <= 0) {
+		UIM_ERR("mux: wake-up not acknowledged, sending it again");
+		wake_up(mux);
+	}
+	if (mux->ll == UIM_LL_ASLEEP)
+		wake_up(mux);
+	if (mux->ll == UIM_LL_WAKING)
+		return;
+
+	if (write_uart(mux, iov, n, &done) < 0)
+		UIM_ERR("mux: UART write failed (%s), %lu bytes kept",
+				strerror(errno), (unsigned long)(total - done));
+
+	for (i = 0; i < UIM_MUX_CHANNELS && done; i++) {
+		c = &mux->chan[i];
+		len = c->tx_ready < done ? c->tx_ready : done;
+		done -= len;
+		mux->tx_chan = i;
+		mux->tx_rest = sent_tx(c, len, 0);
+	}
+}
+
+/* Function to tell whether frames wait for the UART, not for a wake-up
+ * acknowledgement
+ */
+static int tx_pending(const struct uim_mux *mux)
+{
+	int i;
+
+	if (mux->tx_rest || mux->ll_out)
+		return 1;
+	if (mux->ll == UIM_LL_WAKING)
+		return 0;
+	for (i = 0; i < UIM_MUX_CHANNELS; i++)
+		if (mux->chan[i].tx_ready)
+			return 1;
+	return 0;
+}
+
+static void *mux_thread(void *arg)
+{
+	struct uim_mux *mux = arg;
+	struct pollfd p[2 + UIM_MUX_CHANNELS];
+	struct uim_mux_chan *c;
+	int i, timeout;
+
+	/* what arrived between the last reply of the bring-up and now */
+	demux(mux);
+
+	p[0].fd = mux->tr->fd;
+	p[1].fd = mux->stop_fd;
+	p[1].events = POLLIN;
+
+	for (;;) {
+		/* frames kept after a failed write are retried on room */
+		p[0].events = POLLIN | (tx_pending(mux) ? POLLOUT : 0);
+		timeout = -1;
+		if (mux->ll == UIM_LL_WAKING)
+			timeout = uim_deadline_ms_left(&mux->wake_deadline);
+		for (i = 0; i < UIM_MUX_CHANNELS; i++) {
+			c = &mux->chan[i];
+			p[2 + i].fd = c->tr.fd;
+			p[2 + i].events = (c->tx_len < UIM_MUX_TX_SIZE ? POLLIN : 0) |
+				(c->spill_len ? POLLOUT : 0);
+		}
+		if (poll(p, 2 + UIM_MUX_CHANNELS, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			UIM_ERR("mux: poll (%s)", strerror(errno));
+			break;
+		}
+		if (p[1].revents)
+			break;
+
+		if (p[0].revents & ~POLLOUT) {
+			if (read_uart(mux) < 0)
+				break;
+			demux(mux);
+		}
+		for (i = 0; i < UIM_MUX_CHANNELS; i++) {
+			if (p[2 + i].revents & POLLOUT)
+				flush_spill(&mux->chan[i]);
+			if (p[2 + i].revents & POLLIN)
+				read_chan(mux, i);
+		}
+		send_tx(mux);
+	}
+
+	return NULL;
+}
+
+/* Function to create the pty of a channel and publish its slave */
+static int open_chan(struct uim_mux_chan *c, const char *name,
+		const char *dir, int chan)
+{
+	char peer[PATH_MAX];
+
+	if (uim_transport_pty(&c->tr, peer, sizeof(peer)) < 0) {
+		UIM_ERR("mux: can't allocate a pty (%s)", strerror(errno));
+		return -1;
+	}
+	c->peer_fd = open(peer, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (c->peer_fd < 0) {
+		UIM_ERR("mux: can't open %s (%s)", peer, strerror(errno));
+		return -1;
+	}
+	fcntl(c->tr.fd, F_SETFD, FD_CLOEXEC);
+#ifdef ANDROID
+	if (chown(peer, AID_BLUETOOTH, AID_BLUETOOTH) < 0)
+		UIM_ERR("mux: can't hand %s over (%s)", peer, strerror(errno));
+#endif
+	chmod(peer, 0660);
+
+	snprintf(c->link, sizeof(c->link), "%s/%s.%s", dir, name,
+			chan_names[chan]);
+	unlink(c->link);
+	if (symlink(peer, c->link) < 0) {
+		UIM_ERR("mux: can't link %s (%s)", c->link, strerror(errno));
+		c->link[0] = '\0';
+		return -1;
+	}
+	UIM_DBG("%s channel on %s", chan_names[chan], c->link);
+	return 0;
+}
+
+static void free_mux(struct uim_mux *mux)
+{
+	struct uim_mux_chan *c;
+	int i;
+
+	for (i = 0; i < UIM_MUX_CHANNELS; i++) {
+		c = &mux->chan[i];
+		if (c->link[0])
+			unlink(c->link);
+		if (c->peer_fd >= 0)
+			close(c->peer_fd);
+		if (c->tr.ops)
+			uim_transport_close(&c->tr);
+	}
+	if (mux->stop_fd >= 0)
+		close(mux->stop_fd);
+	free(mux);
+}
+
+/* Function to serve the channels of an initialised controller from
+ * user space, in place of the N_TI_WL line discipline. The UART is
+ * taken over from rx, including the bytes it buffered. Returns NULL
+ * if the channels could not be set up.
+ */
+struct uim_mux *uim_mux_start(struct uim_rx *rx, const char *name,
+		const char *dir)
+{
+	struct uim_mux *mux;
+	int i;
+
+	UIM_START_FUNC();
+
+	if (rx->tr->fd < 0) {
+		UIM_ERR("mux: %s transport can't be polled", rx->tr->ops->name);
+		return NULL;
+	}
+	mux = calloc(1, sizeof(*mux));
+	if (!mux)
+		return NULL;
+	mux->tr = rx->tr;
+	mux->ll = UIM_LL_AWAKE;
+	for (i = 0; i < UIM_MUX_CHANNELS; i++)
+		mux->chan[i].peer_fd = -1;
+
+	mux->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mux->stop_fd < 0)
+		goto fail;
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		UIM_ERR("mux: can't create %s (%s)", dir, strerror(errno));
+		goto fail;
+	}
+	for (i = 0; i < UIM_MUX_CHANNELS; i++)
+		if (open_chan(&mux->chan[i], name, dir, i) < 0)
+			goto fail;
+
+	while (rx->head != rx->tail)
+		mux->ring[mux->tail++] = rx->buf[rx->head++ & UIM_RX_BUF_MASK];
+
+	if (pthread_create(&mux->thread, NULL, mux_thread, mux) != 0) {
+		UIM_ERR("mux: can't start thread");
+		goto fail;
+	}
+	return mux;
+
+fail:
+	free_mux(mux);
+	return NULL;
+}
+
+/* Function to stop serving the channels, the UART is left open */
+void uim_mux_stop(struct uim_mux *mux)
+{
+	uint64_t one = 1;
+
+	if (write(mux->stop_fd, &one, sizeof(one)) == sizeof(one))
+		pthread_join(mux->thread, NULL);
+	free_mux(mux);
+}
+
+/* Function to describe the traffic of a channel on one line */
+int uim_mux_format(const struct uim_mux *mux, int chan, char *buf,
+		size_t size)
+{
+	const struct uim_mux_stats *st = &mux->chan[chan].stats;
+
+	return snprintf(buf, size, "%s %s rx %lu/%luB tx %lu/%luB dropped %lu "
+			"invalid %lu", chan_names[chan], mux->chan[chan].link,
+			st->rx_frames, st->rx_bytes, st->tx_frames, st->tx_bytes,
+			st->dropped, st->invalid);
+}
@@ -0,0 +1,141 @@
+/*
+ *  User Mode Init manager - user space channel multiplexer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_MUX_H
+#define UIM_MUX_H
+
+#include <limits.h>
+#include <pthread.h>
+
+#include "uim_rx.h"
+
+/* Without the TI shared transport driver the UART is served from here:
+ * the frames the WL1283 sends are split by channel byte into one pty
+ * per channel, and the frames written to the ptys are sent to it.
+ * Each pty carries the frames as they are on the UART, channel byte
+ * included, the BT one is a plain H4 link.
+ *
+ * The HCILL sleep protocol is answered here, a frame written while the
+ * controller sleeps wakes it first.
+ *
+ * The slave side of every pty is published as a symlink
+ * <dir>/<instance>.<channel>.
+ */
+#ifdef ANDROID
+#define UIM_MUX_DIR		"/dev/uim"
+#else
+#define UIM_MUX_DIR		"/tmp/uim_mux"
+#endif
+
+/* Channel bytes besides the HCI ones */
+#define ST_FM_CH8_PKT		0x08
+#define ST_GPS_CH9_PKT		0x09
+
+/* HCILL power management, single byte frames */
+#define HCILL_GO_TO_SLEEP_IND	0x30
+#define HCILL_GO_TO_SLEEP_ACK	0x31
+#define HCILL_WAKE_UP_IND	0x32
+#define HCILL_WAKE_UP_ACK	0x33
+
+/* Received bytes buffered, must be a power of two */
+#define UIM_MUX_RING_SIZE	65536
+#define UIM_MUX_RING_MASK	(UIM_MUX_RING_SIZE - 1)
+
+/* Largest frame forwarded either way, longer lengths are taken for
+ * noise. Holds any ACL frame of the WL1283.
+ */
+#define UIM_MUX_MAX_FRAME	4096
+
+/* Bytes written by the clients of a channel and not sent yet */
+#define UIM_MUX_TX_SIZE		(2 * UIM_MUX_MAX_FRAME)
+
+enum uim_mux_chan_id {
+	UIM_MUX_BT,
+	UIM_MUX_FM,
+	UIM_MUX_GPS,
+	UIM_MUX_CHANNELS
+};
+
+enum uim_mux_ll_state {
+	UIM_LL_AWAKE,
+	UIM_LL_ASLEEP,
+	UIM_LL_WAKING,		/* wake up indication sent */
+};
+
+struct uim_mux_stats {
+	unsigned long rx_frames;	/* to the clients */
+	unsigned long rx_bytes;
+	unsigned long tx_frames;	/* from the clients */
+	unsigned long tx_bytes;		/* written to the controller */
+	unsigned long dropped;		/* frames the pty had no room for */
+	unsigned long invalid;		/* bytes written that were no frame */
+};
+
+struct uim_mux_chan {
+	struct uim_transport tr;	/* pty master */
+	int peer_fd;		/* slave, held so the master never hangs up */
+	char link[PATH_MAX];
+
+	/* frames from the clients, the first tx_ready bytes are whole */
+	unsigned char tx[UIM_MUX_TX_SIZE];
+	unsigned int tx_len;
+	unsigned int tx_ready;
+
+	/* rest of a frame the pty took only part of */
+	unsigned char spill[UIM_MUX_MAX_FRAME];
+	unsigned int spill_off;
+	unsigned int spill_len;
+
+	struct uim_mux_stats stats;
+};
+
+struct uim_mux {
+	struct uim_transport *tr;
+	int stop_fd;
+	pthread_t thread;
+	enum uim_mux_ll_state ll;
+	struct timespec wake_deadline;	/* while UIM_LL_WAKING */
+	unsigned char ll_out;		/* HCILL answer not sent yet, or 0 */
+
+	/* channel of the frame the UART took only part of, and how many
+	 * of its bytes are left
+	 */
+	int tx_chan;
+	unsigned int tx_rest;
+
+	/* received bytes, head and tail run free as in struct uim_rx */
+	unsigned int head;
+	unsigned int tail;
+	unsigned char ring[UIM_MUX_RING_SIZE];
+
+	struct uim_mux_chan chan[UIM_MUX_CHANNELS];
+
+	unsigned long resync_bytes;	/* received bytes that were no frame */
+	unsigned long writes;		/* writes to the UART */
+	unsigned long sleeps;
+	unsigned long wakeups;
+};
+
+struct uim_mux *uim_mux_start(struct uim_rx *rx, const char *name,
+		const char *dir);
+void uim_mux_stop(struct uim_mux *mux);
+int uim_mux_format(const struct uim_mux *mux, int chan, char *buf,
+		size_t size);
+const char *uim_mux_chan_name(int chan);
+
+#endif /* UIM_MUX_H */
@@ -0,0 +1,65 @@
+/*
+ *  User Mode Init manager - single producer single consumer queue
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "uim_queue.h"
+
+void uim_queue_init(struct uim_queue *q)
+{
+	q->head = q->tail = 0;
+}
+
+/* Producer side, returns -1 when the queue is full */
+int uim_queue_push(struct uim_queue *q, const struct uim_install_req *req)
+{
+	unsigned int tail = q->tail;
+
+	if (tail - q->head == UIM_QUEUE_SIZE)
+		return -1;
+
+	q->req[tail & UIM_QUEUE_MASK] = *req;
+	/* the entry must be visible before the consumer can see it */
+	__sync_synchronize();
+	q->tail = tail + 1;
+
+	return 0;
+}
+
+/* Consumer side, returns -1 when the queue is empty */
+int uim_queue_pop(struct uim_queue *q, struct uim_install_req *req)
+{
+	unsigned int head = q->head;
+
+	if (head == q->tail)
+		return -1;
+
+	/* no reading the entry before seeing the tail that published it */
+	__sync_synchronize();
+	*req = q->req[head & UIM_QUEUE_MASK];
+	/* nor handing the slot back before it was read */
+	__sync_synchronize();
+	q->head = head + 1;
+
+	return 0;
+}
+
+/* Consumer side, whether anything was pushed since the last pop */
+int uim_queue_empty(const struct uim_queue *q)
+{
+	__sync_synchronize();
+	return q->head == q->tail;
+}
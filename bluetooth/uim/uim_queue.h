@@ -0,0 +1,47 @@
+/*
+ *  User Mode Init manager - single producer single consumer queue
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_QUEUE_H
+#define UIM_QUEUE_H
+
+/* Entries of a queue, must be a power of two */
+#define UIM_QUEUE_SIZE		16
+#define UIM_QUEUE_MASK		(UIM_QUEUE_SIZE - 1)
+
+/* Install state requested from an instance thread */
+struct uim_install_req {
+	unsigned char install;
+	unsigned char restart;		/* tear down before bringing up */
+};
+
+/* Lock-free ring between exactly one producer and one consumer thread.
+ * head is only written by the consumer and tail only by the producer,
+ * both are free running counters.
+ */
+struct uim_queue {
+	volatile unsigned int head;
+	volatile unsigned int tail;
+	struct uim_install_req req[UIM_QUEUE_SIZE];
+};
+
+void uim_queue_init(struct uim_queue *q);
+int uim_queue_push(struct uim_queue *q, const struct uim_install_req *req);
+int uim_queue_pop(struct uim_queue *q, struct uim_install_req *req);
+int uim_queue_empty(const struct uim_queue *q);
+
+#endif /* UIM_QUEUE_H */
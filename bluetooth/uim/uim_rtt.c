@@ -0,0 +1,119 @@
+/*
+ *  User Mode Init manager - command round trip times
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "uim_rtt.h"
+
+void uim_rtt_init(struct uim_rtt *rtt)
+{
+	memset(rtt, 0, sizeof(*rtt));
+}
+
+/* Function to find the entry of an opcode at a rate, adding it when
+ * there is room. Returns NULL for untracked pairs.
+ */
+struct uim_rtt_entry *uim_rtt_get(struct uim_rtt *rtt, uint16_t opcode,
+		long baud)
+{
+	struct uim_rtt_entry *e;
+	int i;
+
+	for (i = 0; i < rtt->n; i++) {
+		e = &rtt->entry[i];
+		if (e->opcode == opcode && e->baud == baud)
+			return e;
+	}
+	if (rtt->n == UIM_RTT_ENTRIES)
+		return NULL;
+
+	e = &rtt->entry[rtt->n++];
+	memset(e, 0, sizeof(*e));
+	e->opcode = opcode;
+	e->baud = baud;
+	return e;
+}
+
+void uim_rtt_sample(struct uim_rtt_entry *e, long us)
+{
+	int b = 0, i;
+
+	while (us > 1 && b < UIM_RTT_BUCKETS - 1) {
+		us >>= 1;
+		b++;
+	}
+	e->bucket[b]++;
+	e->count++;
+	e->samples++;
+
+	if (e->count >= UIM_RTT_AGE_SAMPLES) {
+		e->count = 0;
+		for (i = 0; i < UIM_RTT_BUCKETS; i++) {
+			e->bucket[i] >>= 1;
+			e->count += e->bucket[i];
+		}
+	}
+}
+
+/* Function to get an upper bound of a quantile, in 1/1000 */
+long uim_rtt_quantile_us(const struct uim_rtt_entry *e, int permille)
+{
+	unsigned long want, seen = 0;
+	int b;
+
+	if (!e->count)
+		return 0;
+	want = (e->count * permille + 999) / 1000;
+	for (b = 0; b < UIM_RTT_BUCKETS - 1; b++) {
+		seen += e->bucket[b];
+		if (seen >= want)
+			break;
+	}
+	return 2L << b;
+}
+
+/* Function to get the time allowed for an attempt at a command,
+ * max_ms until enough round trips were seen
+ */
+int uim_rtt_deadline_ms(const struct uim_rtt_entry *e, int attempt,
+		int max_ms)
+{
+	long ms;
+
+	if (!e || e->count < UIM_RTT_MIN_SAMPLES)
+		return max_ms;
+
+	ms = (uim_rtt_quantile_us(e, 990) * UIM_RTT_FACTOR + 999) / 1000;
+	if (ms < UIM_RTT_FLOOR_MS)
+		ms = UIM_RTT_FLOOR_MS;
+	while (attempt-- > 0 && ms < max_ms)
+		ms <<= 1;
+	return ms < max_ms ? ms : max_ms;
+}
+
+/* Function to describe an entry on one line */
+int uim_rtt_format(const struct uim_rtt_entry *e, char *buf, size_t size)
+{
+	return snprintf(buf, size, "0x%04x %ld n %lu p50 %ldus p99 %ldus "
+			"deadline %dms timeouts %lu retries %lu",
+			e->opcode, e->baud, e->samples,
+			uim_rtt_quantile_us(e, 500), uim_rtt_quantile_us(e, 990),
+			uim_rtt_deadline_ms(e, 0, e->max_ms), e->timeouts, e->retries);
+}
@@ -0,0 +1,75 @@
+/*
+ *  User Mode Init manager - command round trip times
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_RTT_H
+#define UIM_RTT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Bucket i counts the round trips of [2^i, 2^(i+1)) us, the last one
+ * everything slower
+ */
+#define UIM_RTT_BUCKETS		24
+
+/* Opcode and rate pairs tracked, others keep their fixed timeouts */
+#define UIM_RTT_ENTRIES		64
+
+/* Samples needed before a learned deadline replaces the fixed one */
+#define UIM_RTT_MIN_SAMPLES	8
+
+/* Older samples are halved once this many were taken, so the
+ * histogram follows a controller whose timing drifts
+ */
+#define UIM_RTT_AGE_SAMPLES	1024
+
+/* A first attempt waits this many times the 99th percentile, each
+ * retry twice as long as the one before, never less than the floor
+ * and never more than the timeout of the command description
+ */
+#define UIM_RTT_FACTOR		4
+#define UIM_RTT_FLOOR_MS	5
+
+/* Round trips of one opcode at one UART rate */
+struct uim_rtt_entry {
+	uint16_t opcode;
+	long baud;
+	unsigned long count;	/* in the histogram, aged */
+	unsigned long samples;	/* all time */
+	unsigned long timeouts;
+	unsigned long retries;
+	int max_ms;		/* fixed timeout of the command */
+	unsigned long bucket[UIM_RTT_BUCKETS];
+};
+
+/* Per-instance statistics, kept across bring-ups */
+struct uim_rtt {
+	int n;
+	struct uim_rtt_entry entry[UIM_RTT_ENTRIES];
+};
+
+void uim_rtt_init(struct uim_rtt *rtt);
+struct uim_rtt_entry *uim_rtt_get(struct uim_rtt *rtt, uint16_t opcode,
+		long baud);
+void uim_rtt_sample(struct uim_rtt_entry *e, long us);
+long uim_rtt_quantile_us(const struct uim_rtt_entry *e, int permille);
+int uim_rtt_deadline_ms(const struct uim_rtt_entry *e, int attempt,
+		int max_ms);
+int uim_rtt_format(const struct uim_rtt_entry *e, char *buf, size_t size);
+
+#endif /* UIM_RTT_H */
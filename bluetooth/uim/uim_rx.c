@@ -0,0 +1,228 @@
+/*
+ *  User Mode Init manager - HCI event receive engine
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+#include "uim.h"
+#include "uim_rx.h"
+
+/* Set a CLOCK_MONOTONIC deadline timeout_ms from now */
+void uim_deadline_set(struct timespec *deadline, int timeout_ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += timeout_ms / 1000;
+	deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+/* Function to tell whether deadline a comes before b */
+int uim_deadline_before(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+	return a->tv_nsec < b->tv_nsec;
+}
+
+/* Milliseconds left until the given CLOCK_MONOTONIC deadline */
+int uim_deadline_ms_left(const struct timespec *deadline)
+{
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+		(deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+	return ms > 0 ? (int) ms : 0;
+}
+
+static inline unsigned int rx_count(const struct uim_rx *rx)
+{
+	return rx->tail - rx->head;
+}
+
+static inline unsigned char rx_peek(const struct uim_rx *rx, unsigned int off)
+{
+	return rx->buf[(rx->head + off) & UIM_RX_BUF_MASK];
+}
+
+/* Function to record len bytes from the head of the ring */
+static void rx_snoop(struct uim_rx *rx, unsigned int len)
+{
+	struct iovec iov[2];
+	unsigned int off = rx->head & UIM_RX_BUF_MASK;
+
+	if (!rx->snoop || !len)
+		return;
+	iov[0].iov_base = rx->buf + off;
+	iov[0].iov_len = UIM_RX_BUF_SIZE - off < len ? UIM_RX_BUF_SIZE - off : len;
+	iov[1].iov_base = rx->buf;
+	iov[1].iov_len = len - iov[0].iov_len;
+	uim_snoop_record(rx->snoop, UIM_SNOOP_RECEIVED, iov, 2);
+}
+
+/* Drop everything buffered in front of the next event prefix.
+ *
+ * The buffered bytes live in at most two contiguous segments of the
+ * ring, each of them is scanned with a single memchr. What is dropped
+ * is still captured, noise after a speed change is worth seeing.
+ */
+static void rx_resync(struct uim_rx *rx)
+{
+	unsigned int count, off, seg;
+	unsigned char *p;
+
+	while ((count = rx_count(rx)) > 0) {
+		off = rx->head & UIM_RX_BUF_MASK;
+		seg = UIM_RX_BUF_SIZE - off;
+		if (seg > count)
+			seg = count;
+
+		p = memchr(rx->buf + off, RESP_PREFIX, seg);
+		if (p) {
+			rx_snoop(rx, p - (rx->buf + off));
+			rx->dropped_bytes += p - (rx->buf + off);
+			rx->head += p - (rx->buf + off);
+			return;
+		}
+		rx_snoop(rx, seg);
+		rx->dropped_bytes += seg;
+		rx->head += seg;
+	}
+}
+
+/* Read as many bytes as the ring and the driver allow */
+static int rx_fill(struct uim_rx *rx)
+{
+	unsigned int off, space;
+	int rd;
+
+	off = rx->tail & UIM_RX_BUF_MASK;
+	space = UIM_RX_BUF_SIZE - rx_count(rx);
+	if (space > UIM_RX_BUF_SIZE - off)
+		space = UIM_RX_BUF_SIZE - off;
+
+	rd = uim_transport_read(rx->tr, rx->buf + off, space);
+	if (rd > 0) {
+		rx->tail += rd;
+		rx->read_bytes += rd;
+	}
+
+	return rd;
+}
+
+void uim_rx_init(struct uim_rx *rx, struct uim_transport *tr)
+{
+	rx->tr = tr;
+	rx->cancel_fd = -1;
+	rx->snoop = NULL;
+	rx->head = rx->tail = 0;
+	rx->read_bytes = rx->written_bytes = rx->dropped_bytes = 0;
+}
+
+void uim_rx_set_snoop(struct uim_rx *rx, struct uim_snoop *snoop)
+{
+	rx->snoop = snoop;
+}
+
+/* Function to give waits a way out: as soon as cancel_fd becomes
+ * readable they fail with ECANCELED. It is only polled, never read.
+ */
+void uim_rx_set_cancel(struct uim_rx *rx, int cancel_fd)
+{
+	rx->cancel_fd = cancel_fd;
+}
+
+/* Forget any buffered bytes, to be used together with tcflush() */
+void uim_rx_flush(struct uim_rx *rx)
+{
+	rx->head = rx->tail;
+}
+
+/* Function to read one complete HCI event from the transport
+ *
+ * Bytes are pulled from the driver in bulk whenever they are reported,
+ * anything in front of the 0x04 prefix is skipped. The whole frame is
+ * consumed from the ring, at most size bytes of it are copied to buf.
+ * Returns the number of bytes copied or -1 once the deadline expires,
+ * with errno set to ECANCELED if the wait was cancelled.
+ */
+int uim_rx_read_event(struct uim_rx *rx, unsigned char *buf, int size,
+		int timeout_ms)
+{
+	struct timespec deadline;
+	unsigned int frame, len, i;
+	int rd, err;
+
+	if (size <= 0)
+		return -1;
+
+	uim_deadline_set(&deadline, timeout_ms);
+
+	for (;;) {
+		rx_resync(rx);
+
+		/* prefix, event code and parameter total length */
+		if (rx_count(rx) >= 1 + HCI_EVENT_HDR_SIZE) {
+			frame = 1 + HCI_EVENT_HDR_SIZE + rx_peek(rx, 2);
+			if (rx_count(rx) >= frame) {
+				len = frame < (unsigned int) size ? frame : (unsigned int) size;
+				for (i = 0; i < len; i++)
+					buf[i] = rx_peek(rx, i);
+				rx_snoop(rx, frame);
+				rx->head += frame;
+				return len;
+			}
+		}
+
+		err = uim_transport_wait(rx->tr, POLLIN, rx->cancel_fd,
+				uim_deadline_ms_left(&deadline));
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ECANCELED)
+				UIM_DBG(" Cancelled while waiting for event");
+			else
+				UIM_ERR(" wait err (%s)", strerror(errno));
+			return -1;
+		}
+		if (err == 0) {
+			UIM_ERR(" Timed out waiting for event");
+			return -1;
+		}
+
+		rd = rx_fill(rx);
+		if (rd == 0) {
+			UIM_ERR(" UART closed while waiting for event");
+			return -1;
+		}
+		if (rd < 0 && errno != EAGAIN && errno != EINTR) {
+			UIM_ERR(" read err (%s)", strerror(errno));
+			return -1;
+		}
+	}
+}
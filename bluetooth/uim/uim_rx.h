@@ -0,0 +1,63 @@
+/*
+ *  User Mode Init manager - HCI event receive engine
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_RX_H
+#define UIM_RX_H
+
+#include <time.h>
+
+#include "uim_snoop.h"
+#include "uim_transport.h"
+
+/* Size of the receive ring, must be a power of two and hold at least
+ * one maximum sized HCI event (1 + 2 + 255 bytes)
+ */
+#define UIM_RX_BUF_SIZE		1024
+#define UIM_RX_BUF_MASK		(UIM_RX_BUF_SIZE - 1)
+
+/* Default time allowed for a complete event to arrive */
+#define UIM_RX_TIMEOUT_MS	200
+
+/* Receive state for one transport. head and tail are free running
+ * counters, the ring position is obtained by masking them.
+ */
+struct uim_rx {
+	struct uim_transport *tr;
+	int cancel_fd;		/* aborts waits once readable, -1 if none */
+	struct uim_snoop *snoop;	/* records the traffic, NULL if none */
+	unsigned int head;	/* next byte to be consumed */
+	unsigned int tail;	/* next byte to be filled */
+	/* traffic since uim_rx_init(), for the metrics */
+	unsigned long read_bytes;
+	unsigned long written_bytes;
+	unsigned long dropped_bytes;	/* skipped in front of events */
+	unsigned char buf[UIM_RX_BUF_SIZE];
+};
+
+void uim_deadline_set(struct timespec *deadline, int timeout_ms);
+int uim_deadline_ms_left(const struct timespec *deadline);
+int uim_deadline_before(const struct timespec *a, const struct timespec *b);
+
+void uim_rx_init(struct uim_rx *rx, struct uim_transport *tr);
+void uim_rx_set_cancel(struct uim_rx *rx, int cancel_fd);
+void uim_rx_set_snoop(struct uim_rx *rx, struct uim_snoop *snoop);
+void uim_rx_flush(struct uim_rx *rx);
+int uim_rx_read_event(struct uim_rx *rx, unsigned char *buf, int size,
+		int timeout_ms);
+
+#endif /* UIM_RX_H */
@@ -0,0 +1,432 @@
+/*
+ *  User Mode Init manager - WL1283 controller simulator
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The simulator answers on the master side of a pseudo-terminal the way
+ * a WL1283 answers on its UART, and fakes the KIM sysfs attributes in a
+ * temporary directory pointing at the slave side. It is only meant for
+ * host builds, to exercise and time st_uart_config() without hardware.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <termios.h>
+
+#include "uim.h"
+#include "uim_sim.h"
+#include "uim_baud.h"
+#include "uim_link.h"
+
+/* Answer to HCI_Read_Local_Version_Information: HCI 4.0, TI, and a LMP
+ * subversion decoding to the 7.2.31 (WL1283) firmware family
+ */
+static const unsigned char local_version[] = {
+	0x06, 0x00, 0x00, 0x06, 0x0d, 0x00, 0x1f, 0x1d
+};
+
+static void ts_add_us(struct timespec *ts, unsigned long us)
+{
+	ts->tv_sec += us / 1000000;
+	ts->tv_nsec += (us % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static int ts_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static int write_attr(struct uim_sim *sim, const char *attr, const char *val)
+{
+	char path[PATH_MAX];
+	int fd, len, ret;
+
+	if (snprintf(path, sizeof(path), "%s/%s", sim->sysfs_dir, attr) >=
+			(int)sizeof(path)) {
+		UIM_ERR("sim: path of %s too long", attr);
+		return -1;
+	}
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		UIM_ERR("sim: can't create %s (%s)", path, strerror(errno));
+		return -1;
+	}
+	len = strlen(val);
+	ret = write(fd, val, len);
+	close(fd);
+
+	return ret == len ? 0 : -1;
+}
+
+static void remove_attr(struct uim_sim *sim, const char *attr)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", sim->sysfs_dir, attr) <
+			(int)sizeof(path))
+		unlink(path);
+}
+
+/* Take a slot for an event, NULL when the queue is full */
+static struct uim_sim_rsp *alloc_event(struct uim_sim *sim, uint16_t opcode)
+{
+	if (sim->rsp_count == UIM_SIM_MAX_PENDING) {
+		UIM_ERR("sim: reply queue full, dropping 0x%04x", opcode);
+		return NULL;
+	}
+	return &sim->rsp[(sim->rsp_head + sim->rsp_count) % UIM_SIM_MAX_PENDING];
+}
+
+/* Queue the event built in the slot from alloc_event(), due once the
+ * configured delay and jitter have elapsed. Replies never overtake
+ * each other, with wire set each one also waits for the previous one
+ * to be transmitted.
+ */
+static void queue_event(struct uim_sim *sim, struct uim_sim_rsp *rsp)
+{
+	struct uim_sim_rsp *prev;
+	unsigned long us, rate;
+
+	us = sim->cfg.delay_us;
+	if (sim->cfg.jitter_us)
+		us += rand_r(&sim->seed) % (sim->cfg.jitter_us + 1);
+	clock_gettime(CLOCK_MONOTONIC, &rsp->due);
+	ts_add_us(&rsp->due, us);
+
+	if (sim->rsp_count) {
+		prev = &sim->rsp[(sim->rsp_head + sim->rsp_count - 1) %
+			UIM_SIM_MAX_PENDING];
+		if (ts_before(&rsp->due, &prev->due))
+			rsp->due = prev->due;
+	}
+	if (sim->cfg.wire) {
+		rate = sim->speed ? sim->speed : UIM_BAUD_DEFAULT;
+		ts_add_us(&rsp->due, rsp->len * 10 * 1000000ULL / rate);
+	}
+	sim->rsp_count++;
+}
+
+static void queue_cmd_complete(struct uim_sim *sim, uint16_t opcode,
+		uint8_t status, const unsigned char *param, unsigned int plen)
+{
+	struct uim_sim_rsp *rsp = alloc_event(sim, opcode);
+
+	if (!rsp)
+		return;
+	rsp->buf[0] = HCI_EVENT_PKT;
+	rsp->buf[1] = EVT_CMD_COMPLETE;
+	rsp->buf[2] = EVT_CMD_COMPLETE_SIZE + 1 + plen;
+	rsp->buf[3] = sim->cfg.ncmd;
+	rsp->buf[4] = opcode & 0xff;
+	rsp->buf[5] = opcode >> 8;
+	rsp->buf[6] = status;
+	if (plen)
+		memcpy(rsp->buf + 7, param, plen);
+	rsp->len = 7 + plen;
+	queue_event(sim, rsp);
+}
+
+/* Send a command back in a Loopback Command event, cut to fit */
+static void queue_loopback(struct uim_sim *sim, uint16_t opcode,
+		const unsigned char *param, unsigned int plen)
+{
+	struct uim_sim_rsp *rsp = alloc_event(sim, opcode);
+
+	if (!rsp)
+		return;
+	if (plen > 255 - HCI_COMMAND_HDR_SIZE)
+		plen = 255 - HCI_COMMAND_HDR_SIZE;
+	rsp->buf[0] = HCI_EVENT_PKT;
+	rsp->buf[1] = EVT_LOOPBACK_COMMAND;
+	rsp->buf[2] = HCI_COMMAND_HDR_SIZE + plen;
+	rsp->buf[3] = opcode & 0xff;
+	rsp->buf[4] = opcode >> 8;
+	rsp->buf[5] = plen;
+	memcpy(rsp->buf + 6, param, plen);
+	rsp->len = 6 + plen;
+	queue_event(sim, rsp);
+}
+
+static void handle_command(struct uim_sim *sim, uint16_t opcode,
+		const unsigned char *param, unsigned int plen)
+{
+	/* of the commands still executed in loopback mode, only the
+	 * one leaving it is simulated
+	 */
+	if (sim->loopback && opcode != HCI_WRITE_LOOPBACK_MODE_OPCODE) {
+		sim->looped++;
+		queue_loopback(sim, opcode, param, plen);
+		return;
+	}
+
+	sim->cmds++;
+
+	switch (opcode) {
+	case HCI_HDR_OPCODE:
+		if (plen >= 4)
+			sim->speed = param[0] | param[1] << 8 |
+				param[2] << 16 | (unsigned long) param[3] << 24;
+		queue_cmd_complete(sim, opcode, 0, NULL, 0);
+		break;
+	case WRITE_BD_ADDR_OPCODE:
+		if (plen >= sizeof(bdaddr_t))
+			memcpy(&sim->bdaddr, param, sizeof(bdaddr_t));
+		queue_cmd_complete(sim, opcode, 0, NULL, 0);
+		break;
+	case HCI_READ_LOCAL_VERSION_OPCODE:
+		queue_cmd_complete(sim, opcode, 0, local_version,
+				sizeof(local_version));
+		break;
+	case HCI_WRITE_LOOPBACK_MODE_OPCODE:
+		sim->loopback = plen ? param[0] : 0;
+		queue_cmd_complete(sim, opcode, 0, NULL, 0);
+		break;
+	default:
+		/* vendor specific init commands are accepted blindly */
+		if ((opcode >> 10) == 0x3f) {
+			queue_cmd_complete(sim, opcode, 0, NULL, 0);
+		} else {
+			sim->unknown_cmds++;
+			queue_cmd_complete(sim, opcode, HCI_UNKNOWN_COMMAND,
+					NULL, 0);
+		}
+		break;
+	}
+}
+
+/* Consume every complete command packet received so far */
+static void parse_commands(struct uim_sim *sim)
+{
+	unsigned char *p;
+	unsigned int len;
+
+	for (;;) {
+		p = memchr(sim->rx, HCI_COMMAND_PKT, sim->rx_len);
+		if (!p) {
+			sim->rx_len = 0;
+			return;
+		}
+		if (p != sim->rx) {
+			sim->rx_len -= p - sim->rx;
+			memmove(sim->rx, p, sim->rx_len);
+		}
+		if (sim->rx_len < 1 + HCI_COMMAND_HDR_SIZE)
+			return;
+
+		len = 1 + HCI_COMMAND_HDR_SIZE + sim->rx[3];
+		if (sim->rx_len < len)
+			return;
+
+		handle_command(sim, sim->rx[1] | sim->rx[2] << 8,
+				sim->rx + 1 + HCI_COMMAND_HDR_SIZE, sim->rx[3]);
+
+		sim->rx_len -= len;
+		memmove(sim->rx, sim->rx + len, sim->rx_len);
+	}
+}
+
+static void send_due_replies(struct uim_sim *sim)
+{
+	struct uim_sim_rsp *rsp;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while (sim->rsp_count) {
+		rsp = &sim->rsp[sim->rsp_head];
+		if (ts_before(&now, &rsp->due))
+			return;
+		if (write(sim->master_fd, rsp->buf, rsp->len) != (int) rsp->len)
+			UIM_ERR("sim: short reply write (%s)", strerror(errno));
+		sim->rsp_head = (sim->rsp_head + 1) % UIM_SIM_MAX_PENDING;
+		sim->rsp_count--;
+	}
+}
+
+static void *sim_thread(void *arg)
+{
+	struct uim_sim *sim = arg;
+	struct pollfd p[2];
+	struct timespec now, tmo, *ptmo;
+	int rd;
+
+	p[0].fd = sim->master_fd;
+	p[0].events = POLLIN;
+	p[1].fd = sim->stop_fd[0];
+	p[1].events = POLLIN;
+
+	for (;;) {
+		ptmo = NULL;
+		if (sim->rsp_count) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			tmo = sim->rsp[sim->rsp_head].due;
+			tmo.tv_sec -= now.tv_sec;
+			tmo.tv_nsec -= now.tv_nsec;
+			if (tmo.tv_nsec < 0) {
+				tmo.tv_sec--;
+				tmo.tv_nsec += 1000000000L;
+			}
+			if (tmo.tv_sec < 0)
+				tmo.tv_sec = tmo.tv_nsec = 0;
+			ptmo = &tmo;
+		}
+
+		if (ppoll(p, 2, ptmo, NULL) < 0 && errno != EINTR)
+			break;
+		if (p[1].revents)
+			break;
+
+		if (p[0].revents & POLLIN) {
+			rd = read(sim->master_fd, sim->rx + sim->rx_len,
+					UIM_SIM_RX_SIZE - sim->rx_len);
+			if (rd > 0) {
+				sim->rx_len += rd;
+				parse_commands(sim);
+			}
+		}
+		send_due_replies(sim);
+	}
+
+	return NULL;
+}
+
+/* Function to start a simulated controller
+ *
+ * Opens the pseudo-terminal, creates the fake KIM sysfs directory
+ * and starts answering commands from a dedicated thread.
+ */
+int uim_sim_start(struct uim_sim *sim, const struct uim_sim_cfg *cfg)
+{
+	struct termios ti;
+	char val[32];
+	char *name;
+
+	memset(sim, 0, sizeof(*sim));
+	sim->cfg = *cfg;
+	if (!sim->cfg.ncmd)
+		sim->cfg.ncmd = 1;
+	sim->seed = getpid();
+	sim->stop_fd[0] = sim->stop_fd[1] = -1;
+	sim->master_fd = sim->slave_fd = -1;
+
+	sim->master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (sim->master_fd < 0 || grantpt(sim->master_fd) < 0 ||
+			unlockpt(sim->master_fd) < 0) {
+		UIM_ERR("sim: can't allocate pty (%s)", strerror(errno));
+		goto fail;
+	}
+	name = ptsname(sim->master_fd);
+	if (!name || strlen(name) > UART_DEV_NAME_LEN) {
+		UIM_ERR("sim: unusable pty name");
+		goto fail;
+	}
+	strcpy(sim->pty_name, name);
+
+	/* Keep the slave open ourselves, so that the master does not see
+	 * a hangup every time uim closes the UART
+	 */
+	sim->slave_fd = open(sim->pty_name, O_RDWR | O_NOCTTY);
+	if (sim->slave_fd < 0) {
+		UIM_ERR("sim: can't open %s (%s)", sim->pty_name, strerror(errno));
+		goto fail;
+	}
+	if (tcgetattr(sim->slave_fd, &ti) == 0) {
+		cfmakeraw(&ti);
+		tcsetattr(sim->slave_fd, TCSANOW, &ti);
+	}
+
+	snprintf(sim->sysfs_dir, sizeof(sim->sysfs_dir), "%s/uim_sim.XXXXXX",
+			P_tmpdir);
+	if (!mkdtemp(sim->sysfs_dir)) {
+		UIM_ERR("sim: can't create sysfs dir (%s)", strerror(errno));
+		sim->sysfs_dir[0] = '\0';
+		goto fail;
+	}
+
+	snprintf(val, sizeof(val), "%ld\n", sim->cfg.baud_rate);
+	if (write_attr(sim, INSTALL_SYSFS_ENTRY, "0\n") < 0 ||
+			write_attr(sim, DEV_NAME_SYSFS, sim->pty_name) < 0 ||
+			write_attr(sim, BAUD_RATE_SYSFS, val) < 0 ||
+			write_attr(sim, FLOW_CTRL_SYSFS,
+				sim->cfg.flow_ctrl ? "1\n" : "0\n") < 0)
+		goto fail;
+
+	if (pipe(sim->stop_fd) < 0)
+		goto fail;
+
+	if (pthread_create(&sim->thread, NULL, sim_thread, sim) != 0) {
+		UIM_ERR("sim: can't start thread");
+		goto fail;
+	}
+	sim->running = 1;
+
+	return 0;
+
+fail:
+	uim_sim_stop(sim);
+	return -1;
+}
+
+void uim_sim_stop(struct uim_sim *sim)
+{
+	if (sim->running) {
+		if (write(sim->stop_fd[1], "", 1) == 1)
+			pthread_join(sim->thread, NULL);
+		sim->running = 0;
+	}
+	if (sim->stop_fd[0] >= 0) {
+		close(sim->stop_fd[0]);
+		close(sim->stop_fd[1]);
+		sim->stop_fd[0] = sim->stop_fd[1] = -1;
+	}
+
+	if (sim->sysfs_dir[0]) {
+		remove_attr(sim, INSTALL_SYSFS_ENTRY);
+		remove_attr(sim, DEV_NAME_SYSFS);
+		remove_attr(sim, BAUD_RATE_SYSFS);
+		remove_attr(sim, FLOW_CTRL_SYSFS);
+		rmdir(sim->sysfs_dir);
+		sim->sysfs_dir[0] = '\0';
+	}
+
+	if (sim->slave_fd >= 0)
+		close(sim->slave_fd);
+	if (sim->master_fd >= 0)
+		close(sim->master_fd);
+	sim->slave_fd = sim->master_fd = -1;
+}
+
+/* Mirror what the KIM driver does when a protocol registers */
+int uim_sim_set_install(struct uim_sim *sim, unsigned char install)
+{
+	char val[3] = { install, '\n', '\0' };
+
+	return write_attr(sim, INSTALL_SYSFS_ENTRY, val);
+}
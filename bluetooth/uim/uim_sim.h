@@ -0,0 +1,80 @@
+/*
+ *  User Mode Init manager - WL1283 controller simulator
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_SIM_H
+#define UIM_SIM_H
+
+#include <limits.h>
+#include <pthread.h>
+
+/* Status returned for commands the simulator does not know */
+#define HCI_UNKNOWN_COMMAND		0x01
+
+#define UIM_SIM_RX_SIZE		1024
+#define UIM_SIM_RSP_MAX		(1 + HCI_EVENT_HDR_SIZE + 255)
+#define UIM_SIM_MAX_PENDING	32
+
+/* Behaviour of the simulated controller */
+struct uim_sim_cfg {
+	long baud_rate;		/* exported through baud_rate */
+	int flow_ctrl;		/* exported through flow_cntrl */
+	unsigned int delay_us;	/* time to answer a command */
+	unsigned int jitter_us;	/* random extra time added to delay_us */
+	unsigned int ncmd;	/* command credits advertised in replies */
+	int wire;		/* events take their time on the wire, 8N1 */
+};
+
+/* Event waiting for its due time */
+struct uim_sim_rsp {
+	struct timespec due;
+	unsigned int len;
+	unsigned char buf[UIM_SIM_RSP_MAX];
+};
+
+struct uim_sim {
+	struct uim_sim_cfg cfg;
+	int master_fd;
+	int slave_fd;
+	int stop_fd[2];
+	char pty_name[UART_DEV_NAME_LEN + 1];
+	char sysfs_dir[PATH_MAX];
+	pthread_t thread;
+	int running;
+	unsigned int seed;
+
+	unsigned char rx[UIM_SIM_RX_SIZE];
+	unsigned int rx_len;
+
+	struct uim_sim_rsp rsp[UIM_SIM_MAX_PENDING];
+	unsigned int rsp_head;
+	unsigned int rsp_count;
+
+	/* what the host did to the controller */
+	unsigned long cmds;
+	unsigned long unknown_cmds;
+	unsigned long speed;
+	bdaddr_t bdaddr;
+	int loopback;		/* HCI loopback mode */
+	unsigned long looped;	/* commands sent back in loopback mode */
+};
+
+int uim_sim_start(struct uim_sim *sim, const struct uim_sim_cfg *cfg);
+void uim_sim_stop(struct uim_sim *sim);
+int uim_sim_set_install(struct uim_sim *sim, unsigned char install);
+
+#endif /* UIM_SIM_H */
@@ -0,0 +1,93 @@
+/*
+ *  User Mode Init manager - standalone WL1283 controller simulator
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "uim.h"
+#include "uim_sim.h"
+
+static void usage(void)
+{
+	UIM_ERR("Usage: uim_sim [-b baud] [-f flow] [-d delay_us] "
+			"[-j jitter_us] [-n ncmd] [-w]");
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+	struct uim_sim_cfg cfg = {
+		.baud_rate = 3000000,
+		.flow_ctrl = 1,
+		.delay_us = 500,
+		.jitter_us = 0,
+		.ncmd = 1,
+	};
+	struct uim_sim sim;
+	sigset_t set;
+	int opt, sig;
+
+	while ((opt = getopt(argc, argv, "b:f:d:j:n:w")) != -1) {
+		switch (opt) {
+		case 'b':
+			cfg.baud_rate = strtol(optarg, NULL, 0);
+			break;
+		case 'f':
+			cfg.flow_ctrl = atoi(optarg);
+			break;
+		case 'd':
+			cfg.delay_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			cfg.jitter_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			cfg.ncmd = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			/* pace the events at the UART rate */
+			cfg.wire = 1;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	if (uim_sim_start(&sim, &cfg) < 0)
+		return -1;
+
+	printf("pty %s\nsysfs %s\n", sim.pty_name, sim.sysfs_dir);
+	fflush(stdout);
+
+	sigwait(&set, &sig);
+
+	uim_sim_stop(&sim);
+	printf("%lu commands, %lu unknown, last speed %lu\n",
+			sim.cmds, sim.unknown_cmds, sim.speed);
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ *  User Mode Init manager - HCI capture
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "uim.h"
+#include "uim_snoop.h"
+
+/* btsnoop file format, all fields big endian */
+#define BTSNOOP_VERSION		1
+#define BTSNOOP_DATALINK_H4	1002
+#define BTSNOOP_FLAG_RECEIVED	0x01
+#define BTSNOOP_FLAG_CMD_EVT	0x02
+/* microseconds from 0000-01-01 to 1970-01-01 */
+#define BTSNOOP_EPOCH_DELTA	0x00dcddb30f2f8000ULL
+
+void uim_snoop_init(struct uim_snoop *snoop)
+{
+	snoop->head = snoop->tail = 0;
+	snoop->dropped = 0;
+}
+
+static void ring_put(struct uim_snoop *snoop, unsigned int pos,
+		const void *data, unsigned int len)
+{
+	unsigned int off = pos & UIM_SNOOP_BUF_MASK;
+	unsigned int seg = UIM_SNOOP_BUF_SIZE - off;
+
+	if (seg > len)
+		seg = len;
+	memcpy(snoop->buf + off, data, seg);
+	memcpy(snoop->buf, (const unsigned char *)data + seg, len - seg);
+}
+
+static void ring_get(const struct uim_snoop *snoop, unsigned int pos,
+		void *data, unsigned int len)
+{
+	unsigned int off = pos & UIM_SNOOP_BUF_MASK;
+	unsigned int seg = UIM_SNOOP_BUF_SIZE - off;
+
+	if (seg > len)
+		seg = len;
+	memcpy(data, snoop->buf + off, seg);
+	memcpy((unsigned char *)data + seg, snoop->buf, len - seg);
+}
+
+/* Function to record one packet gathered from iov, called on every
+ * write and read of the UART: no allocation, no formatting, the
+ * oldest records make room when needed
+ */
+void uim_snoop_record(struct uim_snoop *snoop, enum uim_snoop_dir dir,
+		const struct iovec *iov, int iovcnt)
+{
+	struct uim_snoop_rec rec, old;
+	struct timespec ts;
+	unsigned int len = 0, pos;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (!len || sizeof(rec) + len > UIM_SNOOP_BUF_SIZE)
+		return;
+
+	while (snoop->tail - snoop->head + sizeof(rec) + len >
+			UIM_SNOOP_BUF_SIZE) {
+		ring_get(snoop, snoop->head, &old, sizeof(old));
+		snoop->head += sizeof(old) + old.len;
+		snoop->dropped++;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec.ts_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	rec.len = len;
+	rec.dir = dir;
+	rec.pad = 0;
+
+	pos = snoop->tail;
+	ring_put(snoop, pos, &rec, sizeof(rec));
+	pos += sizeof(rec);
+	for (i = 0; i < iovcnt; i++) {
+		ring_put(snoop, pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
+	snoop->tail = pos;
+}
+
+static void put_be64(unsigned char *p, uint64_t v)
+{
+	uint32_t hi = htonl(v >> 32), lo = htonl(v & 0xffffffff);
+
+	memcpy(p, &hi, 4);
+	memcpy(p + 4, &lo, 4);
+}
+
+/* Function to write the recorded packets, oldest first, as a btsnoop
+ * file with the H4 datalink, so that the packet type byte is kept
+ */
+int uim_snoop_dump(const struct uim_snoop *snoop, int fd)
+{
+	unsigned char hdr[24], data[UIM_SNOOP_BUF_SIZE];
+	struct uim_snoop_rec rec;
+	uint32_t v[4];
+	unsigned int pos;
+	int len;
+
+	memcpy(hdr, "btsnoop\0", 8);
+	v[0] = htonl(BTSNOOP_VERSION);
+	v[1] = htonl(BTSNOOP_DATALINK_H4);
+	memcpy(hdr + 8, v, 8);
+	if (write(fd, hdr, 16) != 16)
+		return -1;
+
+	for (pos = snoop->head; pos != snoop->tail;
+			pos += sizeof(rec) + rec.len) {
+		ring_get(snoop, pos, &rec, sizeof(rec));
+		ring_get(snoop, pos + sizeof(rec), data, rec.len);
+
+		v[0] = v[1] = htonl(rec.len);
+		v[2] = rec.dir == UIM_SNOOP_RECEIVED ? BTSNOOP_FLAG_RECEIVED : 0;
+		/* commands and events are told apart from ACL/SCO data */
+		if (data[0] == 0x01 || data[0] == 0x04)
+			v[2] |= BTSNOOP_FLAG_CMD_EVT;
+		v[2] = htonl(v[2]);
+		v[3] = 0;
+		memcpy(hdr, v, 16);
+		put_be64(hdr + 16, rec.ts_us + BTSNOOP_EPOCH_DELTA);
+
+		len = sizeof(hdr);
+		if (write(fd, hdr, len) != len ||
+				write(fd, data, rec.len) != rec.len)
+			return -1;
+	}
+	return 0;
+}
+
+/* Function to write the capture of an instance to UIM_SNOOP_DIR,
+ * path receives the name of the file
+ */
+int uim_snoop_save(const struct uim_snoop *snoop, const char *name,
+		char *path, size_t size)
+{
+	int fd, err;
+
+	snprintf(path, size, "%s/uim_%s.btsnoop", UIM_SNOOP_DIR, name);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		UIM_ERR("Can't open %s (%s)", path, strerror(errno));
+		return -1;
+	}
+	err = uim_snoop_dump(snoop, fd);
+	if (err < 0)
+		UIM_ERR("Failed to write %s (%s)", path, strerror(errno));
+	close(fd);
+	return err;
+}
@@ -0,0 +1,70 @@
+/*
+ *  User Mode Init manager - HCI capture
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_SNOOP_H
+#define UIM_SNOOP_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Bytes of traffic kept per UART, must be a power of two. A bring-up
+ * exchanges a few hundred bytes, so this spans many of them.
+ */
+#define UIM_SNOOP_BUF_SIZE	16384
+#define UIM_SNOOP_BUF_MASK	(UIM_SNOOP_BUF_SIZE - 1)
+
+/* Where captures are written, as uim_<instance>.btsnoop */
+#ifdef ANDROID
+#define UIM_SNOOP_DIR		"/data/misc/bluetooth"
+#else
+#define UIM_SNOOP_DIR		"/tmp"
+#endif
+
+/* Direction of a record, as seen from the host */
+enum uim_snoop_dir {
+	UIM_SNOOP_SENT = 0,
+	UIM_SNOOP_RECEIVED = 1,
+};
+
+/* Header of a record in the ring, its bytes follow unpadded */
+struct uim_snoop_rec {
+	uint64_t ts_us;		/* CLOCK_REALTIME */
+	uint16_t len;
+	uint8_t dir;
+	uint8_t pad;
+};
+
+/* Ring of the packets written to and read from a UART. Recording only
+ * copies bytes behind a binary header, the oldest records are
+ * overwritten. head and tail are free running counters.
+ */
+struct uim_snoop {
+	unsigned int head;	/* oldest record */
+	unsigned int tail;	/* where the next record goes */
+	unsigned long dropped;	/* records overwritten so far */
+	unsigned char buf[UIM_SNOOP_BUF_SIZE];
+};
+
+void uim_snoop_init(struct uim_snoop *snoop);
+void uim_snoop_record(struct uim_snoop *snoop, enum uim_snoop_dir dir,
+		const struct iovec *iov, int iovcnt);
+int uim_snoop_dump(const struct uim_snoop *snoop, int fd);
+int uim_snoop_save(const struct uim_snoop *snoop, const char *name,
+		char *path, size_t size);
+
+#endif /* UIM_SNOOP_H */
@@ -0,0 +1,107 @@
+/*
+ *  User Mode Init manager - metrics reader
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Prints the metrics page of a running uim as text, once or every
+ * interval. The page is only mapped and read, uim is never asked.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "uim.h"
+#include "uim_metrics.h"
+
+static void usage(void)
+{
+	UIM_ERR("Usage: uim_stat [-f metrics] [-i interval_ms] [-n count]");
+}
+
+static int dump_page(const struct uim_metrics_page *page)
+{
+	struct uim_metrics m;
+	char line[64];
+	int i, len;
+
+	len = snprintf(line, sizeof(line), "uim_start_time_seconds %lld\n",
+			(long long) page->start_time);
+	if (write(STDOUT_FILENO, line, len) != len)
+		return -1;
+	for (i = 0; i < page->nslots; i++) {
+		if (uim_metrics_read(&page->slot[i], &m) < 0) {
+			UIM_ERR("Slot %d kept changing", i);
+			continue;
+		}
+		if (uim_metrics_dump(&m, STDOUT_FILENO) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+	const struct uim_metrics_page *page;
+	const char *path = UIM_METRICS_FILE;
+	struct timespec ts;
+	unsigned long count = 1, interval_ms = 0, i;
+	size_t size;
+	int opt, counted = 0;
+
+	while ((opt = getopt(argc, argv, "f:i:n:")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'i':
+			interval_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			counted = 1;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+	/* an interval alone means until interrupted */
+	if (interval_ms && !counted)
+		count = 0;
+
+	page = uim_metrics_open(path, &size);
+	if (!page) {
+		UIM_ERR("Can't map %s (%s)", path, strerror(errno));
+		return -1;
+	}
+
+	ts.tv_sec = interval_ms / 1000;
+	ts.tv_nsec = (interval_ms % 1000) * 1000000L;
+	for (i = 0; !count || i < count; i++) {
+		if (i)
+			nanosleep(&ts, NULL);
+		if (dump_page(page) < 0)
+			return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ *  User Mode Init manager - bring-up phase tracing
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "uim_trace.h"
+
+static const char *phase_names[UIM_TRACE_PHASES] = {
+	[UIM_TRACE_SYSFS_DEV_NAME] = "sysfs_dev_name",
+	[UIM_TRACE_SYSFS_BAUD_RATE] = "sysfs_baud_rate",
+	[UIM_TRACE_SYSFS_FLOW_CTRL] = "sysfs_flow_cntrl",
+	[UIM_TRACE_UART_OPEN] = "uart_open",
+	[UIM_TRACE_SET_BAUD_RATE] = "set_baud_rate",
+	[UIM_TRACE_SPEED_CHANGE_WRITE] = "speed_change_write",
+	[UIM_TRACE_SPEED_CHANGE_WAIT] = "speed_change_wait",
+	[UIM_TRACE_SET_CUSTOM_BAUD_RATE] = "set_custom_baud_rate",
+	[UIM_TRACE_BAUD_PROBE] = "baud_probe",
+	[UIM_TRACE_FW_DOWNLOAD] = "fw_download",
+	[UIM_TRACE_BD_ADDR] = "bd_addr",
+	[UIM_TRACE_FW_VERSION] = "fw_version",
+	[UIM_TRACE_SET_LDISC] = "set_ldisc",
+};
+
+static inline struct uim_trace_cycle *current(struct uim_trace *trace)
+{
+	return &trace->cycle[trace->seq % UIM_TRACE_CYCLES];
+}
+
+static long ts_diff_us(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000000L +
+		(b->tv_nsec - a->tv_nsec) / 1000;
+}
+
+static inline int ts_set(const struct timespec *ts)
+{
+	return ts->tv_sec || ts->tv_nsec;
+}
+
+/* Start recording a new cycle, overwriting the oldest one */
+void uim_trace_begin_cycle(struct uim_trace *trace)
+{
+	struct uim_trace_cycle *cycle;
+
+	trace->seq++;
+	cycle = current(trace);
+	memset(cycle, 0, sizeof(*cycle));
+	cycle->seq = trace->seq;
+	clock_gettime(CLOCK_MONOTONIC, &cycle->begin);
+}
+
+void uim_trace_end_cycle(struct uim_trace *trace, int result)
+{
+	struct uim_trace_cycle *cycle = current(trace);
+
+	cycle->result = result;
+	clock_gettime(CLOCK_MONOTONIC, &cycle->end);
+}
+
+void uim_trace_begin(struct uim_trace *trace, enum uim_trace_phase phase)
+{
+	clock_gettime(CLOCK_MONOTONIC, &current(trace)->span[phase].begin);
+}
+
+void uim_trace_end(struct uim_trace *trace, enum uim_trace_phase phase)
+{
+	clock_gettime(CLOCK_MONOTONIC, &current(trace)->span[phase].end);
+}
+
+/* Most recent cycle, or NULL if nothing was traced yet */
+const struct uim_trace_cycle *uim_trace_last(const struct uim_trace *trace)
+{
+	if (!trace->seq)
+		return NULL;
+	return &trace->cycle[trace->seq % UIM_TRACE_CYCLES];
+}
+
+/* Duration of a completed span, -1 if it did not run or complete */
+long uim_trace_span_us(const struct uim_trace_span *span)
+{
+	if (!ts_set(&span->begin) || !ts_set(&span->end))
+		return -1;
+	return ts_diff_us(&span->begin, &span->end);
+}
+
+/* Duration of a completed cycle, -1 while it is still running */
+long uim_trace_cycle_us(const struct uim_trace_cycle *cycle)
+{
+	if (!ts_set(&cycle->end))
+		return -1;
+	return ts_diff_us(&cycle->begin, &cycle->end);
+}
+
+/* Phase a cycle stopped in, -1 if none was left unfinished */
+int uim_trace_failed_phase(const struct uim_trace_cycle *cycle)
+{
+	int phase;
+
+	for (phase = UIM_TRACE_PHASES - 1; phase >= 0; phase--)
+		if (ts_set(&cycle->span[phase].begin) &&
+				!ts_set(&cycle->span[phase].end))
+			return phase;
+	return -1;
+}
+
+const char *uim_trace_phase_name(enum uim_trace_phase phase)
+{
+	return phase_names[phase];
+}
+
+/* Function to write the traced cycles, oldest first, as text
+ *
+ * Each phase is reported with its offset from the start of the cycle
+ * and its duration, both in microseconds.
+ */
+int uim_trace_dump(const struct uim_trace *trace, int fd)
+{
+	const struct uim_trace_cycle *cycle;
+	const struct uim_trace_span *span;
+	unsigned long seq, first;
+	char line[128];
+	int len, phase;
+
+	first = trace->seq > UIM_TRACE_CYCLES ?
+		trace->seq - UIM_TRACE_CYCLES + 1 : 1;
+
+	for (seq = first; seq <= trace->seq; seq++) {
+		cycle = &trace->cycle[seq % UIM_TRACE_CYCLES];
+		len = snprintf(line, sizeof(line), "cycle %lu result %d total %ldus\n",
+				cycle->seq, cycle->result,
+				ts_set(&cycle->end) ?
+				ts_diff_us(&cycle->begin, &cycle->end) : -1L);
+		if (write(fd, line, len) != len)
+			return -1;
+
+		for (phase = 0; phase < UIM_TRACE_PHASES; phase++) {
+			span = &cycle->span[phase];
+			if (!ts_set(&span->begin))
+				continue;
+			if (ts_set(&span->end))
+				len = snprintf(line, sizeof(line),
+						"  %-22s +%-8ld %ldus\n",
+						phase_names[phase],
+						ts_diff_us(&cycle->begin, &span->begin),
+						ts_diff_us(&span->begin, &span->end));
+			else
+				len = snprintf(line, sizeof(line),
+						"  %-22s +%-8ld unfinished\n",
+						phase_names[phase],
+						ts_diff_us(&cycle->begin, &span->begin));
+			if (write(fd, line, len) != len)
+				return -1;
+		}
+	}
+
+	return 0;
+}
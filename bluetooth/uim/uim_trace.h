@@ -0,0 +1,78 @@
+/*
+ *  User Mode Init manager - bring-up phase tracing
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_TRACE_H
+#define UIM_TRACE_H
+
+#include <time.h>
+
+/* Number of bring-up cycles kept in memory */
+#define UIM_TRACE_CYCLES	16
+
+/* Phases of st_uart_config(), in execution order */
+enum uim_trace_phase {
+	UIM_TRACE_SYSFS_DEV_NAME,
+	UIM_TRACE_SYSFS_BAUD_RATE,
+	UIM_TRACE_SYSFS_FLOW_CTRL,
+	UIM_TRACE_UART_OPEN,
+	UIM_TRACE_SET_BAUD_RATE,
+	UIM_TRACE_SPEED_CHANGE_WRITE,
+	UIM_TRACE_SPEED_CHANGE_WAIT,
+	UIM_TRACE_SET_CUSTOM_BAUD_RATE,
+	UIM_TRACE_BAUD_PROBE,
+	UIM_TRACE_FW_DOWNLOAD,
+	UIM_TRACE_BD_ADDR,
+	UIM_TRACE_FW_VERSION,
+	UIM_TRACE_SET_LDISC,
+	UIM_TRACE_PHASES
+};
+
+/* A span that was begun but never ended marks the failing phase,
+ * a span with a zero begin was not executed.
+ */
+struct uim_trace_span {
+	struct timespec begin;
+	struct timespec end;
+};
+
+struct uim_trace_cycle {
+	unsigned long seq;
+	int result;
+	struct timespec begin;
+	struct timespec end;
+	struct uim_trace_span span[UIM_TRACE_PHASES];
+};
+
+/* Fixed ring of the last UIM_TRACE_CYCLES bring-up cycles */
+struct uim_trace {
+	unsigned long seq;
+	struct uim_trace_cycle cycle[UIM_TRACE_CYCLES];
+};
+
+void uim_trace_begin_cycle(struct uim_trace *trace);
+void uim_trace_end_cycle(struct uim_trace *trace, int result);
+void uim_trace_begin(struct uim_trace *trace, enum uim_trace_phase phase);
+void uim_trace_end(struct uim_trace *trace, enum uim_trace_phase phase);
+const struct uim_trace_cycle *uim_trace_last(const struct uim_trace *trace);
+long uim_trace_span_us(const struct uim_trace_span *span);
+long uim_trace_cycle_us(const struct uim_trace_cycle *cycle);
+int uim_trace_failed_phase(const struct uim_trace_cycle *cycle);
+const char *uim_trace_phase_name(enum uim_trace_phase phase);
+int uim_trace_dump(const struct uim_trace *trace, int fd);
+
+#endif /* UIM_TRACE_H */
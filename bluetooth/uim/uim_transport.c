@@ -0,0 +1,333 @@
+/*
+ *  User Mode Init manager - UART transports
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "uim.h"
+#include "uim_baud.h"
+#include "uim_transport.h"
+
+/* A descriptor: the UART, or anything else that behaves like one */
+
+static ssize_t fd_read(struct uim_transport *t, void *buf, size_t len)
+{
+	return read(t->fd, buf, len);
+}
+
+static ssize_t fd_writev(struct uim_transport *t, const struct iovec *iov,
+		int iovcnt)
+{
+	return writev(t->fd, iov, iovcnt);
+}
+
+static int fd_wait(struct uim_transport *t, short events, int cancel_fd,
+		int timeout_ms)
+{
+	struct pollfd p[2];
+	int err;
+
+	p[0].fd = t->fd;
+	p[0].events = events;
+	p[0].revents = 0;
+	p[1].fd = cancel_fd;
+	p[1].events = POLLIN;
+	p[1].revents = 0;
+
+	err = poll(p, cancel_fd >= 0 ? 2 : 1, timeout_ms);
+	if (err <= 0)
+		return err;
+	if (p[1].revents) {
+		errno = ECANCELED;
+		return -1;
+	}
+	return p[0].revents;
+}
+
+/* Function to apply a rate and flow control to a tty
+ *
+ * The settings are derived from the last ones read back and written
+ * with a single TCSETS2, nothing is written if they did not change.
+ * They are read back so the cache holds what the driver programmed.
+ */
+static int fd_set_rate(struct uim_transport *t, long rate, int flow_ctrl)
+{
+	struct termios2 ti2;
+
+	if (!t->ti2_valid) {
+		if (ioctl(t->fd, TCGETS2, &t->ti2) < 0) {
+			UIM_ERR(" Can't get port settings (%s)", strerror(errno));
+			return -1;
+		}
+		t->ti2_valid = 1;
+	}
+
+	ti2 = t->ti2;
+	/* raw mode, as cfmakeraw() sets it */
+	ti2.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR |
+			ICRNL | IXON);
+	ti2.c_oflag &= ~OPOST;
+	ti2.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	ti2.c_cflag &= ~(CSIZE | PARENB);
+	ti2.c_cflag |= CS8;
+	ti2.c_cc[VMIN] = 1;
+	ti2.c_cc[VTIME] = 0;
+
+	if (flow_ctrl)
+		ti2.c_cflag |= CRTSCTS;
+	else
+		ti2.c_cflag &= ~CRTSCTS;
+
+	/* same arbitrary rate in both directions */
+	ti2.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	ti2.c_cflag |= BOTHER;
+	ti2.c_ospeed = rate;
+	ti2.c_ispeed = rate;
+
+	if (!memcmp(&ti2, &t->ti2, sizeof(ti2)))
+		return 0;
+
+	t->ti2_valid = 0;
+	if (ioctl(t->fd, TCSETS2, &ti2) < 0) {
+		UIM_ERR(" Can't set %ld baud (%s)", rate, strerror(errno));
+		return -1;
+	}
+	if (ioctl(t->fd, TCGETS2, &t->ti2) < 0) {
+		UIM_ERR(" Can't get port settings (%s)", strerror(errno));
+		return -1;
+	}
+	t->ti2_valid = 1;
+
+	if (uim_baud_error_between(rate, t->ti2.c_ospeed) >
+			UIM_BAUD_MAX_ERROR_PPM) {
+		UIM_ERR(" Asked for %ld baud, UART runs at %d", rate,
+				t->ti2.c_ospeed);
+		return -1;
+	}
+	return 0;
+}
+
+static int fd_flush(struct uim_transport *t, int queue)
+{
+	return tcflush(t->fd, queue);
+}
+
+static int fd_set_ldisc(struct uim_transport *t, int ldisc)
+{
+	return ioctl(t->fd, TIOCSETD, &ldisc);
+}
+
+static void fd_close(struct uim_transport *t)
+{
+	/* the descriptor belongs to the caller */
+	t->fd = -1;
+	t->ti2_valid = 0;
+}
+
+static const struct uim_transport_ops fd_ops = {
+	.name = "fd",
+	.read = fd_read,
+	.writev = fd_writev,
+	.wait = fd_wait,
+	.set_rate = fd_set_rate,
+	.flush = fd_flush,
+	.set_ldisc = fd_set_ldisc,
+	.close = fd_close,
+};
+
+void uim_transport_fd(struct uim_transport *t, int fd)
+{
+	memset(t, 0, sizeof(*t));
+	t->ops = &fd_ops;
+	t->fd = fd;
+}
+
+/* The master side of a pseudo terminal, the controller (or a
+ * simulator of it) opens the peer
+ */
+
+static void pty_close(struct uim_transport *t)
+{
+	if (t->fd >= 0)
+		close(t->fd);
+	t->fd = -1;
+	t->ti2_valid = 0;
+}
+
+static const struct uim_transport_ops pty_ops = {
+	.name = "pty",
+	.read = fd_read,
+	.writev = fd_writev,
+	.wait = fd_wait,
+	.set_rate = fd_set_rate,
+	.flush = fd_flush,
+	.set_ldisc = fd_set_ldisc,
+	.close = pty_close,
+};
+
+/* Function to open a raw, non-blocking pty, the name of its peer is
+ * returned in peer
+ */
+int uim_transport_pty(struct uim_transport *t, char *peer, size_t size)
+{
+	struct termios ti;
+	int fd;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		return -1;
+	if (grantpt(fd) < 0 || unlockpt(fd) < 0 ||
+			ptsname_r(fd, peer, size) != 0) {
+		close(fd);
+		return -1;
+	}
+	if (tcgetattr(fd, &ti) == 0) {
+		cfmakeraw(&ti);
+		tcsetattr(fd, TCSANOW, &ti);
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	memset(t, 0, sizeof(*t));
+	t->ops = &pty_ops;
+	t->fd = fd;
+	return 0;
+}
+
+/* A buffer in memory, for benchmarks and tests. Nothing ever blocks:
+ * a wait with nothing to read times out at once.
+ */
+
+static ssize_t mem_read(struct uim_transport *t, void *buf, size_t len)
+{
+	size_t avail = t->tail - t->head;
+
+	if (!avail) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (len > avail)
+		len = avail;
+	memcpy(buf, t->buf + t->head, len);
+	t->head += len;
+	return len;
+}
+
+static ssize_t mem_writev(struct uim_transport *t, const struct iovec *iov,
+		int iovcnt)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (t->hook)
+		t->hook(t, iov, iovcnt, t->hook_data);
+	return len;
+}
+
+static int mem_wait(struct uim_transport *t, short events, int cancel_fd,
+		int timeout_ms)
+{
+	short ready = POLLOUT;
+
+	if (t->tail != t->head)
+		ready |= POLLIN;
+	return ready & events;
+}
+
+/* Function to take any line setting, there is no line to set */
+static int mem_set_rate(struct uim_transport *t, long rate, int flow_ctrl)
+{
+	return 0;
+}
+
+static int mem_flush(struct uim_transport *t, int queue)
+{
+	return 0;
+}
+
+static int mem_set_ldisc(struct uim_transport *t, int ldisc)
+{
+	return 0;
+}
+
+static void mem_close(struct uim_transport *t)
+{
+	t->head = t->tail = 0;
+}
+
+static const struct uim_transport_ops mem_ops = {
+	.name = "mem",
+	.read = mem_read,
+	.writev = mem_writev,
+	.wait = mem_wait,
+	.set_rate = mem_set_rate,
+	.flush = mem_flush,
+	.set_ldisc = mem_set_ldisc,
+	.close = mem_close,
+};
+
+void uim_transport_mem(struct uim_transport *t, unsigned char *buf,
+		size_t size, uim_transport_hook hook, void *hook_data)
+{
+	memset(t, 0, sizeof(*t));
+	t->ops = &mem_ops;
+	t->fd = -1;
+	t->buf = buf;
+	t->size = size;
+	t->hook = hook;
+	t->hook_data = hook_data;
+}
+
+/* Function to queue bytes to be read from an in-memory transport */
+int uim_transport_mem_push(struct uim_transport *t, const void *data,
+		size_t len)
+{
+	if (t->tail + len > t->size && t->head) {
+		memmove(t->buf, t->buf + t->head, t->tail - t->head);
+		t->tail -= t->head;
+		t->head = 0;
+	}
+	if (t->tail + len > t->size) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	memcpy(t->buf + t->tail, data, len);
+	t->tail += len;
+	return 0;
+}
+
+/* Function to read everything pushed once more, from the start */
+void uim_transport_mem_rewind(struct uim_transport *t)
+{
+	t->head = 0;
+}
+
+void uim_transport_close(struct uim_transport *t)
+{
+	if (t->ops)
+		t->ops->close(t);
+}
@@ -0,0 +1,121 @@
+/*
+ *  User Mode Init manager - UART transports
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program;if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UIM_TRANSPORT_H
+#define UIM_TRANSPORT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "uim.h"
+
+struct uim_transport;
+
+/* What the receive and command engines need from the link to the
+ * controller. read and writev behave like the system calls on a
+ * non-blocking descriptor. wait returns the poll events that became
+ * ready, 0 once timeout_ms passed, or -1 with errno set to ECANCELED
+ * as soon as cancel_fd (if not -1) is readable.
+ *
+ * set_rate, flush and set_ldisc are the line settings and do nothing
+ * where there is no line. set_rate puts the link in raw mode at rate,
+ * with or without RTS/CTS, and fails if the rate the driver actually
+ * programmed is off by more than UIM_BAUD_MAX_ERROR_PPM. flush drops
+ * what the driver queued, queue is one of TCIFLUSH, TCOFLUSH or
+ * TCIOFLUSH.
+ */
+struct uim_transport_ops {
+	const char *name;
+	ssize_t (*read)(struct uim_transport *t, void *buf, size_t len);
+	ssize_t (*writev)(struct uim_transport *t, const struct iovec *iov,
+			int iovcnt);
+	int (*wait)(struct uim_transport *t, short events, int cancel_fd,
+			int timeout_ms);
+	int (*set_rate)(struct uim_transport *t, long rate, int flow_ctrl);
+	int (*flush)(struct uim_transport *t, int queue);
+	int (*set_ldisc)(struct uim_transport *t, int ldisc);
+	void (*close)(struct uim_transport *t);
+};
+
+/* Called with every packet written to an in-memory transport, the
+ * hook answers by pushing events
+ */
+typedef void (*uim_transport_hook)(struct uim_transport *t,
+		const struct iovec *iov, int iovcnt, void *data);
+
+struct uim_transport {
+	const struct uim_transport_ops *ops;
+	int fd;			/* fd and pty transports */
+	/* settings last read back from fd, set_rate skips unchanged ones */
+	struct termios2 ti2;
+	int ti2_valid;
+
+	/* in-memory transport: bytes to be read are buf[head..tail) */
+	unsigned char *buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+	uim_transport_hook hook;
+	void *hook_data;
+};
+
+void uim_transport_fd(struct uim_transport *t, int fd);
+int uim_transport_pty(struct uim_transport *t, char *peer, size_t size);
+void uim_transport_mem(struct uim_transport *t, unsigned char *buf,
+		size_t size, uim_transport_hook hook, void *hook_data);
+int uim_transport_mem_push(struct uim_transport *t, const void *data,
+		size_t len);
+void uim_transport_mem_rewind(struct uim_transport *t);
+void uim_transport_close(struct uim_transport *t);
+
+static inline ssize_t uim_transport_read(struct uim_transport *t, void *buf,
+		size_t len)
+{
+	return t->ops->read(t, buf, len);
+}
+
+static inline ssize_t uim_transport_writev(struct uim_transport *t,
+		const struct iovec *iov, int iovcnt)
+{
+	return t->ops->writev(t, iov, iovcnt);
+}
+
+static inline int uim_transport_wait(struct uim_transport *t, short events,
+		int cancel_fd, int timeout_ms)
+{
+	return t->ops->wait(t, events, cancel_fd, timeout_ms);
+}
+
+static inline int uim_transport_set_rate(struct uim_transport *t, long rate,
+		int flow_ctrl)
+{
+	return t->ops->set_rate(t, rate, flow_ctrl);
+}
+
+static inline int uim_transport_flush(struct uim_transport *t, int queue)
+{
+	return t->ops->flush(t, queue);
+}
+
+static inline int uim_transport_set_ldisc(struct uim_transport *t, int ldisc)
+{
+	return t->ops->set_ldisc(t, ldisc);
+}
+
+#endif /* UIM_TRANSPORT_H */